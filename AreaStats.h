@@ -0,0 +1,160 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "World.h"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Counts of roads, trees and water and the total height over any rectangle of tiles, in the same few lookups
+// whatever its size. Every chunk keeps a summed-area table of its own tiles, so an edit only rebuilds that one.
+// The rest of a rectangle that reaches outside a chunk comes from small tables over whole chunks: the totals of
+// the chunks above and to the left, and the partial rows or columns of the chunks beside and above it
+class AreaStats {
+
+public:
+	struct Totals {
+		int32_t roads = 0;
+		int32_t trees = 0; // Anything growing on the tile
+		int32_t water = 0;
+		int32_t heightSum = 0;
+
+		Totals& operator+=(const Totals& rhs) { roads += rhs.roads; trees += rhs.trees; water += rhs.water; heightSum += rhs.heightSum; return *this; }
+		Totals& operator-=(const Totals& rhs) { roads -= rhs.roads; trees -= rhs.trees; water -= rhs.water; heightSum -= rhs.heightSum; return *this; }
+		Totals operator+(const Totals& rhs) const { return Totals(*this) += rhs; }
+		Totals operator-(const Totals& rhs) const { return Totals(*this) -= rhs; }
+	};
+
+private:
+	ChunkGrid chunks;
+	olc::vi2d tableSize; // Chunk size plus one, the first row and column are zero
+	std::vector<Totals> chunkTables; // Per chunk, the totals from its top left corner up to each of its corners
+	std::vector<Totals> rowPrefix; // Per chunk and row within it, the totals of that many rows of the chunks to its left
+	std::vector<Totals> columnPrefix; // Per chunk and column within it, the totals of that many columns of the chunks above it
+	std::vector<Totals> chunkPrefix; // Per chunk, the totals of all chunks above and to the left of it
+	std::vector<uint8_t> dirty;
+	std::vector<int> dirtyChunks;
+
+public:
+	void Build(const Tile* tiles, const ChunkGrid& chunkGrid)
+	{
+		chunks = chunkGrid;
+		tableSize = chunks.vChunkSize + olc::vi2d(1, 1);
+		chunkTables.assign((size_t)chunks.ChunkCount() * tableSize.x * tableSize.y, {});
+		rowPrefix.assign((size_t)chunks.ChunkCount() * tableSize.y, {});
+		columnPrefix.assign((size_t)chunks.ChunkCount() * tableSize.x, {});
+		chunkPrefix.assign(chunks.ChunkCount(), {});
+		dirty.assign(chunks.ChunkCount(), 0);
+		dirtyChunks.clear();
+
+		for (int chunk = 0; chunk < chunks.ChunkCount(); chunk++) BuildChunk(tiles, chunk);
+		BuildPrefixes(0, 0);
+	}
+
+	// Tiles in the chunk changed, it is rebuilt by the next Update
+	void ChunkChanged(int chunk)
+	{
+		if (dirty[chunk]) return;
+		dirty[chunk] = 1;
+		dirtyChunks.push_back(chunk);
+	}
+
+	void Update(const Tile* tiles)
+	{
+		if (dirtyChunks.empty()) return;
+
+		// Only chunks below or to the right of a changed one have anything of it in their prefixes
+		olc::vi2d first = chunks.vChunkCount;
+		for (int chunk : dirtyChunks) {
+			BuildChunk(tiles, chunk);
+			first = first.min({ chunk % chunks.vChunkCount.x, chunk / chunks.vChunkCount.x });
+			dirty[chunk] = 0;
+		}
+		dirtyChunks.clear();
+		BuildPrefixes(first.x, first.y);
+	}
+
+	// Over the tiles from min up to but not including max, as of the last Update
+	Totals Query(olc::vi2d min, olc::vi2d max) const
+	{
+		min = min.max({ 0, 0 });
+		max = max.min(chunks.vWorldSize);
+		if (min.x >= max.x || min.y >= max.y) return {};
+		return Corner(max.x, max.y) - Corner(min.x, max.y) - Corner(max.x, min.y) + Corner(min.x, min.y);
+	}
+
+private:
+	// Totals from the top left of the world up to but not including (x, y)
+	Totals Corner(int x, int y) const
+	{
+		olc::vi2d chunkPos = { std::min(x / chunks.vChunkSize.x, chunks.vChunkCount.x - 1), std::min(y / chunks.vChunkSize.y, chunks.vChunkCount.y - 1) };
+		olc::vi2d within = olc::vi2d(x, y) - chunkPos * chunks.vChunkSize;
+		int chunk = chunkPos.y * chunks.vChunkCount.x + chunkPos.x;
+
+		return chunkPrefix[chunk]
+			+ rowPrefix[(size_t)chunk * tableSize.y + within.y]
+			+ columnPrefix[(size_t)chunk * tableSize.x + within.x]
+			+ ChunkTable(chunk, within.x, within.y);
+	}
+
+	const Totals& ChunkTable(int chunk, int x, int y) const { return chunkTables[((size_t)chunk * tableSize.y + y) * tableSize.x + x]; }
+	const Totals& ChunkTotal(int chunk) const { return ChunkTable(chunk, tableSize.x - 1, tableSize.y - 1); }
+
+	void BuildChunk(const Tile* tiles, int chunk)
+	{
+		olc::vi2d begin = chunks.ChunkBegin(chunk);
+		Totals* table = &chunkTables[(size_t)chunk * tableSize.x * tableSize.y];
+
+		// Chunks at the edge of the world can be cut short, what is past the edge counts as nothing
+		for (int y = 1; y < tableSize.y; y++) {
+			Totals row;
+			for (int x = 1; x < tableSize.x; x++) {
+				olc::vi2d cell = begin + olc::vi2d(x - 1, y - 1);
+				if (cell.x < chunks.vWorldSize.x && cell.y < chunks.vWorldSize.y) {
+					const Tile& tile = tiles[cell.y * chunks.vWorldSize.x + cell.x];
+					row.roads += tile.ground == roadGround;
+					row.trees += tile.overlay != 0;
+					row.water += tile.ground == 0;
+					row.heightSum += tile.height;
+				}
+				table[y * tableSize.x + x] = table[(y - 1) * tableSize.x + x] + row;
+			}
+		}
+	}
+
+	// Chunks from (firstX, firstY) on, the others only add up chunks before the changed ones
+	void BuildPrefixes(int firstX, int firstY)
+	{
+		const olc::vi2d count = chunks.vChunkCount;
+
+		for (int cy = 0; cy < count.y; cy++) {
+			for (int cx = std::max(firstX, 1); cx < count.x; cx++) {
+				int chunk = cy * count.x + cx;
+				for (int y = 0; y < tableSize.y; y++) {
+					rowPrefix[(size_t)chunk * tableSize.y + y] = rowPrefix[(size_t)(chunk - 1) * tableSize.y + y] + ChunkTable(chunk - 1, tableSize.x - 1, y);
+				}
+			}
+		}
+
+		for (int cy = std::max(firstY, 1); cy < count.y; cy++) {
+			for (int cx = 0; cx < count.x; cx++) {
+				int chunk = cy * count.x + cx;
+				for (int x = 0; x < tableSize.x; x++) {
+					columnPrefix[(size_t)chunk * tableSize.x + x] = columnPrefix[(size_t)(chunk - count.x) * tableSize.x + x] + ChunkTable(chunk - count.x, x, tableSize.y - 1);
+				}
+			}
+		}
+
+		for (int cy = firstY; cy < count.y; cy++) {
+			for (int cx = firstX; cx < count.x; cx++) {
+				Totals totals;
+				if (cx > 0 && cy > 0) {
+					int diagonal = (cy - 1) * count.x + cx - 1;
+					totals = chunkPrefix[diagonal + 1] + chunkPrefix[diagonal + count.x] - chunkPrefix[diagonal] + ChunkTotal(diagonal);
+				}
+				chunkPrefix[cy * count.x + cx] = totals;
+			}
+		}
+	}
+};
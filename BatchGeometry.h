@@ -0,0 +1,264 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "Geometry2D.h"
+#include "Bits.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#if !defined(BATCH_GEOMETRY_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define BATCH_GEOMETRY_SSE2
+#include <emmintrin.h>
+#endif
+
+// Rectangles with every field in its own array, so the same field of four of them loads in one go
+struct RectArray {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> width;
+	std::vector<float> height;
+
+	void Clear() { x.clear(); y.clear(); width.clear(); height.clear(); }
+	int Size() const { return (int)x.size(); }
+
+	void Add(const olc::utils::geom2d::rect<float>& r)
+	{
+		x.push_back(r.pos.x);
+		y.push_back(r.pos.y);
+		width.push_back(r.size.x);
+		height.push_back(r.size.y);
+	}
+
+	olc::utils::geom2d::rect<float> At(int i) const { return { { x[i], y[i] }, { width[i], height[i] } }; }
+};
+
+struct CircleArray {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> radius;
+
+	void Clear() { x.clear(); y.clear(); radius.clear(); }
+	int Size() const { return (int)x.size(); }
+
+	void Add(const olc::utils::geom2d::circle<float>& c)
+	{
+		x.push_back(c.pos.x);
+		y.push_back(c.pos.y);
+		radius.push_back(c.radius);
+	}
+
+	olc::utils::geom2d::circle<float> At(int i) const { return { { x[i], y[i] }, radius[i] }; }
+};
+
+// One shape tested against a whole array of them, four at a time with SSE2 where there is SSE2. Bit i of the mask
+// is set if the scalar geom2d function says so for element i: the same comparisons on the same sums and products,
+// edges and NaNs included, and the elements left over after the last four go through geom2d itself.
+// That holds as long as the compiler doesn't fuse the scalar multiplies and adds, which it doesn't by default.
+// Circles against rectangles with a negative size are the exception, geom2d clamps to them and std::clamp
+// leaves what that gives up to the standard library
+class BatchGeometry {
+
+public:
+	using rect = olc::utils::geom2d::rect<float>;
+	using circle = olc::utils::geom2d::circle<float>;
+
+	// overlaps(query, rects[i])
+	static void Overlaps(const rect& query, const RectArray& rects, std::vector<uint64_t>& mask)
+	{
+		Run(rects.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(query, rects.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, left = _mm_set1_ps(query.pos.x), top = _mm_set1_ps(query.pos.y),
+			right = _mm_set1_ps(query.pos.x + query.size.x), bottom = _mm_set1_ps(query.pos.y + query.size.y)](int i) {
+			__m128 x = _mm_loadu_ps(&rects.x[i]);
+			__m128 y = _mm_loadu_ps(&rects.y[i]);
+			__m128 inX = _mm_and_ps(_mm_cmplt_ps(left, _mm_add_ps(x, _mm_loadu_ps(&rects.width[i]))), _mm_cmpge_ps(right, x));
+			__m128 inY = _mm_and_ps(_mm_cmplt_ps(top, _mm_add_ps(y, _mm_loadu_ps(&rects.height[i]))), _mm_cmpge_ps(bottom, y));
+			return _mm_and_ps(inX, inY);
+		}
+#endif
+		);
+	}
+
+	// overlaps(a[i], b[i]), the arrays the same size
+	static void Overlaps(const RectArray& a, const RectArray& b, std::vector<uint64_t>& mask)
+	{
+		Run(a.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(a.At(i), b.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&](int i) {
+			__m128 ax = _mm_loadu_ps(&a.x[i]);
+			__m128 ay = _mm_loadu_ps(&a.y[i]);
+			__m128 bx = _mm_loadu_ps(&b.x[i]);
+			__m128 by = _mm_loadu_ps(&b.y[i]);
+			__m128 inX = _mm_and_ps(_mm_cmplt_ps(ax, _mm_add_ps(bx, _mm_loadu_ps(&b.width[i]))), _mm_cmpge_ps(_mm_add_ps(ax, _mm_loadu_ps(&a.width[i])), bx));
+			__m128 inY = _mm_and_ps(_mm_cmplt_ps(ay, _mm_add_ps(by, _mm_loadu_ps(&b.height[i]))), _mm_cmpge_ps(_mm_add_ps(ay, _mm_loadu_ps(&a.height[i])), by));
+			return _mm_and_ps(inX, inY);
+		}
+#endif
+		);
+	}
+
+	// contains(query, rects[i])
+	static void Contains(const rect& query, const RectArray& rects, std::vector<uint64_t>& mask)
+	{
+		Run(rects.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::contains(query, rects.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, left = _mm_set1_ps(query.pos.x), top = _mm_set1_ps(query.pos.y),
+			right = _mm_set1_ps(query.pos.x + query.size.x), bottom = _mm_set1_ps(query.pos.y + query.size.y)](int i) {
+			__m128 x = _mm_loadu_ps(&rects.x[i]);
+			__m128 y = _mm_loadu_ps(&rects.y[i]);
+			__m128 inX = _mm_and_ps(_mm_cmpge_ps(x, left), _mm_cmplt_ps(_mm_add_ps(x, _mm_loadu_ps(&rects.width[i])), right));
+			__m128 inY = _mm_and_ps(_mm_cmpge_ps(y, top), _mm_cmplt_ps(_mm_add_ps(y, _mm_loadu_ps(&rects.height[i])), bottom));
+			return _mm_and_ps(inX, inY);
+		}
+#endif
+		);
+	}
+
+	// overlaps(point, rects[i]), i.e. the rectangle holds the point, edges included
+	static void Overlaps(olc::vf2d point, const RectArray& rects, std::vector<uint64_t>& mask)
+	{
+		Run(rects.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(point, rects.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, px = _mm_set1_ps(point.x), py = _mm_set1_ps(point.y)](int i) {
+			// Written as "not outside" like geom2d, which makes a NaN inside
+			__m128 x = _mm_loadu_ps(&rects.x[i]);
+			__m128 y = _mm_loadu_ps(&rects.y[i]);
+			__m128 outside = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(px, x), _mm_cmplt_ps(py, y)),
+				_mm_or_ps(_mm_cmpgt_ps(px, _mm_add_ps(x, _mm_loadu_ps(&rects.width[i]))), _mm_cmpgt_ps(py, _mm_add_ps(y, _mm_loadu_ps(&rects.height[i])))));
+			return _mm_andnot_ps(outside, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+		}
+#endif
+		);
+	}
+
+	// overlaps(query, rects[i])
+	static void Overlaps(const circle& query, const RectArray& rects, std::vector<uint64_t>& mask)
+	{
+		Run(rects.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(query, rects.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, cx = _mm_set1_ps(query.pos.x), cy = _mm_set1_ps(query.pos.y), radius2 = _mm_set1_ps(query.radius * query.radius)](int i) {
+			__m128 x = _mm_loadu_ps(&rects.x[i]);
+			__m128 y = _mm_loadu_ps(&rects.y[i]);
+			__m128 dx = _mm_sub_ps(Clamp(cx, x, _mm_add_ps(x, _mm_loadu_ps(&rects.width[i]))), cx);
+			__m128 dy = _mm_sub_ps(Clamp(cy, y, _mm_add_ps(y, _mm_loadu_ps(&rects.height[i]))), cy);
+			return _mm_cmplt_ps(_mm_sub_ps(ZeroNaN(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), radius2), _mm_setzero_ps());
+		}
+#endif
+		);
+	}
+
+	// overlaps(query, circles[i])
+	static void Overlaps(const rect& query, const CircleArray& circles, std::vector<uint64_t>& mask)
+	{
+		Run(circles.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(query, circles.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, left = _mm_set1_ps(query.pos.x), top = _mm_set1_ps(query.pos.y),
+			right = _mm_set1_ps(query.pos.x + query.size.x), bottom = _mm_set1_ps(query.pos.y + query.size.y)](int i) {
+			__m128 cx = _mm_loadu_ps(&circles.x[i]);
+			__m128 cy = _mm_loadu_ps(&circles.y[i]);
+			__m128 radius = _mm_loadu_ps(&circles.radius[i]);
+			__m128 dx = _mm_sub_ps(Clamp(cx, left, right), cx);
+			__m128 dy = _mm_sub_ps(Clamp(cy, top, bottom), cy);
+			return _mm_cmplt_ps(_mm_sub_ps(ZeroNaN(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), _mm_mul_ps(radius, radius)), _mm_setzero_ps());
+		}
+#endif
+		);
+	}
+
+	// overlaps(query, circles[i])
+	static void Overlaps(const circle& query, const CircleArray& circles, std::vector<uint64_t>& mask)
+	{
+		Run(circles.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(query, circles.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, qx = _mm_set1_ps(query.pos.x), qy = _mm_set1_ps(query.pos.y), qr = _mm_set1_ps(query.radius)](int i) {
+			__m128 dx = _mm_sub_ps(qx, _mm_loadu_ps(&circles.x[i]));
+			__m128 dy = _mm_sub_ps(qy, _mm_loadu_ps(&circles.y[i]));
+			__m128 reach = _mm_add_ps(qr, _mm_loadu_ps(&circles.radius[i]));
+			return _mm_cmple_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(reach, reach));
+		}
+#endif
+		);
+	}
+
+	// overlaps(point, circles[i]), i.e. the point is strictly inside
+	static void Overlaps(olc::vf2d point, const CircleArray& circles, std::vector<uint64_t>& mask)
+	{
+		Run(circles.Size(), mask, [&](int i) {
+			return olc::utils::geom2d::overlaps(point, circles.At(i));
+		}
+#ifdef BATCH_GEOMETRY_SSE2
+		, [&, px = _mm_set1_ps(point.x), py = _mm_set1_ps(point.y)](int i) {
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(&circles.x[i]), px);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(&circles.y[i]), py);
+			__m128 radius = _mm_loadu_ps(&circles.radius[i]);
+			return _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(radius, radius));
+		}
+#endif
+		);
+	}
+
+	// Calls f(i) for every set bit, lowest first
+	template<typename F>
+	static void ForEachSet(const std::vector<uint64_t>& mask, F&& f)
+	{
+		for (size_t word = 0; word < mask.size(); word++) {
+			for (uint64_t bits = mask[word]; bits != 0; bits &= bits - 1) f((int)(word * 64 + CountTrailingZeros(bits)));
+		}
+	}
+
+	static int CountSet(const std::vector<uint64_t>& mask)
+	{
+		int count = 0;
+		for (uint64_t bits : mask) count += PopCount(bits);
+		return count;
+	}
+
+private:
+	// Four elements at a time while there are four left, each group landing in one word as i is a multiple of four
+#ifdef BATCH_GEOMETRY_SSE2
+	template<typename Scalar, typename Simd>
+	static void Run(int count, std::vector<uint64_t>& mask, Scalar&& scalar, Simd&& simd)
+	{
+		mask.assign((count + 63) / 64, 0);
+		int i = 0;
+		for (; i + 4 <= count; i += 4) mask[i >> 6] |= (uint64_t)_mm_movemask_ps(simd(i)) << (i & 63);
+		for (; i < count; i++) mask[i >> 6] |= (uint64_t)scalar(i) << (i & 63);
+	}
+
+	// std::clamp as max then min. The operand order makes maxps and minps pick v over a NaN the same way the
+	// comparisons in std::max and std::min do
+	static __m128 Clamp(__m128 v, __m128 lo, __m128 hi)
+	{
+		return _mm_min_ps(hi, _mm_max_ps(lo, v));
+	}
+
+	static __m128 ZeroNaN(__m128 v)
+	{
+		return _mm_and_ps(_mm_cmpord_ps(v, v), v);
+	}
+#else
+	template<typename Scalar>
+	static void Run(int count, std::vector<uint64_t>& mask, Scalar&& scalar)
+	{
+		mask.assign((count + 63) / 64, 0);
+		for (int i = 0; i < count; i++) mask[i >> 6] |= (uint64_t)scalar(i) << (i & 63);
+	}
+#endif
+};
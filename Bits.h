@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#if __has_include(<bit>)
+#include <bit>
+#endif
+
+// Bit counting. The project is C++20, where these are the functions of <bit>, but the web build (enscripen_build.bat)
+// is C++17, which doesn't have them and gets the builtins of the compiler instead
+
+inline int CountLeadingZeros(uint64_t x)
+{
+#ifdef __cpp_lib_bitops
+	return std::countl_zero(x);
+#else
+	return x == 0 ? 64 : __builtin_clzll(x);
+#endif
+}
+
+// Bits needed to hold x, 0 for 0
+inline int BitWidth(uint32_t x)
+{
+#ifdef __cpp_lib_bitops
+	return std::bit_width(x);
+#else
+	return x == 0 ? 0 : 32 - __builtin_clz(x);
+#endif
+}
+
+inline int CountTrailingZeros(uint64_t x)
+{
+#ifdef __cpp_lib_bitops
+	return std::countr_zero(x);
+#else
+	return x == 0 ? 64 : __builtin_ctzll(x);
+#endif
+}
+
+inline int PopCount(uint64_t x)
+{
+#ifdef __cpp_lib_bitops
+	return std::popcount(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
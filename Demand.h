@@ -0,0 +1,269 @@
+#pragma once
+
+#include "Routing.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+// Random draws made straight from mt19937, whose output the standard fixes bit for bit. The std distributions
+// are left to the library, so a replay recorded with one would play back differently with another
+
+// In [0, 1), from the top 24 bits so every value is exact
+inline float RandomFloat(std::mt19937& rng)
+{
+	return (rng() >> 8) * (1.0f / 16777216.0f);
+}
+
+// In [0, 1), 53 bits from two draws
+inline double RandomDouble(std::mt19937& rng)
+{
+	uint64_t high = rng() >> 5;
+	uint64_t low = rng() >> 6;
+	return (double)((high << 26) | low) * (1.0 / 9007199254740992.0);
+}
+
+// e^x out of nothing but basic arithmetic, which IEEE rounds the same everywhere. std::exp is free to round
+// differently from one library to the next, and so would the trips drawn from anything it went into
+inline double PortableExp(double x)
+{
+	if (std::isnan(x)) return x;
+	if (x < -746.0) return 0.0;
+	if (x > 710.0) return INFINITY;
+
+	// The fraction from a series, 1/18! is below double precision, then the whole part one factor of e at a time
+	double whole = std::floor(x);
+	double fraction = x - whole;
+	double term = 1.0, sum = 1.0;
+	for (int k = 1; k <= 18; k++) {
+		term *= fraction / k;
+		sum += term;
+	}
+	double factor = whole < 0.0 ? 0.36787944117144233 : 2.718281828459045;
+	for (int n = (int)std::abs(whole); n > 0; n--) sum *= factor;
+	return sum;
+}
+
+// Knuth's method: counts the uniform draws it takes for their product to drop below e^-mean. Done one unit of
+// mean at a time, which a sum of Poisson draws allows, so e^-mean never gets near underflow
+inline int RandomPoisson(double mean, std::mt19937& rng)
+{
+	int count = 0;
+	while (mean > 0.0) {
+		double part = std::min(mean, 1.0);
+		mean -= part;
+
+		double limit = PortableExp(-part);
+		for (double product = RandomDouble(rng); product > limit; product *= RandomDouble(rng)) count++;
+	}
+	return count;
+}
+
+// Walker's alias method: after an O(n) build, every sample takes one random index and one biased coin flip
+class AliasTable {
+
+private:
+	std::vector<float> probability; // Chance of keeping the index drawn rather than taking its alias
+	std::vector<int> alias;
+	double total = 0.0;
+
+public:
+	void Build(const std::vector<double>& weights)
+	{
+		int n = (int)weights.size();
+		probability.assign(n, 1.0f);
+		alias.resize(n);
+		total = 0.0;
+		for (double weight : weights) total += weight;
+		if (total <= 0.0) return;
+
+		std::vector<double> scaled(n);
+		std::vector<int> small, large;
+		for (int i = 0; i < n; i++) {
+			alias[i] = i;
+			scaled[i] = weights[i] * n / total;
+			(scaled[i] < 1.0 ? small : large).push_back(i);
+		}
+
+		while (!small.empty() && !large.empty()) {
+			int s = small.back();
+			int l = large.back();
+			small.pop_back();
+			probability[s] = (float)scaled[s];
+			alias[s] = l;
+
+			scaled[l] -= 1.0 - scaled[s];
+			if (scaled[l] < 1.0) {
+				large.pop_back();
+				small.push_back(l);
+			}
+		}
+		// Whatever is left is 1 give or take rounding, and keeps itself
+	}
+
+	bool Empty() const { return total <= 0.0; }
+	double Total() const { return total; }
+
+	int Sample(std::mt19937& rng) const
+	{
+		int i = (int)(rng() % probability.size());
+		float coin = RandomFloat(rng);
+		return coin < probability[i] ? i : alias[i];
+	}
+};
+
+// Trips between zones, and when they happen.
+// Zones are numbered by world chunk (x + y * chunks across) rather than by Zones index, so a demand
+// stays valid when road edits add or remove zones. Trips from or to a chunk without roads are dropped.
+class DemandModel {
+
+public:
+	// Share of the daily average demand for every hour of the day, starting at midnight.
+	// The default has a morning and an evening peak
+	std::vector<float> hourlyProfile = {
+		0.25f, 0.15f, 0.1f, 0.1f, 0.2f, 0.5f, 1.2f, 2.0f, 2.2f, 1.4f, 1.0f, 1.0f,
+		1.1f, 1.0f, 1.0f, 1.2f, 1.6f, 2.1f, 2.0f, 1.3f, 0.9f, 0.7f, 0.5f, 0.4f
+	};
+
+private:
+	int zoneCount = 0;
+	std::vector<double> originTrips; // Trips per hour
+	AliasTable origins;
+	std::vector<AliasTable> destinations; // Per origin, over destinations[origin] indices into destinationZones[origin]
+	std::vector<std::vector<int>> destinationZones;
+
+public:
+	int ZoneCount() const { return zoneCount; }
+	bool Empty() const { return origins.Empty(); }
+	double TripsPerHour() const { return origins.Total(); }
+
+	// trips is zoneCount * zoneCount trips per hour, by origin then destination
+	void SetTrips(int zones, const std::vector<double>& trips)
+	{
+		zoneCount = zones;
+		originTrips.assign(zones, 0.0);
+		destinations.assign(zones, {});
+		destinationZones.assign(zones, {});
+
+		std::vector<double> weights;
+		for (int o = 0; o < zones; o++) {
+			// Only keep the destinations there are trips to, OD matrices are mostly empty
+			weights.clear();
+			for (int d = 0; d < zones; d++) {
+				double t = trips[(size_t)o * zones + d];
+				if (t <= 0.0) continue;
+				destinationZones[o].push_back(d);
+				weights.push_back(t);
+				originTrips[o] += t;
+			}
+			destinations[o].Build(weights);
+		}
+		origins.Build(originTrips);
+	}
+
+	// Text file with one "origin destination tripsPerHour" line per zone pair, and optionally a line of
+	// "profile" followed by 24 hourly factors. Everything after a # is ignored
+	bool Load(const std::string& filename, int zones)
+	{
+		std::ifstream file(filename);
+		if (!file) {
+			printf("Error reading demand: can't open %s\n", filename.c_str());
+			return false;
+		}
+
+		std::vector<double> trips((size_t)zones * zones, 0.0);
+		std::string line;
+		for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream fields(line);
+			std::string first;
+			if (!(fields >> first)) continue;
+
+			if (first == "profile") {
+				std::vector<float> profile(24);
+				for (float& factor : profile) fields >> factor;
+				if (!fields) {
+					printf("Error reading demand: %s line %d needs 24 hourly factors\n", filename.c_str(), lineNumber);
+					return false;
+				}
+				if (std::any_of(profile.begin(), profile.end(), [](float factor) { return factor < 0.0f; })) {
+					printf("Error reading demand: %s line %d has a negative hourly factor\n", filename.c_str(), lineNumber);
+					return false;
+				}
+				hourlyProfile = profile;
+				continue;
+			}
+
+			int origin, destination;
+			double tripsPerHour;
+			std::istringstream pair(line);
+			if (!(pair >> origin >> destination >> tripsPerHour) || origin < 0 || origin >= zones || destination < 0 || destination >= zones || tripsPerHour < 0.0) {
+				printf("Error reading demand: %s line %d is not a valid \"origin destination tripsPerHour\"\n", filename.c_str(), lineNumber);
+				return false;
+			}
+			trips[(size_t)origin * zones + destination] += tripsPerHour;
+		}
+
+		SetTrips(zones, trips);
+		return true;
+	}
+
+	// Production constrained gravity model: every zone makes trips in proportion to its size, which go to other
+	// zones in proportion to their size and fall off exponentially with the travel time there. PortableExp keeps the
+	// trip table, and with it every replay that uses it, the same with any standard library
+	void BuildGravity(int zones, const std::vector<double>& zoneSize, const std::vector<int>& matrixZone, const TravelTimeMatrix& travelTimes, double tripsPerSizePerHour, double beta)
+	{
+		std::vector<double> trips((size_t)zones * zones, 0.0);
+		std::vector<double> attraction;
+		for (int i = 0; i < travelTimes.rows; i++) {
+			attraction.assign(travelTimes.cols, 0.0);
+			double sum = 0.0;
+			for (int j = 0; j < travelTimes.cols; j++) {
+				float time = travelTimes.At(i, j);
+				if (i == j || std::isinf(time)) continue;
+				attraction[j] = zoneSize[matrixZone[j]] * PortableExp(-beta * time);
+				sum += attraction[j];
+			}
+			if (sum <= 0.0) continue;
+
+			double production = zoneSize[matrixZone[i]] * tripsPerSizePerHour;
+			for (int j = 0; j < travelTimes.cols; j++) {
+				trips[(size_t)matrixZone[i] * zones + matrixZone[j]] = production * attraction[j] / sum;
+			}
+		}
+		SetTrips(zones, trips);
+	}
+
+	// Demand relative to the daily average, timeOfDay in seconds since midnight. Hourly factors are for the middle of
+	// the hour and blended in between
+	float ProfileAt(double timeOfDay) const
+	{
+		double hours = std::fmod(timeOfDay / 3600.0 + 23.5, 24.0);
+		int hour = (int)hours;
+		float blend = (float)(hours - hour);
+		return hourlyProfile[hour] * (1.0f - blend) + hourlyProfile[(hour + 1) % 24] * blend;
+	}
+
+	// Draws the trips that start within a step of the given length, calling emit(origin, destination) for each.
+	// Costs O(1) per trip no matter how many zones there are
+	template<typename F>
+	void Generate(double timeOfDay, double stepSeconds, std::mt19937& rng, F&& emit) const
+	{
+		if (Empty()) return;
+
+		// Nothing to draw at a quiet hour, and the test catches NaN as well
+		double expected = origins.Total() * ProfileAt(timeOfDay) * stepSeconds / 3600.0;
+		if (!(expected > 0.0)) return;
+		int count = RandomPoisson(expected, rng);
+		for (int i = 0; i < count; i++) {
+			int origin = origins.Sample(rng);
+			emit(origin, destinationZones[origin][destinations[origin].Sample(rng)]);
+		}
+	}
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+// olc's geometry header compares members with <, which newer g++ reads as the start of a template argument list and
+// warns about. It is vendored, so the warning is silenced around it rather than fixed in it. Include this before
+// anything else of olc's that pulls it in, such as the quad tree
+#if defined(_MSC_VER)
+#pragma warning(push, 0)
+#elif defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas" // g++ before 12 doesn't know the next one
+#pragma GCC diagnostic ignored "-Wmissing-template-keyword"
+#endif
+#include "olcPixelGameEngine/utilities/olcUTIL_Geometry2D.h"
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#elif defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
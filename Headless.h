@@ -0,0 +1,507 @@
+#pragma once
+
+#include "Simulation.h"
+#include "World.h"
+#include "Replay.h"
+#include "Trajectory.h"
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// Running the simulation without a window or renderer, stepping ticks as fast as the CPU allows.
+// Every report interval a row of what happened goes into a CSV file, and every simulated hour a line to the console
+struct HeadlessOptions {
+	double hours = 24.0; // Simulated hours to run for
+	int threads = std::max(1, (int)std::thread::hardware_concurrency()); // Including the one running the ticks
+	std::string outFile = "results.csv";
+	std::string demandFile; // Gravity model over the generated roads if empty
+	std::string replayFile; // Where to save a replay of the run, none if empty
+	int hashInterval = 100; // Ticks between state hashes in the replay, 1 lets --check-replay find the exact tick a rerun goes wrong
+	std::string trajectoryFile; // Where to record vehicle trajectories, none if empty
+	int trajectoryInterval = 2; // Ticks between recorded frames
+	std::string linksFile; // Where to write hourly statistics of every road link, none if empty
+	std::string percentilesFile; // Where to write travel time percentiles per origin and destination and per link, none if empty
+	double reportSeconds = 300.0; // Simulated seconds between rows of the CSV file
+	bool queuesOnly = false; // Simulate every region as queues, nobody is looking at it anyway
+	olc::vi2d worldSize = { 200, 200 };
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--headless") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option == "--headless") continue;
+			if (option == "--queues") {
+				queuesOnly = true;
+				continue;
+			}
+
+			// Every other option takes one value
+			if (option != "--hours" && option != "--threads" && option != "--out" && option != "--demand" && option != "--report" && option != "--world" && option != "--record" &&
+				option != "--hash-interval" && option != "--trajectory" && option != "--trajectory-interval" && option != "--links" && option != "--percentiles") {
+				printf("Error: unknown option %s\n", option.c_str());
+				PrintUsage();
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--hours") hours = atof(value);
+			else if (option == "--threads") threads = atoi(value);
+			else if (option == "--out") outFile = value;
+			else if (option == "--demand") demandFile = value;
+			else if (option == "--report") reportSeconds = atof(value);
+			else if (option == "--world") worldSize.x = worldSize.y = atoi(value);
+			else if (option == "--record") replayFile = value;
+			else if (option == "--hash-interval") hashInterval = atoi(value);
+			else if (option == "--trajectory") trajectoryFile = value;
+			else if (option == "--trajectory-interval") trajectoryInterval = atoi(value);
+			else if (option == "--links") linksFile = value;
+			else if (option == "--percentiles") percentilesFile = value;
+		}
+
+		if (hours <= 0.0 || threads < 1 || reportSeconds <= 0.0 || worldSize.x < 1 || trajectoryInterval < 1 || hashInterval < 1) {
+			printf("Error: --hours, --threads, --report, --world, --trajectory-interval and --hash-interval have to be positive\n");
+			return false;
+		}
+		return true;
+	}
+
+	static void PrintUsage()
+	{
+		printf("Usage: Traffic --headless [--hours 24] [--threads N] [--out results.csv] [--demand trips.txt] [--report 300] [--world 200] [--queues] [--record replay.txt] [--hash-interval 100] [--trajectory run.traj] [--trajectory-interval 2] [--links links.csv] [--percentiles percentiles.csv]\n");
+	}
+};
+
+// Rows of what happened during a run, written to a CSV file as it goes
+class RunRecorder {
+
+	using Clock = std::chrono::steady_clock;
+
+private:
+	FILE* file = nullptr;
+	Clock::time_point start = Clock::now();
+	Clock::time_point lastRow = start;
+	double lastRowTime = 0.0;
+	RouteCache::Metrics lastCache = {};
+
+public:
+	~RunRecorder() { Close(); }
+
+	bool Open(const std::string& filename)
+	{
+		file = fopen(filename.c_str(), "w");
+		if (!file) {
+			printf("Error: can't write %s\n", filename.c_str());
+			return false;
+		}
+		fprintf(file, "time_of_day,simulated_seconds,wall_seconds,speedup,vehicles,pending_trips,trips_generated,trips_started,trips_completed,trips_abandoned,trips_dropped,mean_trip_minutes,trip_p50_minutes,trip_p90_minutes,trip_p99_minutes,route_cache_hit_rate,route_cache_entries,route_cache_routes,route_cache_mb\n");
+		return true;
+	}
+
+	void Close()
+	{
+		if (file) fclose(file);
+		file = nullptr;
+	}
+
+	// Wall clock time is counted from here
+	void Start(const Simulation& simulation)
+	{
+		start = lastRow = Clock::now();
+		lastRowTime = simulation.SimulatedTime();
+		lastCache = simulation.RouteCacheMetrics();
+	}
+
+	double WallSeconds() const { return std::chrono::duration<double>(Clock::now() - start).count(); }
+
+	void Record(const Simulation& simulation)
+	{
+		if (!file) return;
+
+		Clock::time_point now = Clock::now();
+		double rowWall = std::chrono::duration<double>(now - lastRow).count();
+		double rowSimulated = simulation.SimulatedTime() - lastRowTime;
+		RouteCache::Metrics cache = simulation.RouteCacheMetrics();
+		uint64_t hits = cache.hits - lastCache.hits;
+		uint64_t lookups = hits + cache.misses - lastCache.misses;
+		Simulation::TripStats trips = simulation.GetTripStats();
+		const QuantileSketch& tripTimes = simulation.TripTimes();
+		double tickMinutes = simulation.tickLength / 60.0;
+
+		int timeOfDay = (int)std::fmod(simulation.clockStart + simulation.SimulatedTime(), 86400.0);
+		fprintf(file, "%02d:%02d:%02d,%.1f,%.3f,%.1f,%zu,%zu,%llu,%llu,%llu,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.4f,%zu,%zu,%.2f\n",
+			timeOfDay / 3600, timeOfDay / 60 % 60, timeOfDay % 60, simulation.SimulatedTime(), WallSeconds(),
+			rowWall > 0.0 ? rowSimulated / rowWall : 0.0,
+			simulation.VehicleCount(), simulation.PendingTripCount(),
+			(unsigned long long)trips.generated, (unsigned long long)trips.started, (unsigned long long)trips.completed,
+			(unsigned long long)trips.abandoned, (unsigned long long)trips.dropped,
+			trips.completed > 0 ? trips.travelSeconds / trips.completed / 60.0 : 0.0,
+			tripTimes.Quantile(0.5) * tickMinutes, tripTimes.Quantile(0.9) * tickMinutes, tripTimes.Quantile(0.99) * tickMinutes,
+			lookups > 0 ? (double)hits / lookups : 0.0, cache.entries, cache.routes, cache.memoryBytes / 1e6);
+		fflush(file);
+
+		lastRow = now;
+		lastRowTime = simulation.SimulatedTime();
+		lastCache = cache;
+	}
+};
+
+// A row per road link and hour it had traffic in, from the coarsest level of the link statistics
+inline bool WriteLinkStats(const Simulation& simulation, const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) {
+		printf("Error: can't write %s\n", filename.c_str());
+		return false;
+	}
+	fprintf(file, "link,from_x,from_y,to_x,to_y,length,time_of_day,flow_per_hour,mean_vehicles,density,mean_speed\n");
+
+	const LinkStats& stats = simulation.GetLinkStats();
+	const std::vector<uint64_t>& binEnds = stats.BinEnds(stats.LevelCount() - 1);
+	int width = simulation.Roads().vWorldSize.x;
+	for (size_t bin = 1; bin < binEnds.size(); bin++) {
+		int timeOfDay = (int)std::fmod(simulation.clockStart + binEnds[bin - 1] * (double)simulation.tickLength, 86400.0);
+		for (int link = 0; link < stats.LinkCount(); link++) {
+			LinkStats::Totals totals;
+			if (!stats.Query(link, binEnds[bin - 1], binEnds[bin], totals) || totals.vehicleTicks == 0) continue;
+
+			LinkStats::Summary summary = stats.Summarise(link, totals);
+			int from = stats.LinkSource(link);
+			int to = stats.LinkTarget(link);
+			fprintf(file, "%d,%d,%d,%d,%d,%.2f,%02d:%02d,%.1f,%.3f,%.4f,%.3f\n", link, from % width, from / width, to % width, to / width,
+				stats.LinkLength(link), timeOfDay / 3600, timeOfDay / 60 % 60,
+				summary.flowPerHour, summary.meanVehicles, summary.density, summary.meanSpeed);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+// Travel time percentiles over the whole run, a row per origin and destination chunk with completed trips,
+// then one per road link that was driven
+inline bool WritePercentiles(const Simulation& simulation, const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "w");
+	if (!file) {
+		printf("Error: can't write %s\n", filename.c_str());
+		return false;
+	}
+	fprintf(file, "kind,from_x,from_y,to_x,to_y,count,p50_seconds,p90_seconds,p99_seconds,free_flow_seconds\n");
+
+	double tickLength = simulation.tickLength;
+	auto write = [&](const char* kind, olc::vi2d from, olc::vi2d to, const QuantileSketch& sketch, double freeFlowSeconds) {
+		fprintf(file, "%s,%d,%d,%d,%d,%llu,%.2f,%.2f,%.2f,%.2f\n", kind, from.x, from.y, to.x, to.y, (unsigned long long)sketch.Count(),
+			sketch.Quantile(0.5) * tickLength, sketch.Quantile(0.9) * tickLength, sketch.Quantile(0.99) * tickLength, freeFlowSeconds);
+	};
+
+	// Chunks as chunk coordinates, free flow isn't known per chunk
+	ChunkGrid chunks(simulation.Roads().vWorldSize);
+	for (int origin = 0; origin < chunks.ChunkCount(); origin++) {
+		for (int destination = 0; destination < chunks.ChunkCount(); destination++) {
+			const QuantileSketch* sketch = simulation.TripTimes(origin, destination);
+			if (!sketch) continue;
+			olc::vi2d from = { origin % chunks.vChunkCount.x, origin / chunks.vChunkCount.x };
+			olc::vi2d to = { destination % chunks.vChunkCount.x, destination / chunks.vChunkCount.x };
+			write("od", from, to, *sketch, 0.0);
+		}
+	}
+
+	const LinkStats& stats = simulation.GetLinkStats();
+	int width = simulation.Roads().vWorldSize.x;
+	for (int link = 0; link < stats.LinkCount(); link++) {
+		const QuantileSketch& sketch = stats.TravelTimes(link);
+		if (sketch.Count() == 0) continue;
+		olc::vi2d from = { stats.LinkSource(link) % width, stats.LinkSource(link) / width };
+		olc::vi2d to = { stats.LinkTarget(link) % width, stats.LinkTarget(link) / width };
+		write("link", from, to, sketch, stats.LinkLength(link) / simulation.freeFlowSpeed);
+	}
+	fclose(file);
+	return true;
+}
+
+// Returns the exit code for main
+inline int RunHeadless(const HeadlessOptions& options)
+{
+	JobSystem jobs(options.threads - 1);
+	ChunkGrid chunks(options.worldSize);
+	std::vector<Tile> tiles((size_t)options.worldSize.x * options.worldSize.y);
+	WorldGenerator generator;
+	generator.Generate(tiles.data(), chunks, jobs);
+
+	Simulation simulation(jobs);
+	simulation.LoadRoads(RoadMask(tiles.data(), (int)tiles.size()), options.worldSize);
+	if (!options.demandFile.empty() && !simulation.LoadDemand(options.demandFile)) return 1;
+
+	ReplayLog replay;
+	if (!options.replayFile.empty()) replay.Begin(simulation, options.worldSize, generator.seed, options.demandFile, options.hashInterval);
+
+	if (options.queuesOnly) {
+		// A focus far outside the world leaves every region as queues
+		SimulationCommand command = { SimulationCommand::Type::SetFocus };
+		command.focusMin = command.focusMax = { -(1 << 20), -(1 << 20) };
+		simulation.Apply(command);
+	}
+
+	RunRecorder recorder;
+	if (!recorder.Open(options.outFile)) return 1;
+
+	TrajectoryRecorder trajectory;
+	SimulationSnapshot snapshot;
+	trajectory.tickInterval = options.trajectoryInterval;
+	if (!options.trajectoryFile.empty() && !trajectory.Open(options.trajectoryFile, simulation.tickLength)) return 1;
+
+	uint64_t totalTicks = (uint64_t)std::llround(options.hours * 3600.0 / simulation.tickLength);
+	uint64_t reportTicks = std::max<uint64_t>(1, (uint64_t)std::llround(options.reportSeconds / simulation.tickLength));
+	uint64_t hourTicks = (uint64_t)std::llround(3600.0 / simulation.tickLength);
+
+	printf("Simulating %.1f hours of %dx%d cells on %d threads\n", options.hours, options.worldSize.x, options.worldSize.y, jobs.Concurrency());
+
+	recorder.Start(simulation);
+	for (uint64_t t = 1; t <= totalTicks; t++) {
+		simulation.Tick();
+		if (t % reportTicks == 0 || t == totalTicks) recorder.Record(simulation);
+
+		if (trajectory.IsOpen() && simulation.TickCount() % options.trajectoryInterval == 0) {
+			simulation.WriteSnapshot(snapshot);
+			trajectory.Record(snapshot);
+		}
+
+		if (t % hourTicks == 0 || t == totalTicks) {
+			double wallSeconds = recorder.WallSeconds();
+			printf("%6.2f h simulated, %zu vehicles, %.1f simulated seconds per wall second\n",
+				simulation.SimulatedTime() / 3600.0, simulation.VehicleCount(), wallSeconds > 0.0 ? simulation.SimulatedTime() / wallSeconds : 0.0);
+		}
+	}
+	recorder.Close();
+
+	if (trajectory.IsOpen()) {
+		trajectory.Close();
+		TrajectoryRecorder::Stats stats = trajectory.GetStats();
+		printf("Recorded %llu frames of %llu vehicle states in %.1f MB (%.2f bytes per state) to %s\n",
+			(unsigned long long)stats.frames, (unsigned long long)stats.vehicleStates, stats.bytesWritten / 1e6,
+			stats.vehicleStates > 0 ? (double)stats.bytesWritten / stats.vehicleStates : 0.0, options.trajectoryFile.c_str());
+	}
+
+	if (!options.replayFile.empty()) {
+		replay.Finish(simulation);
+		if (!replay.Save(options.replayFile)) return 1;
+	}
+	if (!options.linksFile.empty() && !WriteLinkStats(simulation, options.linksFile)) return 1;
+	if (!options.percentilesFile.empty() && !WritePercentiles(simulation, options.percentilesFile)) return 1;
+
+	double wallSeconds = recorder.WallSeconds();
+	Simulation::TripStats trips = simulation.GetTripStats();
+	printf("Done: %.0f simulated seconds in %.1f wall seconds (%.1fx), %llu of %llu trips completed. Results in %s\n",
+		simulation.SimulatedTime(), wallSeconds, wallSeconds > 0.0 ? simulation.SimulatedTime() / wallSeconds : 0.0,
+		(unsigned long long)trips.completed, (unsigned long long)trips.generated, options.outFile.c_str());
+
+	// How evenly the work spread, to see what more threads would buy. The last entry is the simulation thread
+	std::vector<JobSystem::Stats> jobStats = jobs.GetStats();
+	for (int i = 0; i < (int)jobStats.size(); i++) {
+		const JobSystem::Stats& s = jobStats[i];
+		if (i < jobs.WorkerCount()) printf("  worker %d: %llu jobs, %llu stolen, %.1f s idle (%.0f%%)\n", i, (unsigned long long)s.tasksRun,
+			(unsigned long long)s.steals, s.idleSeconds, wallSeconds > 0.0 ? 100.0 * s.idleSeconds / wallSeconds : 0.0);
+		else printf("  simulation thread: %llu jobs\n", (unsigned long long)s.tasksRun);
+	}
+	return 0;
+}
+
+// Runs the same world and demand twice, once in full detail and once as queues, and compares how many vehicles
+// drove every link that crosses from one region into another. Queues are an approximation, so the totals only
+// have to agree to within a tolerance, but a queue that lets vehicles through too fast or loses them shows up here
+struct QueueCheckOptions {
+	double hours = 2.0;
+	int threads = std::max(1, (int)std::thread::hardware_concurrency());
+	olc::vi2d worldSize = { 100, 100 };
+	double tolerance = 0.1; // Largest difference of the total exits, as a fraction of the full detail ones
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--check-queues") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--check-queues" && option != "--threads" && option != "--world" && option != "--tolerance") {
+				printf("Error: unknown option %s\n", option.c_str());
+				printf("Usage: Traffic --check-queues hours [--threads N] [--world 100] [--tolerance 0.1]\n");
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--check-queues") hours = atof(value);
+			else if (option == "--threads") threads = atoi(value);
+			else if (option == "--world") worldSize.x = worldSize.y = atoi(value);
+			else if (option == "--tolerance") tolerance = atof(value);
+		}
+
+		if (hours <= 0.0 || threads < 1 || worldSize.x < 1 || tolerance < 0.0) {
+			printf("Error: --check-queues, --threads and --world have to be positive, --tolerance can't be negative\n");
+			return false;
+		}
+		return true;
+	}
+};
+
+// Returns the exit code for main
+inline int CheckQueueFlows(const QueueCheckOptions& options)
+{
+	JobSystem jobs(options.threads - 1);
+	ChunkGrid chunks(options.worldSize);
+	std::vector<Tile> tiles((size_t)options.worldSize.x * options.worldSize.y);
+	WorldGenerator generator;
+	generator.Generate(tiles.data(), chunks, jobs);
+	std::vector<uint8_t> roadMask = RoadMask(tiles.data(), (int)tiles.size());
+	uint64_t ticks = 0;
+
+	// Same seed both times, so the same trips are asked for
+	auto run = [&](bool queues, Simulation& simulation) {
+		simulation.LoadRoads(roadMask, options.worldSize);
+		if (queues) {
+			SimulationCommand command = { SimulationCommand::Type::SetFocus };
+			command.focusMin = command.focusMax = { -(1 << 20), -(1 << 20) };
+			simulation.Apply(command);
+		}
+		ticks = (uint64_t)std::llround(options.hours * 3600.0 / simulation.tickLength);
+		for (uint64_t t = 0; t < ticks; t++) simulation.Tick();
+	};
+
+	printf("Running %.1f hours of %dx%d cells in full detail and as queues\n", options.hours, options.worldSize.x, options.worldSize.y);
+	Simulation micro(jobs);
+	run(false, micro);
+	Simulation meso(jobs);
+	run(true, meso);
+
+	const LinkStats& microStats = micro.GetLinkStats();
+	const LinkStats& mesoStats = meso.GetLinkStats();
+	uint64_t microExits = 0, mesoExits = 0, linkDifference = 0;
+	int boundaryLinks = 0;
+	for (int link = 0; link < microStats.LinkCount(); link++) {
+		int from = microStats.LinkSource(link);
+		int to = microStats.LinkTarget(link);
+		if (chunks.ChunkOfCell(from) == chunks.ChunkOfCell(to)) continue;
+
+		LinkStats::Totals microTotals, mesoTotals;
+		microStats.Query(link, 0, ticks, microTotals);
+		mesoStats.Query(mesoStats.FindLink(from, to), 0, ticks, mesoTotals);
+		microExits += microTotals.exits;
+		mesoExits += mesoTotals.exits;
+		linkDifference += microTotals.exits > mesoTotals.exits ? microTotals.exits - mesoTotals.exits : mesoTotals.exits - microTotals.exits;
+		boundaryLinks++;
+	}
+
+	double difference = microExits > 0 ? std::abs((double)mesoExits - (double)microExits) / microExits : 0.0;
+	printf("%d links between regions: %llu exits in full detail, %llu as queues, %.1f%% apart in total and %.1f%% link by link\n",
+		boundaryLinks, (unsigned long long)microExits, (unsigned long long)mesoExits, difference * 100.0,
+		microExits > 0 ? 100.0 * linkDifference / microExits : 0.0);
+	if (difference > options.tolerance) {
+		printf("Error: queues and full detail disagree on the flow between regions by more than %.1f%%\n", options.tolerance * 100.0);
+		return 1;
+	}
+	return 0;
+}
+
+// Runs the default world and demand, and checks that trips keep being completed. A network that locks up stops
+// completing them for good, however much demand there is, so every interval with vehicles on the road has to complete at least one
+struct FlowCheckOptions {
+	double hours = 1.0;
+	int threads = std::max(1, (int)std::thread::hardware_concurrency());
+	olc::vi2d worldSize = { 200, 200 };
+	double intervalSeconds = 300.0; // Simulated seconds that have to complete a trip each
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--check-flow") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--check-flow" && option != "--threads" && option != "--world" && option != "--interval") {
+				printf("Error: unknown option %s\n", option.c_str());
+				printf("Usage: Traffic --check-flow hours [--threads N] [--world 200] [--interval 300]\n");
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--check-flow") hours = atof(value);
+			else if (option == "--threads") threads = atoi(value);
+			else if (option == "--world") worldSize.x = worldSize.y = atoi(value);
+			else if (option == "--interval") intervalSeconds = atof(value);
+		}
+
+		if (hours <= 0.0 || threads < 1 || worldSize.x < 1 || intervalSeconds <= 0.0) {
+			printf("Error: --check-flow, --threads, --world and --interval have to be positive\n");
+			return false;
+		}
+		return true;
+	}
+};
+
+// Returns the exit code for main
+inline int CheckTripFlow(const FlowCheckOptions& options)
+{
+	JobSystem jobs(options.threads - 1);
+	ChunkGrid chunks(options.worldSize);
+	std::vector<Tile> tiles((size_t)options.worldSize.x * options.worldSize.y);
+	WorldGenerator generator;
+	generator.Generate(tiles.data(), chunks, jobs);
+
+	Simulation simulation(jobs);
+	simulation.LoadRoads(RoadMask(tiles.data(), (int)tiles.size()), options.worldSize);
+
+	uint64_t totalTicks = (uint64_t)std::llround(options.hours * 3600.0 / simulation.tickLength);
+	uint64_t intervalTicks = std::max<uint64_t>(1, (uint64_t)std::llround(options.intervalSeconds / simulation.tickLength));
+
+	printf("Running %.1f hours of %dx%d cells, trips have to be completed every %.0f seconds\n", options.hours, options.worldSize.x, options.worldSize.y, options.intervalSeconds);
+	uint64_t lastCompleted = 0;
+	for (uint64_t t = 1; t <= totalTicks; t++) {
+		simulation.Tick();
+		if (t % intervalTicks != 0) continue;
+
+		Simulation::TripStats trips = simulation.GetTripStats();
+		int timeOfDay = (int)std::fmod(simulation.clockStart + simulation.SimulatedTime(), 86400.0);
+		printf("%02d:%02d:%02d %llu trips completed, %llu abandoned, %zu vehicles\n", timeOfDay / 3600, timeOfDay / 60 % 60, timeOfDay % 60,
+			(unsigned long long)trips.completed, (unsigned long long)trips.abandoned, simulation.VehicleCount());
+		if (trips.completed <= lastCompleted && simulation.VehicleCount() > 0) {
+			printf("Error: no trip was completed in the last %.0f simulated seconds\n", options.intervalSeconds);
+			return 1;
+		}
+		lastCompleted = trips.completed;
+	}
+	return 0;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "olcPGEX_TransformedView.h"
+#include "Simulation.h"
+#include "StatsPyramid.h"
+#include "PagedTexture.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Colours the map by how fast traffic moves or how dense it is, worked out from the vehicles in the snapshots.
+// Every cell is a texel of a paged texture that covers the world, so the cost goes with the traffic
+// and not with how much road is on screen: one decal per page, whatever it shows.
+// Cells keep a running average over the last few seconds, and only cells with traffic in that window are looked at.
+// The averages also go into a pyramid of blocks of 2x2, 4x4, ... cells, with a texture for each level. Zoomed out,
+// the blocks that are about a pixel on screen are drawn instead of single cells, so the colours don't flicker
+// with whichever cell a pixel happens to land on. Traffic in a rectangle, e.g. on screen, comes from the same blocks
+class TrafficHeatmap {
+
+public:
+	enum class Mode { Off, Speed, Density, ModeCount };
+
+	Mode mode = Mode::Off;
+	float smoothingSeconds = 5.0f; // How long traffic takes to fade from a cell
+	float freeFlowSpeed = 2.0f; // Tiles per second, green in speed mode
+	float jamDensity = 2.0f; // Vehicles per cell, red in density mode
+
+private:
+	struct Cell {
+		float vehicles = 0.0f; // Averaged over time
+		float speedSum = 0.0f; // Speeds of those vehicles, averaged the same way
+		bool active = false;
+	};
+
+	olc::vi2d worldSize = { 0, 0 };
+	std::vector<Cell> cells;
+	std::vector<int> activeCells;
+	StatsPyramid vehicles; // Sum and max of the averaged vehicles per cell
+	StatsPyramid speeds; // Sum of their speeds
+	std::vector<PagedTexture> levels; // A texel per block of every level of the pyramid
+	olc::vi2d visibleMin = { 0, 0 }; // Cells the last Draw was over
+	olc::vi2d visibleMax = { 0, 0 };
+	double lastTime = -1.0; // Snapshot time the cells are up to date with
+	Mode lastMode = Mode::Off;
+
+public:
+	// Needs the engine running, the pages are textures
+	void Resize(olc::vi2d newWorldSize)
+	{
+		Release();
+		worldSize = newWorldSize;
+		cells.assign((size_t)worldSize.x * worldSize.y, {});
+		vehicles.Resize(worldSize);
+		speeds.Resize(worldSize);
+
+		levels = std::vector<PagedTexture>(vehicles.LevelCount());
+		for (int l = 0; l < vehicles.LevelCount(); l++) levels[l].Resize(vehicles.LevelSize(l));
+	}
+
+	// Textures have to go while the engine is still running
+	void Release()
+	{
+		levels.clear();
+		cells.clear();
+		activeCells.clear();
+		lastTime = -1.0;
+	}
+
+	void NextMode() { mode = (Mode)(((int)mode + 1) % (int)Mode::ModeCount); }
+
+	const char* ModeName() const
+	{
+		switch (mode) {
+		case Mode::Speed: return "speed";
+		case Mode::Density: return "density";
+		default: return "off";
+		}
+	}
+
+	// Takes in a new snapshot, if there is one. Only the cells with traffic and the blocks above them are touched
+	void Update(const SimulationFrame& frame)
+	{
+		if (cells.empty()) return;
+		bool newSnapshot = frame.current->time != lastTime;
+		if (!newSnapshot && mode == lastMode) return;
+
+		if (newSnapshot) {
+			Accumulate(*frame.previous, *frame.current);
+
+			// Cells that faded out go back to clear and stop being looked at
+			size_t kept = 0;
+			for (int i : activeCells) {
+				Cell& cell = cells[i];
+				if (cell.vehicles < 0.01f) cell = {};
+				else activeCells[kept++] = i;
+				vehicles.Set(i % worldSize.x, i / worldSize.x, cell.vehicles);
+				speeds.Set(i % worldSize.x, i / worldSize.x, cell.speedSum);
+			}
+			activeCells.resize(kept);
+			vehicles.Update();
+			speeds.Update();
+		}
+
+		if (mode != lastMode) {
+			// Every texel changes colour, it's only on a key press
+			lastMode = mode;
+			for (int l = 0; l < vehicles.LevelCount(); l++) {
+				olc::vi2d size = vehicles.LevelSize(l);
+				for (int i = 0; i < size.x * size.y; i++) Recolour(l, i);
+			}
+			return;
+		}
+
+		for (int l = 0; l < vehicles.LevelCount(); l++) {
+			for (int i : vehicles.Changed(l)) Recolour(l, i);
+		}
+	}
+
+	// Vehicles on the cells the last Draw was over, averaged the same way as the colours, and their mean speed in tiles per second
+	void VisibleTraffic(float& vehicleCount, float& meanSpeed) const
+	{
+		vehicleCount = vehicles.Query(visibleMin, visibleMax).sum;
+		float speedSum = speeds.Query(visibleMin, visibleMax).sum;
+		meanSpeed = vehicleCount > 0.0f ? speedSum / vehicleCount : 0.0f;
+	}
+
+	// Uses the finest level whose texels are at least a couple of pixels wide
+	void Draw(olc::TransformedView& tv, olc::vi2d tileSize)
+	{
+		if (levels.empty()) return;
+
+		auto toWorld = [tileSize](olc::vf2d screen) {
+			float across = screen.x * 2.0f / tileSize.x - 1.0f; // x - y
+			float down = screen.y * 2.0f / tileSize.y; // x + y
+			return olc::vf2d((down + across) * 0.5f, (down - across) * 0.5f);
+		};
+
+		// The screen is a diamond in world space, so its cells are within the box around its corners
+		olc::vf2d screenTL = tv.GetWorldTL();
+		olc::vf2d screenBR = tv.GetWorldBR();
+		olc::vf2d top = toWorld(screenTL);
+		olc::vf2d bottom = toWorld(screenBR);
+		olc::vf2d left = toWorld({ screenTL.x, screenBR.y });
+		olc::vf2d right = toWorld({ screenBR.x, screenTL.y });
+		visibleMin = olc::vf2d(top.x, right.y).floor();
+		visibleMax = olc::vf2d(bottom.x, left.y).ceil();
+
+		int l = 0;
+		float texelPixels = tileSize.x * tv.GetWorldScale().x;
+		while (texelPixels < 2.0f && l + 1 < (int)levels.size()) {
+			texelPixels *= 2.0f;
+			l++;
+		}
+
+		levels[l].Draw(tv, tileSize, 1 << l);
+	}
+
+private:
+	void Accumulate(const SimulationSnapshot& previous, const SimulationSnapshot& current)
+	{
+		// Starting over, after a seek back or a long gap, beats averaging in traffic from somewhere else in time
+		double elapsed = current.time - lastTime;
+		bool restart = lastTime < 0.0 || elapsed <= 0.0 || elapsed > smoothingSeconds * 4.0;
+		float keep = restart ? 0.0f : (float)std::exp(-elapsed / smoothingSeconds);
+		float weight = 1.0f - keep;
+		lastTime = current.time;
+
+		for (int i : activeCells) {
+			cells[i].vehicles *= keep;
+			cells[i].speedSum *= keep;
+		}
+
+		float snapshotSeconds = (float)(current.time - previous.time);
+		size_t p = 0;
+		for (const auto& vehicle : current.vehicles) {
+			while (p < previous.vehicles.size() && previous.vehicles[p].id < vehicle.id) p++;
+
+			olc::vi2d cellPos = vehicle.pos.floor();
+			if (cellPos.x < 0 || cellPos.x >= worldSize.x || cellPos.y < 0 || cellPos.y >= worldSize.y) continue;
+
+			float speed = 0.0f;
+			if (p < previous.vehicles.size() && previous.vehicles[p].id == vehicle.id && snapshotSeconds > 0.0f) {
+				float moved = (vehicle.pos - previous.vehicles[p].pos).mag();
+				// Vehicles that jumped, e.g. after a road edit, say nothing about traffic
+				if (moved > 1.0f) continue;
+				speed = moved / snapshotSeconds;
+			}
+
+			int i = cellPos.y * worldSize.x + cellPos.x;
+			Cell& cell = cells[i];
+			cell.vehicles += weight;
+			cell.speedSum += weight * speed;
+			if (!cell.active) {
+				cell.active = true;
+				activeCells.push_back(i);
+			}
+		}
+	}
+
+	void Recolour(int level, int i)
+	{
+		const StatsPyramid::Stats& block = vehicles.At(level, i);
+		int width = vehicles.LevelSize(level).x;
+		levels[level].SetTexel(i % width, i / width, block.count > 0 ? Colour(block, speeds.At(level, i).sum) : olc::BLANK);
+	}
+
+	// Slow to fast is red to green, sparse to jammed is faint green to red. A block is as dense as its densest cell,
+	// so a jam doesn't vanish when zoomed out. Steps of 1/32 so small changes don't dirty a page
+	olc::Pixel Colour(const StatsPyramid::Stats& block, float speedSum) const
+	{
+		float value;
+		uint8_t alpha = 200;
+		if (mode == Mode::Speed) value = std::min(speedSum / block.sum / freeFlowSpeed, 1.0f);
+		else {
+			value = 1.0f - std::min(block.max / jamDensity, 1.0f);
+			alpha = (uint8_t)(80 + 120 * (1.0f - value));
+		}
+
+		value = std::floor(value * 32.0f) / 32.0f;
+		uint8_t red = (uint8_t)(255 * std::min(1.0f, 2.0f - 2.0f * value));
+		uint8_t green = (uint8_t)(255 * std::min(1.0f, 2.0f * value));
+		return olc::Pixel(red, green, 40, alpha);
+	}
+};
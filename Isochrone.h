@@ -0,0 +1,242 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "olcPGEX_TransformedView.h"
+#include "Routing.h"
+#include "JobSystem.h"
+#include "PagedTexture.h"
+#include "Simulation.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+// Travel times from one node to every other over a contraction hierarchy, the PHAST way: an upward search from the
+// source, then a single sweep over all nodes from the highest rank down, each taking the best of the arcs that come
+// down into it from nodes already swept. Nodes are laid out in sweep order, so the sweep reads memory front to back.
+// The sweep goes level by level, a level being nodes with no arcs between them, and every level is split over the job system
+class IsochroneGraph {
+
+public:
+	std::shared_ptr<const ContractionHierarchy> hierarchy;
+	std::vector<int> sweepNode; // Node at every position of the sweep
+	std::vector<int> position; // Of every node in the sweep
+	std::vector<int> sweepCell; // Cell of the node at every position of the sweep
+	std::vector<int> cellPosition; // Per cell, -1 if no node is there
+	std::vector<int> levelStart; // First position of every level, and one past the last
+	std::vector<int> arcStart; // Per position, into the arrays below
+	std::vector<int> arcSource; // Position of the higher node the arc comes down from
+	std::vector<float> arcWeight;
+
+public:
+	static std::shared_ptr<IsochroneGraph> Build(std::shared_ptr<const ContractionHierarchy> hierarchy, const std::vector<int>& nodeCell, int cellCount)
+	{
+		auto graph = std::make_shared<IsochroneGraph>();
+		graph->hierarchy = hierarchy;
+		const ContractionHierarchy& ch = *hierarchy;
+		const int n = ch.NodeCount();
+
+		std::vector<int> byRank(n);
+		for (int u = 0; u < n; u++) byRank[ch.rank[u]] = u;
+
+		// A node's level is one below the lowest of the nodes it has arcs down from, so arcs only ever go between levels
+		std::vector<int> level(n, 0);
+		int levelCount = 0;
+		for (int r = n - 1; r >= 0; r--) {
+			int v = byRank[r];
+			for (int i = ch.downStart[v]; i < ch.downStart[v + 1]; i++) level[v] = std::max(level[v], level[ch.arcs[ch.downArcs[i]].source] + 1);
+			levelCount = std::max(levelCount, level[v] + 1);
+		}
+
+		graph->levelStart.assign(levelCount + 1, 0);
+		for (int u = 0; u < n; u++) graph->levelStart[level[u] + 1]++;
+		for (int l = 0; l < levelCount; l++) graph->levelStart[l + 1] += graph->levelStart[l];
+
+		// Highest rank first within a level, which keeps nodes near the ones they come down from
+		std::vector<int>& sweepNode = graph->sweepNode;
+		std::vector<int>& position = graph->position;
+		sweepNode.resize(n);
+		position.resize(n);
+		std::vector<int> fill(graph->levelStart.begin(), graph->levelStart.end() - 1);
+		for (int r = n - 1; r >= 0; r--) {
+			int v = byRank[r];
+			position[v] = fill[level[v]]++;
+			sweepNode[position[v]] = v;
+		}
+
+		graph->sweepCell.resize(n);
+		graph->cellPosition.assign(cellCount, -1);
+		graph->arcStart.resize(n + 1);
+		for (int p = 0; p < n; p++) {
+			int v = sweepNode[p];
+			graph->sweepCell[p] = nodeCell[v];
+			graph->cellPosition[nodeCell[v]] = p;
+			graph->arcStart[p] = (int)graph->arcSource.size();
+			for (int i = ch.downStart[v]; i < ch.downStart[v + 1]; i++) {
+				const ContractionHierarchy::Arc& arc = ch.arcs[ch.downArcs[i]];
+				graph->arcSource.push_back(position[arc.source]);
+				graph->arcWeight.push_back(arc.weight);
+			}
+		}
+		graph->arcStart[n] = (int)graph->arcSource.size();
+
+		return graph;
+	}
+
+	int NodeCount() const { return (int)sweepCell.size(); }
+	int LevelCount() const { return (int)levelStart.size() - 1; }
+
+	// Seconds from the cell to the node at every position of the sweep, infinity where there is no way there.
+	// False if there is no node at the cell
+	bool Search(int sourceCell, JobSystem& jobs, std::vector<float>& seconds) const
+	{
+		int source = sourceCell >= 0 && sourceCell < (int)cellPosition.size() ? cellPosition[sourceCell] : -1;
+		if (source < 0) return false;
+
+		seconds.assign(NodeCount(), INFINITY);
+		std::vector<std::pair<int, float>> space;
+		hierarchy->UpwardSearch(sweepNode[source], true, space);
+		for (const auto& [node, dist] : space) seconds[position[node]] = dist;
+
+		for (int l = 0; l < LevelCount(); l++) {
+			jobs.ParallelFor(levelStart[l], levelStart[l + 1], 1024, [&](int begin, int end) {
+				for (int p = begin; p < end; p++) {
+					float best = seconds[p];
+					for (int i = arcStart[p]; i < arcStart[p + 1]; i++) best = std::min(best, seconds[arcSource[i]] + arcWeight[i]);
+					seconds[p] = best;
+				}
+			});
+		}
+		return true;
+	}
+};
+
+// Everything reachable from the cell under the cursor within a time limit, drawn over the roads in bands.
+// Searches run as background jobs, one at a time, and the latest result stays up until the next one is done,
+// so moving the cursor never holds up a frame. The sweep layout is kept until the simulation adopts a new hierarchy
+class IsochroneOverlay {
+
+public:
+	bool enabled = false;
+	float limitSeconds = 120.0f;
+	static constexpr int bands = 6; // Colour steps from the source out to the limit
+
+private:
+	struct Search {
+		std::shared_ptr<const ContractionHierarchy> hierarchy;
+		std::shared_ptr<const std::vector<int>> cells;
+		int sourceCell = -1;
+
+		// Filled in by the job
+		std::shared_ptr<const IsochroneGraph> graph; // Handed in if it is still the one for the hierarchy
+		std::vector<float> seconds;
+		bool found = false;
+		double milliseconds = 0.0;
+		std::atomic<int> remaining = 0;
+	};
+
+	olc::vi2d worldSize = { 0, 0 };
+	PagedTexture texture;
+	std::shared_ptr<Search> running;
+	std::shared_ptr<Search> finished; // Last one done, whether or not the cell had a road in its hierarchy
+	std::shared_ptr<Search> shown;
+	std::shared_ptr<const IsochroneGraph> graph;
+	std::vector<int> paintedCells;
+	int wantedCell = -1;
+	float shownLimit = 0.0f;
+	int reachable = 0;
+
+public:
+	// Needs the engine running, the overlay is a texture
+	void Resize(olc::vi2d newWorldSize)
+	{
+		Release();
+		worldSize = newWorldSize;
+		texture.Resize(worldSize);
+	}
+
+	// Textures have to go while the engine is still running
+	void Release()
+	{
+		texture.Release();
+		finished = nullptr;
+		shown = nullptr;
+		graph = nullptr;
+		paintedCells.clear();
+	}
+
+	// The cell to search from, -1 to keep the last one
+	void Update(const SimulationSnapshot& snapshot, int sourceCell, JobSystem& jobs)
+	{
+		if (sourceCell >= 0) wantedCell = sourceCell;
+
+		if (running && running->remaining.load(std::memory_order_acquire) == 0) {
+			graph = running->graph;
+			finished = running;
+			if (running->found) {
+				shown = running;
+				Paint();
+			}
+			running = nullptr;
+		}
+		if (shown && shownLimit != limitSeconds) Paint();
+
+		// Only one search at a time, by the time it is done the cursor has moved on anyway
+		if (running || wantedCell < 0 || !snapshot.hierarchy) return;
+		if (finished && finished->sourceCell == wantedCell && finished->hierarchy == snapshot.hierarchy) return;
+
+		auto search = std::make_shared<Search>();
+		search->hierarchy = snapshot.hierarchy;
+		search->cells = snapshot.hierarchyCells;
+		search->sourceCell = wantedCell;
+		if (graph && graph->hierarchy == snapshot.hierarchy) search->graph = graph;
+		search->remaining = 1;
+		running = search;
+
+		int cellCount = worldSize.x * worldSize.y;
+		jobs.SubmitBackground([search, cellCount, &jobs] {
+			auto start = std::chrono::steady_clock::now();
+			if (!search->graph) search->graph = IsochroneGraph::Build(search->hierarchy, *search->cells, cellCount);
+			search->found = search->graph->Search(search->sourceCell, jobs, search->seconds);
+			search->milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}, &search->remaining);
+	}
+
+	void Draw(olc::TransformedView& tv, olc::vi2d tileSize)
+	{
+		if (shown) texture.Draw(tv, tileSize);
+	}
+
+	bool HasResult() const { return shown != nullptr; }
+	olc::vi2d Source() const { return shown ? olc::vi2d(shown->sourceCell % worldSize.x, shown->sourceCell / worldSize.x) : olc::vi2d(-1, -1); }
+	int Reachable() const { return reachable; } // Road tiles within the limit
+	double SearchMilliseconds() const { return shown ? shown->milliseconds : 0.0; }
+
+private:
+	void Paint()
+	{
+		for (int cell : paintedCells) texture.SetTexel(cell % worldSize.x, cell / worldSize.x, olc::BLANK);
+		paintedCells.clear();
+		shownLimit = limitSeconds;
+		reachable = 0;
+
+		const IsochroneGraph& shownGraph = *shown->graph;
+		for (int p = 0; p < shownGraph.NodeCount(); p++) {
+			float seconds = shown->seconds[p];
+			if (seconds > limitSeconds) continue;
+
+			// Green near the source to red at the limit, in bands like the contour lines of a map
+			float value = std::floor(seconds / limitSeconds * bands) / bands;
+			uint8_t red = (uint8_t)(255 * std::min(1.0f, 2.0f * value));
+			uint8_t green = (uint8_t)(255 * std::min(1.0f, 2.0f - 2.0f * value));
+
+			int cell = shownGraph.sweepCell[p];
+			texture.SetTexel(cell % worldSize.x, cell / worldSize.x, olc::Pixel(red, green, 60, 190));
+			paintedCells.push_back(cell);
+			reachable++;
+		}
+	}
+};
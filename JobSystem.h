@@ -0,0 +1,390 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+
+// Work-stealing thread pool.
+// Every worker owns a queue: it pushes and pops its own work at the back, and idle workers steal from the front of
+// somebody else's. Threads that aren't workers (engine, simulation) put their work on an injection queue of their own,
+// and run jobs from it themselves while they wait for it to finish, so waiting never wastes a core. They never take
+// anyone else's work, so a frame waiting on its own jobs can't end up running a simulation tick or the other way round.
+// Long running background work (e.g. rebuilding routing data) goes on a separate queue that only idle workers look at,
+// so it can never end up blocking a thread that is waiting on something urgent. Jobs a background job submits, e.g. the
+// pieces of its ParallelFor, go on that queue too. A pool without workers has nobody to hand background work to and
+// runs it on the spot.
+// How it scales past a few cores hasn't been measured: it has only been run on a single core machine, where every
+// thread count gives the same results at the same speed.
+class JobSystem {
+
+	using Clock = std::chrono::steady_clock;
+
+public:
+	struct Stats {
+		uint64_t tasksRun;
+		uint64_t steals;
+		double idleSeconds;
+	};
+
+private:
+	struct Job {
+		std::function<void()> fn;
+		std::atomic<int>* counter; // Decremented once the job has run, may be null
+	};
+
+	struct alignas(64) WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	struct alignas(64) WorkerStats {
+		std::atomic<uint64_t> tasksRun = 0;
+		std::atomic<uint64_t> steals = 0;
+		std::atomic<uint64_t> idleNanoseconds = 0;
+	};
+
+	// Threads outside the pool that get an injection queue of their own, any more share the last one
+	static constexpr int maxInjectionQueues = 8;
+
+	std::vector<std::thread> workers;
+	// One queue per worker, plus the injection queues at the end
+	std::unique_ptr<WorkQueue[]> queues;
+	std::mutex injectionMutex;
+	std::vector<std::thread::id> injectionThreads; // Owner of every injection queue handed out so far
+	const uint64_t id = nextId++; // Unlike the address, never reused by another pool
+	WorkQueue backgroundQueue;
+	// One slot per worker, plus one shared by every thread that isn't a worker
+	std::unique_ptr<WorkerStats[]> stats;
+	int workerCount = 0;
+
+	std::atomic<bool> running = true;
+	std::atomic<int> queuedJobs = 0;
+	std::atomic<int> sleepingWorkers = 0;
+	std::mutex sleepMutex;
+	std::condition_variable sleepSignal;
+
+	static inline std::atomic<uint64_t> nextId = 1;
+	static inline thread_local JobSystem* currentSystem = nullptr;
+	static inline thread_local uint64_t injectionSystem = 0; // Pool the thread last looked its injection queue up in
+	static inline thread_local int injectionQueue = 0;
+	static inline thread_local int currentWorker = -1;
+	static inline thread_local bool inBackground = false; // Running a background job, so whatever it submits is background work too
+
+public:
+	// threadCount = 0 makes a pool without workers, which runs everything on the calling thread
+	JobSystem(int threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1))
+		: workerCount(std::max(0, threadCount))
+	{
+		queues = std::make_unique<WorkQueue[]>(workerCount + maxInjectionQueues);
+		stats = std::make_unique<WorkerStats[]>(workerCount + 1);
+
+		for (int i = 0; i < workerCount; i++) {
+			workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+		}
+	}
+
+	~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			running = false;
+		}
+		sleepSignal.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	int WorkerCount() const { return workerCount; }
+
+	// Number of threads that can be running jobs at once, counting the one waiting on them
+	int Concurrency() const { return workerCount + 1; }
+
+	// Queue a job. If a counter is given, it is decremented once the job has run, so it has to be incremented beforehand
+	void Submit(std::function<void()> fn, std::atomic<int>* counter = nullptr)
+	{
+		if (workerCount == 0) {
+			// Nobody else would ever pick it up
+			Execute({ std::move(fn), counter }, workerCount);
+			return;
+		}
+		if (inBackground) {
+			SubmitBackground(std::move(fn), counter);
+			return;
+		}
+
+		WorkQueue& queue = queues[Self()];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back({ std::move(fn), counter });
+		}
+		queuedJobs++;
+
+		if (sleepingWorkers > 0) {
+			// Taking the lock stops the wakeup from slipping in between a worker's check and its wait
+			{ std::lock_guard<std::mutex> lock(sleepMutex); }
+			sleepSignal.notify_one();
+		}
+	}
+
+	// Queue a job that runs whenever a worker has nothing better to do. Waiting threads never pick these up
+	void SubmitBackground(std::function<void()> fn, std::atomic<int>* counter = nullptr)
+	{
+		if (workerCount == 0) {
+			Execute({ std::move(fn), counter }, workerCount);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(backgroundQueue.mutex);
+			backgroundQueue.jobs.push_back({ std::move(fn), counter });
+		}
+		queuedJobs++;
+
+		{ std::lock_guard<std::mutex> lock(sleepMutex); }
+		sleepSignal.notify_one();
+	}
+
+	// Runs other jobs until the counter reaches zero. A thread outside the pool only runs jobs it submitted itself, and
+	// only a background job waiting on its own pieces takes background work.
+	// Which is also why a job must never wait for background work: a background job waiting on its pieces may pick it up,
+	// and then what it waits for sits further down the same thread's stack. Wait for it from outside the pool instead
+	void Wait(std::atomic<int>& counter)
+	{
+		int self = Self();
+		while (counter.load(std::memory_order_acquire) > 0) {
+			Job job;
+			if (FindJob(self, job)) Execute(std::move(job), self);
+			else if (inBackground && FindBackgroundJob(job)) Execute(std::move(job), self, true);
+			else std::this_thread::yield();
+		}
+	}
+
+	// Calls body(rangeBegin, rangeEnd) over [begin, end) split into pieces of at least grainSize, and waits for all of them
+	template<typename F>
+	void ParallelFor(int begin, int end, int grainSize, F&& body)
+	{
+		int count = end - begin;
+		if (count <= 0) return;
+
+		// A few pieces per thread evens out uneven work without drowning in tiny jobs
+		int pieces = std::min((count + grainSize - 1) / std::max(1, grainSize), Concurrency() * 4);
+		if (pieces <= 1 || workerCount == 0) {
+			body(begin, end);
+			return;
+		}
+
+		std::atomic<int> remaining = pieces;
+		for (int piece = 1; piece < pieces; piece++) {
+			int pieceBegin = begin + (int)((int64_t)count * piece / pieces);
+			int pieceEnd = begin + (int)((int64_t)count * (piece + 1) / pieces);
+			Submit([&body, pieceBegin, pieceEnd] { body(pieceBegin, pieceEnd); }, &remaining);
+		}
+
+		// Do the first piece here rather than sitting idle
+		body(begin, begin + (int)((int64_t)count / pieces));
+		remaining--;
+
+		Wait(remaining);
+	}
+
+	std::vector<Stats> GetStats() const
+	{
+		std::vector<Stats> result;
+		for (int i = 0; i <= workerCount; i++) {
+			result.push_back({ stats[i].tasksRun, stats[i].steals, stats[i].idleNanoseconds * 1e-9 });
+		}
+		return result;
+	}
+
+private:
+	bool IsWorker() const { return currentSystem == this && currentWorker >= 0; }
+
+	// Queue the calling thread submits to: its own if it is a worker, otherwise its injection queue
+	int Self()
+	{
+		if (IsWorker()) return currentWorker;
+		if (injectionSystem != id) {
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			std::thread::id thread = std::this_thread::get_id();
+			auto it = std::find(injectionThreads.begin(), injectionThreads.end(), thread);
+			int index = (int)(it - injectionThreads.begin());
+			if (it == injectionThreads.end()) injectionThreads.push_back(thread);
+			injectionQueue = workerCount + std::min(index, maxInjectionQueues - 1);
+			injectionSystem = id;
+		}
+		return injectionQueue;
+	}
+
+	// An urgent job picked up while a background job waits doesn't get demoted to background work
+	void Execute(Job&& job, int self, bool background = false)
+	{
+		bool outerBackground = inBackground;
+		inBackground = background;
+		job.fn();
+		inBackground = outerBackground;
+		stats[std::min(self, workerCount)].tasksRun.fetch_add(1, std::memory_order_relaxed);
+		if (job.counter) job.counter->fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	bool FindBackgroundJob(Job& job)
+	{
+		if (!PopFront(backgroundQueue, job)) return false;
+		queuedJobs--;
+		return true;
+	}
+
+	bool PopBack(WorkQueue& queue, Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) return false;
+		job = std::move(queue.jobs.back());
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	bool PopFront(WorkQueue& queue, Job& job)
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) return false;
+		job = std::move(queue.jobs.front());
+		queue.jobs.pop_front();
+		return true;
+	}
+
+	bool FindJob(int self, Job& job)
+	{
+		if (queuedJobs.load(std::memory_order_acquire) == 0) return false;
+
+		// Threads outside the pool only ever run what they handed in themselves
+		if (self >= workerCount) {
+			if (!PopFront(queues[self], job)) return false;
+			queuedJobs--;
+			return true;
+		}
+
+		// Own work first, newest first while it is still in cache
+		if (PopBack(queues[self], job)) {
+			queuedJobs--;
+			return true;
+		}
+
+		// Then work handed in from outside the pool
+		for (int i = workerCount; i < workerCount + maxInjectionQueues; i++) {
+			if (PopFront(queues[i], job)) {
+				queuedJobs--;
+				return true;
+			}
+		}
+
+		// Then steal the oldest job of another worker, which tends to be the biggest piece left
+		for (int i = 1; i <= workerCount; i++) {
+			int victim = (self + i) % workerCount;
+			if (victim == self) continue;
+			if (PopFront(queues[victim], job)) {
+				queuedJobs--;
+				stats[self].steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void WorkerLoop(int index)
+	{
+		currentSystem = this;
+		currentWorker = index;
+
+		while (running) {
+			Job job;
+			if (FindJob(index, job)) {
+				Execute(std::move(job), index);
+				continue;
+			}
+
+			if (FindBackgroundJob(job)) {
+				Execute(std::move(job), index, true);
+				continue;
+			}
+
+			Clock::time_point idleStart = Clock::now();
+
+			// Spin a little before going to sleep, new work usually comes in bursts
+			bool found = false;
+			for (int spin = 0; spin < 64 && !found; spin++) {
+				std::this_thread::yield();
+				found = queuedJobs > 0;
+			}
+
+			if (!found) {
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepingWorkers++;
+				sleepSignal.wait(lock, [this] { return queuedJobs > 0 || !running; });
+				sleepingWorkers--;
+			}
+
+			stats[index].idleNanoseconds.fetch_add(
+				std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - idleStart).count(),
+				std::memory_order_relaxed);
+		}
+	}
+};
+
+// A small set of jobs with dependencies between them, e.g. the phases of a simulation tick.
+// Built once and run as many times as needed
+class JobGraph {
+
+private:
+	struct Node {
+		std::function<void()> fn;
+		std::vector<int> dependents;
+		int dependencyCount = 0;
+		std::atomic<int> pending = 0;
+	};
+
+	std::deque<Node> nodes; // deque so atomics never have to move
+
+public:
+	// Returns the id to use when other jobs depend on this one
+	int Add(std::function<void()> fn, std::initializer_list<int> dependencies = {})
+	{
+		int id = (int)nodes.size();
+		Node& node = nodes.emplace_back();
+		node.fn = std::move(fn);
+		for (int dependency : dependencies) {
+			nodes[dependency].dependents.push_back(id);
+			node.dependencyCount++;
+		}
+		return id;
+	}
+
+	void Run(JobSystem& jobs)
+	{
+		std::atomic<int> remaining = (int)nodes.size();
+		for (Node& node : nodes) node.pending = node.dependencyCount;
+
+		for (int i = 0; i < (int)nodes.size(); i++) {
+			if (nodes[i].dependencyCount == 0) Launch(jobs, i, remaining);
+		}
+		jobs.Wait(remaining);
+	}
+
+private:
+	void Launch(JobSystem& jobs, int id, std::atomic<int>& remaining)
+	{
+		jobs.Submit([this, &jobs, id, &remaining] {
+			nodes[id].fn();
+			for (int dependent : nodes[id].dependents) {
+				if (--nodes[dependent].pending == 0) Launch(jobs, dependent, remaining);
+			}
+		}, &remaining);
+	}
+};
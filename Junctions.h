@@ -0,0 +1,113 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "RoadNetwork.h"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Space-time reservations for crossing junctions.
+// A junction tile is split into four quadrants, and every movement through it (arriving in one direction, leaving
+// in another) covers some of them, worked out once from the lane geometry. Vehicles about to cross ask for their
+// quadrants for the ticks the crossing takes, and only go if none of them are taken. Each junction keeps a short
+// ring of per-tick quadrant masks, so a request costs the same however many vehicles are queuing for the junction
+class JunctionReservations {
+
+public:
+	static constexpr int horizon = 32; // Ticks ahead that can be reserved
+
+private:
+	struct Slot {
+		uint32_t tick; // Low bits of the tick the mask is for, anything else is stale
+		uint8_t quadrants;
+	};
+
+	uint8_t movementQuadrants[4][4] = {}; // [arrival direction][departure direction]
+	std::vector<int> nodeJunction; // -1 if the node isn't a junction
+	std::vector<Slot> slots; // horizon per junction
+	int junctionCount = 0;
+
+public:
+	JunctionReservations(float laneOffset = 0.2f)
+	{
+		for (int in = 0; in < 4; in++) {
+			for (int out = 0; out < 4; out++) {
+				movementQuadrants[in][out] = TraceMovement(in, out, laneOffset);
+			}
+		}
+	}
+
+	// Nodes where three or more roads meet are junctions
+	void Build(const RoadNetwork& roads)
+	{
+		nodeJunction.assign(roads.NodeCount(), -1);
+		junctionCount = 0;
+		for (int node = 0; node < roads.NodeCount(); node++) {
+			if (roads.OutDegree(node) >= 3) nodeJunction[node] = junctionCount++;
+		}
+		slots.assign((size_t)junctionCount * horizon, { UINT32_MAX, 0 });
+	}
+
+	int JunctionCount() const { return junctionCount; }
+	int JunctionOf(int node) const { return nodeJunction[node]; }
+
+	// Quadrants covered going from one edge onto the next
+	uint8_t Movement(const RoadNetwork& roads, int fromEdge, int toEdge) const
+	{
+		return movementQuadrants[roads.edgeDirection[fromEdge]][roads.edgeDirection[toEdge]];
+	}
+
+	// Takes the quadrants for [tick, tick + duration) if they are all free. Different junctions can be reserved from different threads
+	bool Reserve(int junction, uint64_t tick, int duration, uint8_t quadrants)
+	{
+		duration = std::min(duration, horizon);
+		for (int t = 0; t < duration; t++) {
+			if (Quadrants(junction, tick + t) & quadrants) return false;
+		}
+		for (int t = 0; t < duration; t++) Occupy(junction, tick + t, quadrants);
+		return true;
+	}
+
+	// Marks quadrants as taken no matter what, for vehicles still in the junction
+	void Occupy(int junction, uint64_t tick, uint8_t quadrants)
+	{
+		Slot& slot = slots[(size_t)junction * horizon + tick % horizon];
+		if (slot.tick != (uint32_t)tick) slot = { (uint32_t)tick, 0 };
+		slot.quadrants |= quadrants;
+	}
+
+	uint8_t Quadrants(int junction, uint64_t tick) const
+	{
+		const Slot& slot = slots[(size_t)junction * horizon + tick % horizon];
+		return slot.tick == (uint32_t)tick ? slot.quadrants : 0;
+	}
+
+private:
+	// Follows the lane from the middle of the side the vehicle comes in at, round the corner where its lane meets the
+	// lane it leaves on, out to the middle of the side it leaves at, and notes every quadrant it passes through.
+	// Quadrants are numbered 0 = -x -y, 1 = +x -y, 2 = -x +y, 3 = +x +y
+	static uint8_t TraceMovement(int in, int out, float laneOffset)
+	{
+		olc::vf2d dirIn = { (float)RoadNetwork::directionX[in], (float)RoadNetwork::directionY[in] };
+		olc::vf2d dirOut = { (float)RoadNetwork::directionX[out], (float)RoadNetwork::directionY[out] };
+		// Traffic keeps to the right, the same way vehicles are drawn
+		olc::vf2d rightIn = olc::vf2d(-dirIn.y, dirIn.x) * laneOffset;
+		olc::vf2d rightOut = olc::vf2d(-dirOut.y, dirOut.x) * laneOffset;
+
+		std::vector<olc::vf2d> path = { dirIn * -0.5f + rightIn, rightIn };
+		if (in != out) path.push_back(dirIn.dot(dirOut) == 0.0f ? rightIn + rightOut : rightOut);
+		path.push_back(dirOut * 0.5f + rightOut);
+
+		uint8_t quadrants = 0;
+		const int steps = 16;
+		for (size_t i = 0; i + 1 < path.size(); i++) {
+			for (int s = 0; s <= steps; s++) {
+				olc::vf2d p = path[i] + (path[i + 1] - path[i]) * ((float)s / steps);
+				if (p.x == 0.0f || p.y == 0.0f) continue; // On the line between two quadrants
+				quadrants |= 1 << ((p.x > 0.0f ? 1 : 0) + (p.y > 0.0f ? 2 : 0));
+			}
+		}
+		return quadrants;
+	}
+};
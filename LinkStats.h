@@ -0,0 +1,216 @@
+#pragma once
+
+#include "QuantileSketch.h"
+
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+// Flow, occupancy and speed of every road link over time, counted as the simulation runs.
+// A link is the road between two cells, so it keeps its history when edges are renumbered by a road edit.
+//
+// While a bin is open, the simulation counts into per-region shards that only the region's own thread writes,
+// and adds them into the running totals here when the bin closes. Every level then keeps, per closed bin, the
+// totals of every link since the start: one column per counter with a row of links per bin. The counts between
+// any two bin ends are a subtraction, and finding the bins is a binary search over their end ticks.
+// Fine bins are only kept for a while, coarser ones for longer, and a query uses the finest level that reaches back far enough.
+// Totals are stored in 32 bits and allowed to wrap, which halves the memory and still subtracts to the right count
+// as long as that fits in 32 bits: weeks of a link that is jammed solid
+class LinkStats {
+
+public:
+	// What the simulation counts per edge, reset whenever it is added in
+	struct Counters {
+		uint32_t exits = 0; // Vehicles that drove to the end of the link
+		uint32_t vehicleTicks = 0; // Vehicles on the link, added up over ticks
+		uint32_t travelTicks = 0; // How long the vehicles that left took to drive it
+	};
+
+	// Counts over whole bins, fromTick and toTick are the bin ends the query was rounded out to
+	struct Totals {
+		uint64_t fromTick = 0;
+		uint64_t toTick = 0;
+		uint64_t exits = 0;
+		uint64_t vehicleTicks = 0;
+		uint64_t travelTicks = 0;
+	};
+
+	struct Summary {
+		double flowPerHour = 0.0; // Vehicles
+		double meanVehicles = 0.0;
+		double density = 0.0; // Vehicles per tile
+		double meanSpeed = 0.0; // Tiles per second, 0 if nobody drove the link
+	};
+
+	struct LevelConfig {
+		double binSeconds;
+		double keepSeconds; // 0 to keep every bin
+	};
+
+	// Every bin size has to be a multiple of the one before, so all levels close a bin at the same time
+	std::vector<LevelConfig> levelConfigs = { { 60.0, 2.0 * 3600.0 }, { 900.0, 24.0 * 3600.0 }, { 3600.0, 0.0 } };
+
+private:
+	enum Column { Exits, VehicleTicks, TravelTicks, ColumnCount };
+
+	struct Level {
+		uint64_t binTicks = 1;
+		size_t keepBins = 0;
+		std::vector<uint64_t> binEnd; // Tick every kept bin closed at, ascending
+		std::vector<size_t> rowStart; // Where every bin's row starts in the columns. Links added since aren't in older rows
+		std::vector<uint32_t> columns[ColumnCount];
+
+		size_t RowWidth(size_t bin) const { return (bin + 1 < rowStart.size() ? rowStart[bin + 1] : columns[0].size()) - rowStart[bin]; }
+		uint32_t Value(size_t bin, int link, Column column) const { return (size_t)link < RowWidth(bin) ? columns[column][rowStart[bin] + link] : 0; }
+		uint32_t Difference(size_t from, size_t to, int link, Column column) const { return Value(to, link, column) - Value(from, link, column); }
+	};
+
+	float tickLength = 1.0f / 20.0f;
+	std::vector<Level> levels;
+	std::vector<uint32_t> totals[ColumnCount]; // Per link, since the start
+	std::vector<int> linkSource; // Cells
+	std::vector<int> linkTarget;
+	std::vector<float> linkLength; // Tiles
+	std::deque<QuantileSketch> travelTimes; // Per link, over the whole run. A deque since sketches can't move
+	std::unordered_map<uint64_t, int> linkOfCells;
+
+public:
+	// Forgets everything, the first bin starts at the tick
+	void Start(float simulationTickLength, uint64_t tick)
+	{
+		tickLength = simulationTickLength;
+		for (std::vector<uint32_t>& column : totals) column.clear();
+		linkSource.clear();
+		linkTarget.clear();
+		linkLength.clear();
+		travelTimes.clear();
+		linkOfCells.clear();
+
+		levels.assign(levelConfigs.size(), {});
+		for (size_t l = 0; l < levels.size(); l++) {
+			Level& level = levels[l];
+			level.binTicks = std::max<uint64_t>(1, (uint64_t)std::llround(levelConfigs[l].binSeconds / tickLength));
+			level.keepBins = levelConfigs[l].keepSeconds > 0.0 ? (size_t)std::ceil(levelConfigs[l].keepSeconds / levelConfigs[l].binSeconds) : 0;
+			// An empty row to subtract from, every link was at zero
+			level.binEnd.push_back(tick);
+			level.rowStart.push_back(0);
+		}
+	}
+
+	// The link from one cell to another, added if it is new
+	int Link(int sourceCell, int targetCell, float length)
+	{
+		auto [it, added] = linkOfCells.try_emplace(((uint64_t)(uint32_t)sourceCell << 32) | (uint32_t)targetCell, (int)linkSource.size());
+		if (added) {
+			linkSource.push_back(sourceCell);
+			linkTarget.push_back(targetCell);
+			linkLength.push_back(length);
+			travelTimes.emplace_back();
+			for (std::vector<uint32_t>& column : totals) column.push_back(0);
+		}
+		else linkLength[it->second] = length;
+		return it->second;
+	}
+
+	// -1 if there never was a road from one cell to the other
+	int FindLink(int sourceCell, int targetCell) const
+	{
+		auto it = linkOfCells.find(((uint64_t)(uint32_t)sourceCell << 32) | (uint32_t)targetCell);
+		return it != linkOfCells.end() ? it->second : -1;
+	}
+
+	int LinkCount() const { return (int)linkSource.size(); }
+	int LinkSource(int link) const { return linkSource[link]; }
+	int LinkTarget(int link) const { return linkTarget[link]; }
+	float LinkLength(int link) const { return linkLength[link]; }
+	// In ticks. Safe to add to from any thread during a tick
+	QuantileSketch& TravelTimes(int link) { return travelTimes[link]; }
+	const QuantileSketch& TravelTimes(int link) const { return travelTimes[link]; }
+
+	void Add(int link, const Counters& counters)
+	{
+		totals[Exits][link] += counters.exits;
+		totals[VehicleTicks][link] += counters.vehicleTicks;
+		totals[TravelTicks][link] += counters.travelTicks;
+	}
+
+	// Whether the finest bin closes at the tick. Counters have to be added in before CloseBins
+	bool ClosesBin(uint64_t tick) const { return !levels.empty() && tick % levels[0].binTicks == 0; }
+
+	void CloseBins(uint64_t tick)
+	{
+		for (Level& level : levels) {
+			if (tick % level.binTicks != 0) continue;
+
+			level.binEnd.push_back(tick);
+			level.rowStart.push_back(level.columns[0].size());
+			for (int c = 0; c < ColumnCount; c++) level.columns[c].insert(level.columns[c].end(), totals[c].begin(), totals[c].end());
+
+			// Rows past the ones kept only go in batches, so dropping them doesn't cost a copy every bin
+			if (level.keepBins > 0 && level.binEnd.size() > level.keepBins + level.keepBins / 4 + 1) {
+				size_t drop = level.binEnd.size() - (level.keepBins + 1);
+				size_t dropValues = level.rowStart[drop];
+				for (std::vector<uint32_t>& column : level.columns) column.erase(column.begin(), column.begin() + dropValues);
+				level.binEnd.erase(level.binEnd.begin(), level.binEnd.begin() + drop);
+				level.rowStart.erase(level.rowStart.begin(), level.rowStart.begin() + drop);
+				for (size_t& start : level.rowStart) start -= dropValues;
+			}
+		}
+	}
+
+	// Counts on the link from the last bin end at or before fromTick to the first one at or after toTick,
+	// or the latest bin end if there is none yet. False if no bin has closed in between
+	bool Query(int link, uint64_t fromTick, uint64_t toTick, Totals& out) const
+	{
+		if (levels.empty() || link < 0 || link >= LinkCount()) return false;
+
+		// Finest level that still has a bin end at or before the start, or else the one that reaches back furthest
+		size_t l = 0;
+		while (l + 1 < levels.size() && levels[l].binEnd.front() > fromTick) l++;
+		const Level& level = levels[l];
+
+		size_t from = std::upper_bound(level.binEnd.begin(), level.binEnd.end(), fromTick) - level.binEnd.begin();
+		from = from > 0 ? from - 1 : 0;
+		size_t to = std::lower_bound(level.binEnd.begin(), level.binEnd.end(), toTick) - level.binEnd.begin();
+		to = std::min(to, level.binEnd.size() - 1);
+		if (to <= from) return false;
+
+		out.fromTick = level.binEnd[from];
+		out.toTick = level.binEnd[to];
+		out.exits = level.Difference(from, to, link, Exits);
+		out.vehicleTicks = level.Difference(from, to, link, VehicleTicks);
+		out.travelTicks = level.Difference(from, to, link, TravelTicks);
+		return true;
+	}
+
+	Summary Summarise(int link, const Totals& totals) const
+	{
+		Summary summary;
+		double seconds = (totals.toTick - totals.fromTick) * (double)tickLength;
+		if (seconds <= 0.0) return summary;
+
+		summary.flowPerHour = totals.exits * 3600.0 / seconds;
+		summary.meanVehicles = (double)totals.vehicleTicks / (totals.toTick - totals.fromTick);
+		summary.density = summary.meanVehicles / linkLength[link];
+		// Space mean speed: the distance driven over the time it took
+		if (totals.travelTicks > 0) summary.meanSpeed = totals.exits * (double)linkLength[link] / (totals.travelTicks * (double)tickLength);
+		return summary;
+	}
+
+	// Bin ends kept at a level, oldest first
+	int LevelCount() const { return (int)levels.size(); }
+	const std::vector<uint64_t>& BinEnds(int level) const { return levels[level].binEnd; }
+
+	size_t MemoryBytes() const
+	{
+		size_t bytes = travelTimes.size() * sizeof(QuantileSketch);
+		for (const Level& level : levels) {
+			bytes += level.binEnd.capacity() * sizeof(uint64_t) + level.rowStart.capacity() * sizeof(size_t);
+			for (const std::vector<uint32_t>& column : level.columns) bytes += column.capacity() * sizeof(uint32_t);
+		}
+		return bytes;
+	}
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "olcPGEX_TransformedView.h"
+
+#include <vector>
+#include <memory>
+
+// A texture with a texel per world cell, or per block of cells, laid over the ground tiles as warped decals.
+// It is cut into pages, and a page is only uploaded again when a texel on it changed and it is on screen,
+// so overlays that change a few cells at a time don't pay for the whole world
+class PagedTexture {
+
+public:
+	static constexpr int pageSize = 64; // Texels along each side of a page
+
+private:
+	struct Page {
+		std::unique_ptr<olc::Sprite> sprite;
+		std::unique_ptr<olc::Decal> decal;
+		bool dirty = false; // Only uploaded once it is drawn
+	};
+
+	olc::vi2d size = { 0, 0 };
+	olc::vi2d pageCount = { 0, 0 };
+	std::vector<Page> pages;
+
+public:
+	// Needs the engine running, the pages are textures. Every texel starts out clear
+	void Resize(olc::vi2d newSize)
+	{
+		size = newSize;
+		pageCount = (size + olc::vi2d(pageSize - 1, pageSize - 1)) / pageSize;
+		pages.clear();
+		pages.resize((size_t)pageCount.x * pageCount.y);
+		for (Page& page : pages) {
+			page.sprite = std::make_unique<olc::Sprite>(pageSize, pageSize);
+			for (int i = 0; i < pageSize * pageSize; i++) page.sprite->GetData()[i] = olc::BLANK;
+			page.decal = std::make_unique<olc::Decal>(page.sprite.get());
+		}
+	}
+
+	// Textures have to go while the engine is still running
+	void Release()
+	{
+		pages.clear();
+		size = { 0, 0 };
+		pageCount = { 0, 0 };
+	}
+
+	olc::vi2d Size() const { return size; }
+
+	void SetTexel(int x, int y, olc::Pixel colour)
+	{
+		Page& page = pages[(y / pageSize) * pageCount.x + x / pageSize];
+		olc::Pixel& texel = page.sprite->GetData()[(y % pageSize) * pageSize + x % pageSize];
+		if (texel == colour) return;
+		texel = colour;
+		page.dirty = true;
+	}
+
+	// Texel (x, y) covers cells from (x, y) * cellsPerTexel, drawn where their ground tiles are:
+	// the top corner of cell (x, y) is half a tile right of (x, y) in screen space
+	void Draw(olc::TransformedView& tv, olc::vi2d tileSize, int cellsPerTexel = 1)
+	{
+		auto toScreen = [tileSize](float x, float y) {
+			return olc::vf2d((x - y + 1.0f) * tileSize.x * 0.5f, (x + y) * tileSize.y * 0.5f);
+		};
+
+		float pageCells = (float)(pageSize * cellsPerTexel);
+		for (int py = 0; py < pageCount.y; py++) {
+			for (int px = 0; px < pageCount.x; px++) {
+				float x0 = px * pageCells;
+				float y0 = py * pageCells;
+				float x1 = x0 + pageCells;
+				float y1 = y0 + pageCells;
+
+				// Top left, bottom left, bottom right and top right of the texture
+				olc::vf2d corners[4] = { toScreen(x0, y0), toScreen(x0, y1), toScreen(x1, y1), toScreen(x1, y0) };
+				olc::vf2d boundsMin = { corners[1].x, corners[0].y };
+				olc::vf2d boundsMax = { corners[3].x, corners[2].y };
+				if (!tv.IsRectVisible(boundsMin, boundsMax - boundsMin)) continue;
+
+				Page& page = pages[py * pageCount.x + px];
+				if (page.dirty) {
+					page.decal->Update();
+					page.dirty = false;
+				}
+				tv.DrawWarpedDecal(page.decal.get(), corners);
+			}
+		}
+	}
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "Trajectory.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file through the virtual memory system: nothing is read until it is touched, and
+// whatever is touched stays in the page cache for next time
+class MappedFile {
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const std::string& filename)
+	{
+		Close();
+#if defined(_WIN32)
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			Close();
+			return false;
+		}
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = (size_t)fileSize.QuadPart;
+#else
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return false;
+		}
+		void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		// The mapping keeps the file alive on its own
+		close(fd);
+		if (mapped == MAP_FAILED) return false;
+		data = (const uint8_t*)mapped;
+		size = (size_t)info.st_size;
+#endif
+		if (!data) Close();
+		return data != nullptr;
+	}
+
+	void Close()
+	{
+#if defined(_WIN32)
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data) munmap((void*)data, size);
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+};
+
+// Random access to a trajectory file written by TrajectoryRecorder. Finding the block for a tick is a division and
+// a look into the index, and any block can be decoded on its own, from any thread
+class TrajectoryReader {
+
+private:
+	MappedFile file;
+	TrajectoryFormat::FileHeader header = {};
+	TrajectoryFormat::Footer footer = {};
+	const uint8_t* index = nullptr; // Not necessarily aligned, so entries are copied out
+	uint64_t frameCount = 0;
+
+public:
+	bool Open(const std::string& filename)
+	{
+		if (!file.Open(filename)) {
+			printf("Error reading trajectory: can't open %s\n", filename.c_str());
+			return false;
+		}
+
+		const uint8_t* data = file.Data();
+		size_t size = file.Size();
+		if (size < sizeof(header) + sizeof(footer)) return Fail(filename, "too short");
+		memcpy(&header, data, sizeof(header));
+		memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+		if (header.magic != TrajectoryFormat::fileMagic || header.version != TrajectoryFormat::version) return Fail(filename, "not a trajectory file");
+		if (footer.magic != TrajectoryFormat::footerMagic || header.framesPerBlock == 0 || header.tickInterval == 0) return Fail(filename, "unfinished recording");
+		if (footer.indexOffset < sizeof(header) || footer.indexOffset > size - sizeof(footer) ||
+			(size - sizeof(footer) - footer.indexOffset) / sizeof(uint64_t) < footer.blockCount) return Fail(filename, "index out of bounds");
+		index = data + footer.indexOffset;
+
+		// Offsets and counts are checked before anything is read or sized with them
+		for (uint32_t block = 0; block < footer.blockCount; block++) {
+			uint64_t offset = BlockOffset(block);
+			if (offset < sizeof(header) || offset > footer.indexOffset || footer.indexOffset - offset < sizeof(TrajectoryFormat::BlockHeader)) return Fail(filename, "block out of bounds");
+			if (ReadBlockHeader(block).frameCount > header.framesPerBlock) return Fail(filename, "block has too many frames");
+		}
+		// Only the last block can be short
+		frameCount = 0;
+		if (footer.blockCount > 0) frameCount = (uint64_t)(footer.blockCount - 1) * header.framesPerBlock + ReadBlockHeader(footer.blockCount - 1).frameCount;
+		return true;
+	}
+
+	uint64_t FrameCount() const { return frameCount; }
+	int BlockCount() const { return (int)footer.blockCount; }
+	int FramesPerBlock() const { return (int)header.framesPerBlock; }
+	uint64_t FirstTick() const { return header.firstTick; }
+	uint64_t LastTick() const { return header.firstTick + (frameCount > 0 ? frameCount - 1 : 0) * header.tickInterval; }
+	uint32_t TickInterval() const { return header.tickInterval; }
+	float TickLength() const { return header.tickLength; }
+
+	// Frame at or before the tick, clamped to the recording
+	uint64_t FrameOfTick(uint64_t tick) const
+	{
+		if (frameCount == 0 || tick <= header.firstTick) return 0;
+		return std::min((tick - header.firstTick) / header.tickInterval, frameCount - 1);
+	}
+
+	int BlockOfFrame(uint64_t frame) const { return (int)(frame / header.framesPerBlock); }
+
+	// Snapshots of every frame of a block, false if the block is damaged
+	bool DecodeBlock(int block, std::vector<std::shared_ptr<SimulationSnapshot>>& frames) const
+	{
+		TrajectoryFormat::BlockHeader blockHeader = ReadBlockHeader(block);
+		uint64_t offset = BlockOffset(block) + sizeof(blockHeader);
+		if (blockHeader.compressedSize > footer.indexOffset - offset) return false;
+		// Every frame takes at least two bytes, its tick and its vehicle count
+		if (blockHeader.rawSize > TrajectoryFormat::maxRawBlockSize || blockHeader.frameCount > blockHeader.rawSize / 2) return false;
+		const uint8_t* compressed = file.Data() + offset;
+
+		std::vector<uint8_t> raw(blockHeader.rawSize);
+		if (!Lz::Decompress(compressed, blockHeader.compressedSize, raw.data(), raw.size())) return false;
+
+		TrajectoryCodec codec;
+		std::vector<TrajectoryVehicle> vehicles;
+		const uint8_t* in = raw.data();
+		uint64_t tick = blockHeader.firstTick;
+		const float scale = 1.0f / header.positionScale;
+
+		frames.resize(blockHeader.frameCount);
+		for (auto& frame : frames) {
+			uint64_t tickDelta;
+			if (!codec.DecodeFrame(in, raw.data() + raw.size(), tickDelta, vehicles)) return false;
+			tick += tickDelta;
+
+			frame = std::make_shared<SimulationSnapshot>();
+			frame->tick = tick;
+			frame->time = tick * (double)header.tickLength;
+			frame->vehicles.resize(vehicles.size());
+			for (size_t i = 0; i < vehicles.size(); i++) {
+				frame->vehicles[i] = { vehicles[i].id, olc::vf2d((float)vehicles[i].x, (float)vehicles[i].y) * scale };
+			}
+		}
+		return true;
+	}
+
+private:
+	uint64_t BlockOffset(int block) const
+	{
+		uint64_t offset;
+		memcpy(&offset, index + (size_t)block * sizeof(offset), sizeof(offset));
+		return offset;
+	}
+
+	TrajectoryFormat::BlockHeader ReadBlockHeader(int block) const
+	{
+		TrajectoryFormat::BlockHeader blockHeader;
+		memcpy(&blockHeader, file.Data() + BlockOffset(block), sizeof(blockHeader));
+		return blockHeader;
+	}
+
+	bool Fail(const std::string& filename, const char* reason)
+	{
+		printf("Error reading trajectory: %s is %s\n", filename.c_str(), reason);
+		file.Close();
+		index = nullptr;
+		frameCount = 0;
+		return false;
+	}
+};
+
+// Plays a recording back through the same SimulationFrame the live simulation hands the renderer.
+// A thread of its own keeps the blocks just ahead of the play cursor decoded, and only a few blocks around the
+// cursor are kept. Seeking anywhere is a division; if the block there isn't decoded yet it is decoded on the spot,
+// which takes a couple of milliseconds, so scrubbing never waits on the read-ahead
+class TrajectoryPlayer {
+
+public:
+	double speed = 1.0; // Simulated seconds per wall second, relative to real time
+	bool paused = false;
+	int blocksAhead = 4;
+
+private:
+	struct DecodedBlock {
+		std::vector<std::shared_ptr<SimulationSnapshot>> frames;
+	};
+
+	TrajectoryReader reader;
+	double cursor = 0.0; // Frames since the start of the recording, fractional between frames
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<std::pair<int, std::shared_ptr<const DecodedBlock>>> cache; // By block
+	int wantedBlock = 0; // Where the cursor is, what the read-ahead works from
+	bool running = false;
+	std::thread decoder;
+
+public:
+	~TrajectoryPlayer() { Close(); }
+
+	bool Open(const std::string& filename)
+	{
+		Close();
+		if (!reader.Open(filename) || reader.FrameCount() == 0) return false;
+		cursor = 0.0;
+		running = true;
+		decoder = std::thread(&TrajectoryPlayer::DecodeLoop, this);
+		return true;
+	}
+
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_all();
+		if (decoder.joinable()) decoder.join();
+		cache.clear();
+	}
+
+	const TrajectoryReader& Reader() const { return reader; }
+
+	uint64_t CurrentTick() const { return reader.FirstTick() + (uint64_t)cursor * reader.TickInterval(); }
+
+	// Position in the recording from 0 to 1
+	float Progress() const { return reader.FrameCount() > 1 ? (float)(cursor / (reader.FrameCount() - 1)) : 0.0f; }
+
+	void Seek(uint64_t tick) { SetCursor((double)reader.FrameOfTick(tick)); }
+	void SeekProgress(float progress) { SetCursor(std::clamp(progress, 0.0f, 1.0f) * (double)(reader.FrameCount() - 1)); }
+
+	// Moves the cursor on by the wall time since the last call
+	void Update(float elapsedSeconds)
+	{
+		if (paused) return;
+		double frameSeconds = reader.TickLength() * reader.TickInterval();
+		SetCursor(cursor + elapsedSeconds * speed / frameSeconds);
+	}
+
+	// The two frames either side of the cursor and how far between them it is
+	SimulationFrame GetFrame()
+	{
+		uint64_t frame = (uint64_t)cursor;
+		uint64_t next = std::min(frame + 1, reader.FrameCount() - 1);
+		return { Snapshot(frame), Snapshot(next), (float)(cursor - (double)frame) };
+	}
+
+private:
+	void SetCursor(double frame)
+	{
+		cursor = std::clamp(frame, 0.0, (double)(reader.FrameCount() - 1));
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			wantedBlock = reader.BlockOfFrame((uint64_t)cursor);
+		}
+		wake.notify_one();
+	}
+
+	std::shared_ptr<const SimulationSnapshot> Snapshot(uint64_t frame)
+	{
+		int block = reader.BlockOfFrame(frame);
+		std::shared_ptr<const DecodedBlock> decoded = Find(block);
+		if (!decoded) {
+			// Seeked past the read-ahead, so there is no point waiting for it
+			decoded = Decode(block);
+			std::lock_guard<std::mutex> lock(mutex);
+			Insert(block, decoded);
+		}
+
+		size_t index = (size_t)(frame - (uint64_t)block * reader.FramesPerBlock());
+		if (index < decoded->frames.size()) return decoded->frames[index];
+		return std::make_shared<SimulationSnapshot>(); // Damaged block, draw nothing rather than stop
+	}
+
+	std::shared_ptr<const DecodedBlock> Find(int block)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const auto& [cached, decoded] : cache) {
+			if (cached == block) return decoded;
+		}
+		return nullptr;
+	}
+
+	std::shared_ptr<const DecodedBlock> Decode(int block) const
+	{
+		auto decoded = std::make_shared<DecodedBlock>();
+		if (!reader.DecodeBlock(block, decoded->frames)) decoded->frames.clear();
+		return decoded;
+	}
+
+	// Keeps the block just behind the cursor, for stepping back, and the read-ahead. Call with the mutex held
+	void Insert(int block, std::shared_ptr<const DecodedBlock> decoded)
+	{
+		for (const auto& [cached, existing] : cache) {
+			if (cached == block) return;
+		}
+		cache.push_back({ block, std::move(decoded) });
+		cache.erase(std::remove_if(cache.begin(), cache.end(), [this](const auto& entry) {
+			return entry.first < wantedBlock - 1 || entry.first > wantedBlock + blocksAhead;
+		}), cache.end());
+	}
+
+	void DecodeLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (running) {
+			// Nearest missing block ahead of the cursor first
+			int missing = -1;
+			for (int block = wantedBlock; block <= wantedBlock + blocksAhead && block < reader.BlockCount(); block++) {
+				bool cached = std::any_of(cache.begin(), cache.end(), [block](const auto& entry) { return entry.first == block; });
+				if (!cached) {
+					missing = block;
+					break;
+				}
+			}
+
+			if (missing < 0) {
+				wake.wait(lock);
+				continue;
+			}
+
+			lock.unlock();
+			std::shared_ptr<const DecodedBlock> decoded = Decode(missing);
+			lock.lock();
+			Insert(missing, std::move(decoded));
+		}
+	}
+};
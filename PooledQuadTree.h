@@ -0,0 +1,326 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "Bits.h"
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Quad tree for boxes that mostly stay put, e.g. scenery, with every node and item in one array each and linked by
+// index, so nothing is allocated per item and nothing has to be freed one by one.
+// An item goes in the smallest node that holds it whole, like olc's DynamicQuadTree. Which node that is comes
+// straight from the box: the level is how many leading bits the grid cells of its two corners have in common,
+// so a move that stays in the same node only overwrites the box.
+// Loading a whole set at once sorts the items by node, in the order the nodes are visited, and lays them out that
+// way, so a query reads nodes and items front to back. Items inserted later take free slots or go on the end
+template<typename T>
+class PooledQuadTree {
+
+public:
+	struct Box {
+		olc::vf2d min;
+		olc::vf2d max;
+	};
+
+	static constexpr int maxLevels = 15; // So the cell and level of a node fit in 32 bits
+
+private:
+	struct Node {
+		int child[4] = { -1, -1, -1, -1 }; // Top left, top right, bottom left, bottom right
+		int firstItem = -1;
+		int level = 0;
+		int cellX = 0;
+		int cellY = 0;
+		Box area; // Grown by a hair, so rounding never leaves an item just outside its node
+	};
+
+	struct Item {
+		Box box;
+		T value;
+		int node = -1; // -1 while the slot is free
+		int previous = -1;
+		int next = -1; // Also links the free slots
+	};
+
+	struct Key {
+		int level;
+		int cellX;
+		int cellY;
+	};
+
+	Box bounds;
+	int levels = 8;
+	olc::vf2d cellsPerUnit; // At the finest level
+	std::vector<Node> nodes;
+	std::vector<Item> items;
+	int firstFree = -1;
+	int count = 0;
+
+public:
+	// Items outside the bounds go in the root, levels counts the root
+	PooledQuadTree(olc::vf2d min, olc::vf2d max, int levelCount = 8)
+	{
+		bounds = { min, max };
+		levels = std::clamp(levelCount, 1, maxLevels);
+		cellsPerUnit = olc::vf2d((float)(1 << (levels - 1)), (float)(1 << (levels - 1))) / (max - min);
+		Clear();
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		items.clear();
+		firstFree = -1;
+		count = 0;
+		CreateNode({ 0, 0, 0 });
+	}
+
+	// Replaces everything with boxes[i] holding values[i]. Items are laid out node by node, handles[i] is where item i went
+	void Build(const std::vector<Box>& boxes, const std::vector<T>& values, std::vector<int>* handles = nullptr)
+	{
+		Clear();
+		const int n = (int)boxes.size();
+
+		// Sorted by the cell the item's node starts at on the finest level, then by level, which visits nodes
+		// depth first, parents before children. The key goes in the high half and the item in the low half, so
+		// sorting the pair by its high half keeps every item with its key
+		std::vector<uint64_t> entries(n);
+		for (int i = 0; i < n; i++) {
+			Key key = KeyOf(boxes[i]);
+			int shift = levels - 1 - key.level;
+			uint64_t sortKey = (Interleave((uint32_t)key.cellX << shift, (uint32_t)key.cellY << shift) << 4) | (uint64_t)key.level;
+			entries[i] = (sortKey << 32) | (uint32_t)i;
+		}
+		SortByKey(entries);
+
+		items.resize(n);
+		if (handles) handles->resize(n);
+		int node = -1;
+		for (int slot = 0; slot < n; slot++) {
+			uint64_t sortKey = entries[slot] >> 32;
+			int index = (int)(uint32_t)entries[slot];
+			bool first = slot == 0 || sortKey != entries[slot - 1] >> 32;
+			if (first) {
+				node = FindNode(KeyOf(boxes[index]));
+				nodes[node].firstItem = slot;
+			}
+
+			Item& item = items[slot];
+			item.box = boxes[index];
+			item.value = values[index];
+			item.node = node;
+			item.previous = first ? -1 : slot - 1;
+			item.next = slot + 1 < n && entries[slot + 1] >> 32 == sortKey ? slot + 1 : -1;
+			if (handles) (*handles)[index] = slot;
+		}
+		count = n;
+	}
+
+	// Returns the item's handle, which stays the same until it is removed
+	int Insert(const T& value, const Box& box)
+	{
+		int handle;
+		if (firstFree >= 0) {
+			handle = firstFree;
+			firstFree = items[handle].next;
+		}
+		else {
+			handle = (int)items.size();
+			items.emplace_back();
+		}
+
+		Item& item = items[handle];
+		item.box = box;
+		item.value = value;
+		Link(handle, FindNode(KeyOf(box)));
+		count++;
+		return handle;
+	}
+
+	void Remove(int handle)
+	{
+		Unlink(handle);
+		items[handle].node = -1;
+		items[handle].next = firstFree;
+		firstFree = handle;
+		count--;
+	}
+
+	// Only moves the item to another node if the box no longer fits the one it is in, or now fits one below it
+	void Relocate(int handle, const Box& box)
+	{
+		Item& item = items[handle];
+		item.box = box;
+
+		Key key = KeyOf(box);
+		const Node& node = nodes[item.node];
+		if (key.level == node.level && key.cellX == node.cellX && key.cellY == node.cellY) return;
+
+		Unlink(handle);
+		Link(handle, FindNode(key));
+	}
+
+	// Appends the handles of the items whose boxes overlap the area, edges included
+	void Search(const Box& area, std::vector<int>& out) const
+	{
+		int stack[maxLevels * 3 + 1];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0) {
+			int n = stack[--top];
+			const Node& node = nodes[n];
+
+			// Nothing in a node the area covers whole needs checking, the root holds whatever is out of bounds
+			if (n != 0 && Contains(area, node.area)) {
+				AppendAll(n, out);
+				continue;
+			}
+
+			for (int i = node.firstItem; i >= 0; i = items[i].next) {
+				if (Overlaps(area, items[i].box)) out.push_back(i);
+			}
+			for (int c = 3; c >= 0; c--) {
+				if (node.child[c] >= 0 && Overlaps(area, nodes[node.child[c]].area)) stack[top++] = node.child[c];
+			}
+		}
+	}
+
+	int Size() const { return count; }
+	const T& Value(int handle) const { return items[handle].value; }
+	T& Value(int handle) { return items[handle].value; }
+	const Box& BoxOf(int handle) const { return items[handle].box; }
+
+	size_t MemoryBytes() const { return nodes.capacity() * sizeof(Node) + items.capacity() * sizeof(Item); }
+
+	static bool Overlaps(const Box& a, const Box& b)
+	{
+		return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y;
+	}
+
+	static bool Contains(const Box& outer, const Box& inner)
+	{
+		return inner.min.x >= outer.min.x && inner.max.x <= outer.max.x && inner.min.y >= outer.min.y && inner.max.y <= outer.max.y;
+	}
+
+private:
+	// Deepest node whose cell holds both corners of the box
+	Key KeyOf(const Box& box) const
+	{
+		const float finest = (float)((1 << (levels - 1)) - 1);
+		olc::vf2d min = (box.min - bounds.min) * cellsPerUnit;
+		olc::vf2d max = (box.max - bounds.min) * cellsPerUnit;
+		// Anything sticking out of the bounds goes in the root. The negated test catches NaN as well
+		if (!(min.x >= 0.0f && min.y >= 0.0f && max.x <= finest + 1.0f && max.y <= finest + 1.0f)) return { 0, 0, 0 };
+
+		// A box right up against the far edge is still inside, so the cell is clamped rather than out of bounds
+		uint32_t x0 = (uint32_t)std::min(min.x, finest);
+		uint32_t y0 = (uint32_t)std::min(min.y, finest);
+		uint32_t x1 = (uint32_t)std::min(max.x, finest);
+		uint32_t y1 = (uint32_t)std::min(max.y, finest);
+
+		// Corners in different halves of a node split at the highest bit they differ in
+		uint32_t differ = (x0 ^ x1) | (y0 ^ y1);
+		int level = levels - 1 - BitWidth(differ);
+		int shift = levels - 1 - level;
+		return { level, (int)(x0 >> shift), (int)(y0 >> shift) };
+	}
+
+	// Creating the nodes on the way down that don't exist yet
+	int FindNode(const Key& key)
+	{
+		int n = 0;
+		for (int level = 1; level <= key.level; level++) {
+			int shift = key.level - level;
+			int cellX = key.cellX >> shift;
+			int cellY = key.cellY >> shift;
+			int c = (cellX & 1) + 2 * (cellY & 1);
+			if (nodes[n].child[c] < 0) {
+				int child = CreateNode({ level, cellX, cellY });
+				nodes[n].child[c] = child;
+			}
+			n = nodes[n].child[c];
+		}
+		return n;
+	}
+
+	int CreateNode(const Key& key)
+	{
+		Node& node = nodes.emplace_back();
+		node.level = key.level;
+		node.cellX = key.cellX;
+		node.cellY = key.cellY;
+
+		olc::vf2d size = (bounds.max - bounds.min) / (float)(1 << key.level);
+		olc::vf2d margin = size * 1e-4f;
+		node.area.min = bounds.min + size * olc::vf2d((float)key.cellX, (float)key.cellY) - margin;
+		node.area.max = node.area.min + size + margin * 2.0f;
+		return (int)nodes.size() - 1;
+	}
+
+	void Link(int handle, int node)
+	{
+		Item& item = items[handle];
+		item.node = node;
+		item.previous = -1;
+		item.next = nodes[node].firstItem;
+		if (item.next >= 0) items[item.next].previous = handle;
+		nodes[node].firstItem = handle;
+	}
+
+	void Unlink(int handle)
+	{
+		Item& item = items[handle];
+		if (item.previous >= 0) items[item.previous].next = item.next;
+		else nodes[item.node].firstItem = item.next;
+		if (item.next >= 0) items[item.next].previous = item.previous;
+	}
+
+	void AppendAll(int root, std::vector<int>& out) const
+	{
+		int stack[maxLevels * 3 + 1];
+		int top = 0;
+		stack[top++] = root;
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			for (int i = node.firstItem; i >= 0; i = items[i].next) out.push_back(i);
+			for (int c = 3; c >= 0; c--) {
+				if (node.child[c] >= 0) stack[top++] = node.child[c];
+			}
+		}
+	}
+
+	// Bits of x and y taken in turn, y's higher, so sorting by it goes through the cells quadrant by quadrant
+	static uint64_t Interleave(uint32_t x, uint32_t y)
+	{
+		auto Spread = [](uint64_t v) {
+			v &= 0xFFFF;
+			v = (v | (v << 8)) & 0x00FF00FFull;
+			v = (v | (v << 4)) & 0x0F0F0F0Full;
+			v = (v | (v << 2)) & 0x33333333ull;
+			v = (v | (v << 1)) & 0x55555555ull;
+			return v;
+		};
+		return Spread(x) | (Spread(y) << 1);
+	}
+
+	// Ascending by the high half, equal ones in the order they came. Radix sort, 11 bits at a time, skipping the
+	// digits all entries share
+	static void SortByKey(std::vector<uint64_t>& entries)
+	{
+		std::vector<uint64_t> scratch(entries.size());
+		uint64_t varying = 0;
+		for (uint64_t entry : entries) varying |= (entry ^ entries[0]) >> 32;
+
+		for (int shift = 32; shift < 64 && (varying >> (shift - 32)) != 0; shift += 11) {
+			if (((varying >> (shift - 32)) & 0x7FF) == 0) continue;
+			int bucketStart[2049] = {};
+			for (uint64_t entry : entries) bucketStart[((entry >> shift) & 0x7FF) + 1]++;
+			for (int b = 0; b < 2048; b++) bucketStart[b + 1] += bucketStart[b];
+			for (uint64_t entry : entries) scratch[bucketStart[(entry >> shift) & 0x7FF]++] = entry;
+			entries.swap(scratch);
+		}
+	}
+};
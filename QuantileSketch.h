@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Bits.h"
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+// Distribution of durations in ticks, for percentiles without keeping every sample. Buckets are log-linear:
+// every power of two is split into 8, so a percentile is within about 6% of the exact one, from a single tick up to
+// more than two days at 20 ticks a second. Longer samples land in the last bucket.
+// That is 160 counters, whatever the number of samples. Adding one is an atomic increment, so any number of
+// threads can add at once, and the result doesn't depend on their order. Sketches of the same kind of thing merge
+// by adding up counters, e.g. every origin into a destination
+class QuantileSketch {
+
+public:
+	static constexpr int subBucketBits = 3;
+	static constexpr int subBuckets = 1 << subBucketBits;
+	static constexpr int maxExponent = 21; // Up to 2^22 - 1 ticks
+	static constexpr int bucketCount = subBuckets * (maxExponent - subBucketBits + 2);
+
+private:
+	std::atomic<uint32_t> counts[bucketCount] = {};
+
+public:
+	void Add(uint64_t ticks)
+	{
+		counts[BucketOf(ticks)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void Merge(const QuantileSketch& other)
+	{
+		for (int b = 0; b < bucketCount; b++) {
+			uint32_t count = other.counts[b].load(std::memory_order_relaxed);
+			if (count > 0) counts[b].fetch_add(count, std::memory_order_relaxed);
+		}
+	}
+
+	void Clear()
+	{
+		for (std::atomic<uint32_t>& count : counts) count.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t Count() const
+	{
+		uint64_t total = 0;
+		for (const std::atomic<uint32_t>& count : counts) total += count.load(std::memory_order_relaxed);
+		return total;
+	}
+
+	// Ticks at or below which a fraction q of the samples are, 0 if there are none. Only exact while nobody is adding
+	double Quantile(double q) const
+	{
+		uint64_t total = Count();
+		if (total == 0) return 0.0;
+
+		uint64_t rank = (uint64_t)(q * (double)(total - 1));
+		uint64_t seen = 0;
+		for (int b = 0; b < bucketCount; b++) {
+			seen += counts[b].load(std::memory_order_relaxed);
+			if (seen > rank) return BucketMiddle(b);
+		}
+		return BucketMiddle(bucketCount - 1);
+	}
+
+	static int BucketOf(uint64_t ticks)
+	{
+		if (ticks < subBuckets) return (int)ticks;
+		if (ticks >> (maxExponent + 1)) return bucketCount - 1;
+
+		int exponent = 63 - CountLeadingZeros(ticks);
+		int sub = (int)(ticks >> (exponent - subBucketBits)) & (subBuckets - 1);
+		return subBuckets * (exponent - subBucketBits + 1) + sub;
+	}
+
+	static double BucketMiddle(int bucket)
+	{
+		if (bucket < subBuckets) return bucket;
+
+		int exponent = bucket / subBuckets + subBucketBits - 1;
+		uint64_t width = 1ull << (exponent - subBucketBits);
+		uint64_t lowest = (uint64_t)(subBuckets + bucket % subBuckets) * width;
+		return lowest + (width - 1) * 0.5;
+	}
+};
+
+// A sketch per cell of a grid, e.g. per origin and destination, only allocated once something is added to it.
+// Adding is safe from any number of threads: the first to need a sketch creates it, and the others use that one
+class QuantileSketchGrid {
+
+private:
+	int width = 0;
+	int height = 0;
+	std::unique_ptr<std::atomic<QuantileSketch*>[]> sketches;
+
+public:
+	QuantileSketchGrid() = default;
+	QuantileSketchGrid(const QuantileSketchGrid&) = delete;
+	QuantileSketchGrid& operator=(const QuantileSketchGrid&) = delete;
+	~QuantileSketchGrid() { Clear(); }
+
+	// Drops every sketch
+	void Resize(int newWidth, int newHeight)
+	{
+		Clear();
+		width = newWidth;
+		height = newHeight;
+		sketches = std::make_unique<std::atomic<QuantileSketch*>[]>((size_t)width * height);
+		for (size_t i = 0; i < (size_t)width * height; i++) sketches[i].store(nullptr, std::memory_order_relaxed);
+	}
+
+	void Add(int x, int y, uint64_t ticks)
+	{
+		std::atomic<QuantileSketch*>& slot = sketches[(size_t)y * width + x];
+		QuantileSketch* sketch = slot.load(std::memory_order_acquire);
+		if (!sketch) {
+			QuantileSketch* created = new QuantileSketch();
+			if (slot.compare_exchange_strong(sketch, created, std::memory_order_acq_rel)) sketch = created;
+			else delete created; // Someone else got there first, sketch is theirs now
+		}
+		sketch->Add(ticks);
+	}
+
+	// Null if nothing was ever added there
+	const QuantileSketch* Get(int x, int y) const { return sketches[(size_t)y * width + x].load(std::memory_order_acquire); }
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+
+	size_t MemoryBytes() const
+	{
+		size_t bytes = (size_t)width * height * sizeof(QuantileSketch*);
+		for (size_t i = 0; i < (size_t)width * height; i++) {
+			if (sketches[i].load(std::memory_order_relaxed)) bytes += sizeof(QuantileSketch);
+		}
+		return bytes;
+	}
+
+private:
+	void Clear()
+	{
+		for (size_t i = 0; i < (size_t)width * height; i++) delete sketches[i].exchange(nullptr);
+	}
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "Simulation.h"
+#include "World.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+
+// Everything needed to run a simulation again exactly as it went: how the world and the simulation were set up,
+// every command with the tick it was applied before, and state hashes along the way to check the rerun against.
+// The simulation only draws random numbers straight from mt19937, never through the std distributions, and the
+// default gravity demand uses PortableExp rather than std::exp, so the trips are the same with any standard library.
+// Saved as text, one item per line:
+//   world 200 200 69              (size, generator seed)
+//   seed 69
+//   parameter tickLength 0.05
+//   demand trips.txt              (only if one was loaded)
+//   hashInterval 100
+//   command 1234 road 5678 1
+//   command 1300 focus 10 10 60 40
+//   hash 100 <roads> <routing> <signals> <trips> <vehicles>
+//   ticks 72000
+struct ReplayLog {
+	olc::vi2d worldSize = { 200, 200 };
+	uint32_t worldSeed = 69;
+	uint32_t seed = 69;
+	std::vector<std::pair<std::string, double>> parameters;
+	std::string demandFile;
+	uint64_t hashInterval = 100;
+	std::vector<std::pair<uint64_t, SimulationCommand>> commands;
+	std::vector<std::pair<uint64_t, SimulationStateHash>> hashes;
+	uint64_t ticks = 0;
+
+	// Call once the simulation is set up and before its first tick
+	void Begin(Simulation& simulation, olc::vi2d world, uint32_t generatorSeed, const std::string& demand, uint64_t interval = 100)
+	{
+		worldSize = world;
+		worldSeed = generatorSeed;
+		seed = simulation.Seed();
+		demandFile = demand;
+		hashInterval = interval;
+		parameters.clear();
+		simulation.ForEachParameter([this](const char* name, auto& value, double, double) { parameters.push_back({ name, (double)value }); });
+		simulation.StartReplayLog(interval);
+	}
+
+	// Takes over what the simulation logged since Begin. Only call between ticks
+	void Finish(const Simulation& simulation)
+	{
+		commands = simulation.CommandLog();
+		hashes = simulation.HashLog();
+		ticks = simulation.TickCount();
+	}
+
+	// Sets up a simulation the way the logged one was, ready for its first tick
+	bool Setup(Simulation& simulation, JobSystem& jobs) const
+	{
+		for (const auto& [name, value] : parameters) {
+			std::string error = simulation.ParameterError(name, value);
+			if (!error.empty()) {
+				printf("Error: replay can't be set up, %s\n", error.c_str());
+				return false;
+			}
+			simulation.SetParameter(name, value);
+		}
+
+		WorldGenerator generator;
+		generator.seed = worldSeed;
+		ChunkGrid chunks(worldSize);
+		std::vector<Tile> tiles((size_t)worldSize.x * worldSize.y);
+		generator.Generate(tiles.data(), chunks, jobs);
+		simulation.LoadRoads(RoadMask(tiles.data(), (int)tiles.size()), worldSize);
+		return demandFile.empty() || simulation.LoadDemand(demandFile);
+	}
+
+	bool Save(const std::string& filename) const
+	{
+		FILE* file = fopen(filename.c_str(), "w");
+		if (!file) {
+			printf("Error: can't write %s\n", filename.c_str());
+			return false;
+		}
+
+		fprintf(file, "world %d %d %u\nseed %u\n", worldSize.x, worldSize.y, worldSeed, seed);
+		for (const auto& [name, value] : parameters) fprintf(file, "parameter %s %.17g\n", name.c_str(), value);
+		if (!demandFile.empty()) fprintf(file, "demand %s\n", demandFile.c_str());
+		fprintf(file, "hashInterval %llu\n", (unsigned long long)hashInterval);
+
+		for (const auto& [tick, command] : commands) {
+			switch (command.type) {
+			case SimulationCommand::Type::SetRoad:
+				fprintf(file, "command %llu road %d %d\n", (unsigned long long)tick, command.cell, command.value);
+				break;
+			case SimulationCommand::Type::SetFocus:
+				fprintf(file, "command %llu focus %d %d %d %d\n", (unsigned long long)tick, command.focusMin.x, command.focusMin.y, command.focusMax.x, command.focusMax.y);
+				break;
+			}
+		}
+
+		for (const auto& [tick, hash] : hashes) {
+			fprintf(file, "hash %llu", (unsigned long long)tick);
+			for (uint64_t part : hash.parts) fprintf(file, " %016llx", (unsigned long long)part);
+			fprintf(file, "\n");
+		}
+		fprintf(file, "ticks %llu\n", (unsigned long long)ticks);
+		fclose(file);
+		return true;
+	}
+
+	bool Load(const std::string& filename)
+	{
+		std::ifstream file(filename);
+		if (!file) {
+			printf("Error reading replay: can't open %s\n", filename.c_str());
+			return false;
+		}
+
+		parameters.clear();
+		commands.clear();
+		hashes.clear();
+		demandFile.clear();
+
+		std::string line;
+		for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+			std::istringstream fields(line);
+			std::string key;
+			if (!(fields >> key)) continue;
+
+			bool valid = true;
+			if (key == "world") valid = (bool)(fields >> worldSize.x >> worldSize.y >> worldSeed);
+			else if (key == "seed") valid = (bool)(fields >> seed);
+			else if (key == "demand") valid = (bool)(fields >> demandFile);
+			else if (key == "hashInterval") valid = (bool)(fields >> hashInterval);
+			else if (key == "ticks") valid = (bool)(fields >> ticks);
+			else if (key == "parameter") {
+				std::pair<std::string, double> parameter;
+				valid = (bool)(fields >> parameter.first >> parameter.second);
+				parameters.push_back(parameter);
+			}
+			else if (key == "command") {
+				uint64_t tick;
+				std::string type;
+				SimulationCommand command = {};
+				valid = (bool)(fields >> tick >> type);
+				if (type == "road") {
+					command.type = SimulationCommand::Type::SetRoad;
+					valid = valid && (bool)(fields >> command.cell >> command.value);
+				}
+				else if (type == "focus") {
+					command.type = SimulationCommand::Type::SetFocus;
+					valid = valid && (bool)(fields >> command.focusMin.x >> command.focusMin.y >> command.focusMax.x >> command.focusMax.y);
+				}
+				else valid = false;
+				commands.push_back({ tick, command });
+			}
+			else if (key == "hash") {
+				std::pair<uint64_t, SimulationStateHash> hash;
+				valid = (bool)(fields >> hash.first);
+				for (uint64_t& part : hash.second.parts) valid = valid && (bool)(fields >> std::hex >> part);
+				hashes.push_back(hash);
+			}
+			else valid = false;
+
+			if (!valid) {
+				printf("Error reading replay: %s line %d isn't valid\n", filename.c_str(), lineNumber);
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Runs a replay again, on however many threads, and compares the state hashes with the logged ones as it goes.
+// A mismatch can only be narrowed down to the ticks since the last logged hash, so a replay recorded with a hash
+// every tick gives the exact tick. Returns the exit code for main: 0 if every hash matched
+inline int CheckReplay(const std::string& filename, int threads)
+{
+	ReplayLog log;
+	if (!log.Load(filename)) return 1;
+
+	JobSystem jobs(threads - 1);
+	Simulation simulation(jobs, log.seed);
+	if (!log.Setup(simulation, jobs)) return 1;
+
+	printf("Checking %zu hashes over %llu ticks on %d threads\n", log.hashes.size(), (unsigned long long)log.ticks, jobs.Concurrency());
+
+	size_t nextCommand = 0;
+	size_t nextHash = 0;
+	uint64_t lastMatch = 0;
+	while (simulation.TickCount() < log.ticks) {
+		while (nextCommand < log.commands.size() && log.commands[nextCommand].first <= simulation.TickCount()) {
+			simulation.Apply(log.commands[nextCommand++].second);
+		}
+		simulation.Tick();
+
+		if (nextHash == log.hashes.size() || log.hashes[nextHash].first != simulation.TickCount()) continue;
+
+		SimulationStateHash expected = log.hashes[nextHash++].second;
+		SimulationStateHash actual = simulation.ComputeStateHash();
+		if (actual == expected) {
+			lastMatch = simulation.TickCount();
+			continue;
+		}
+
+		if (log.hashInterval == 1) printf("Diverged at tick %llu, in:", (unsigned long long)simulation.TickCount());
+		else {
+			printf("Diverged between ticks %llu and %llu, the replay only has a hash every %llu ticks (record it with --hash-interval 1 for the exact tick), in:",
+				(unsigned long long)lastMatch + 1, (unsigned long long)simulation.TickCount(), (unsigned long long)log.hashInterval);
+		}
+		for (int part = 0; part < SimulationStateHash::PartCount; part++) {
+			if (actual.parts[part] != expected.parts[part]) printf(" %s", SimulationStateHash::partNames[part]);
+		}
+		printf("\n");
+		return 1;
+	}
+
+	printf("Replay matches: all %zu hashes agree\n", log.hashes.size());
+	return 0;
+}
+
+struct ReplayCheckOptions {
+	std::string replayFile;
+	int threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--check-replay") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--check-replay" && option != "--threads") {
+				printf("Error: unknown option %s\n", option.c_str());
+				printf("Usage: Traffic --check-replay replay.txt [--threads N]\n");
+				printf("Finds the first logged state hash that differs, which is exact to the tick for replays recorded with --hash-interval 1\n");
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--check-replay") replayFile = value;
+			else threads = atoi(value);
+		}
+
+		if (threads < 1) {
+			printf("Error: --threads has to be positive\n");
+			return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <vector>
+#include <cstdint>
+
+// Directed graph over the road tiles of the world, stored in CSR form.
+// Every road tile is a node, and every pair of 4-neighbouring road tiles
+// is joined by one edge in each direction.
+class RoadNetwork {
+
+public:
+	// Neighbour order used when building edges: +x, +y, -x, -y
+	static constexpr int directionX[4] = { 1, 0, -1, 0 };
+	static constexpr int directionY[4] = { 0, 1, 0, -1 };
+
+	olc::vi2d vWorldSize = { 0, 0 };
+
+	std::vector<int> cellToNode; // -1 if the cell has no road
+	std::vector<int> nodeCell;
+
+	std::vector<int> edgeStart; // nodeCount + 1 offsets into the edge arrays
+	std::vector<int> edgeSource;
+	std::vector<int> edgeTarget;
+	std::vector<uint8_t> edgeDirection; // Index into directionX/directionY
+	std::vector<float> edgeLength; // In tiles
+
+	// Bumped every time the graph is rebuilt, so anything derived from it can tell it is stale
+	uint32_t version = 0;
+
+public:
+	void Build(const std::vector<uint8_t>& roadMask, olc::vi2d worldSize)
+	{
+		vWorldSize = worldSize;
+		cellToNode.assign(roadMask.size(), -1);
+		nodeCell.clear();
+
+		for (int i = 0; i < (int)roadMask.size(); i++) {
+			if (roadMask[i]) {
+				cellToNode[i] = (int)nodeCell.size();
+				nodeCell.push_back(i);
+			}
+		}
+
+		edgeStart.assign(nodeCell.size() + 1, 0);
+		edgeSource.clear();
+		edgeTarget.clear();
+		edgeDirection.clear();
+		edgeLength.clear();
+
+		for (int node = 0; node < NodeCount(); node++) {
+			edgeStart[node] = (int)edgeTarget.size();
+			olc::vi2d cell = CellPos(node);
+
+			for (int dir = 0; dir < 4; dir++) {
+				int nx = cell.x + directionX[dir];
+				int ny = cell.y + directionY[dir];
+				if (nx < 0 || nx >= vWorldSize.x || ny < 0 || ny >= vWorldSize.y) continue;
+
+				int neighbour = cellToNode[ny * vWorldSize.x + nx];
+				if (neighbour < 0) continue;
+
+				edgeSource.push_back(node);
+				edgeTarget.push_back(neighbour);
+				edgeDirection.push_back((uint8_t)dir);
+				edgeLength.push_back(1.0f);
+			}
+		}
+		edgeStart[NodeCount()] = (int)edgeTarget.size();
+
+		version++;
+	}
+
+	int NodeCount() const { return (int)nodeCell.size(); }
+	int EdgeCount() const { return (int)edgeTarget.size(); }
+
+	int OutDegree(int node) const { return edgeStart[node + 1] - edgeStart[node]; }
+
+	olc::vi2d CellPos(int node) const {
+		int cell = nodeCell[node];
+		return { cell % vWorldSize.x, cell / vWorldSize.x };
+	}
+
+	int NodeAt(olc::vi2d cell) const {
+		if (cell.x < 0 || cell.x >= vWorldSize.x || cell.y < 0 || cell.y >= vWorldSize.y) return -1;
+		return cellToNode[cell.y * vWorldSize.x + cell.x];
+	}
+
+	// Returns -1 if there is no edge between the two nodes
+	int FindEdge(int from, int to) const {
+		for (int e = edgeStart[from]; e < edgeStart[from + 1]; e++) {
+			if (edgeTarget[e] == to) return e;
+		}
+		return -1;
+	}
+};
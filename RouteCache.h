@@ -0,0 +1,186 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+
+using RouteEdges = std::shared_ptr<const std::vector<int>>;
+
+// Routes from an origin node to a destination node, shared between every vehicle making the same trip.
+// Routes are immutable, reference counted edge arrays, so handing one out is just copying a pointer.
+// Since every part of a shortest path is a shortest path too, a cached route also answers trips that start
+// further along it: those entries point into the same array at an offset.
+//
+// Lookups during a tick are lock-free reads of a table that doesn't change until the tick is over.
+// Misses are staged and only published between ticks, in a fixed order, so whether a lookup hits never
+// depends on thread timing and the simulation stays deterministic.
+class RouteCache {
+
+public:
+	struct Lookup {
+		RouteEdges edges; // Null if there is no way there
+		int offset; // Index of the first edge of this trip in edges
+	};
+
+	struct Metrics {
+		uint64_t hits;
+		uint64_t misses;
+		size_t entries;
+		size_t routes; // Distinct edge arrays
+		size_t memoryBytes;
+	};
+
+	size_t capacity = 200000; // Entries kept, least recently used ones are evicted past this
+
+private:
+	struct Key {
+		int origin;
+		int destination;
+
+		bool operator==(const Key& other) const { return origin == other.origin && destination == other.destination; }
+		bool operator<(const Key& other) const { return origin < other.origin || (origin == other.origin && destination < other.destination); }
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const { return (size_t)key.origin * 0x9E3779B97F4A7C15ull ^ (size_t)key.destination; }
+	};
+
+	struct Entry {
+		RouteEdges edges;
+		int offset;
+		mutable std::atomic<uint64_t> lastUsed; // Tick, only ever moves forward
+	};
+
+	struct Staged {
+		Key key;
+		uint32_t version;
+		RouteEdges edges;
+	};
+
+	static constexpr int stagingShards = 16;
+
+	struct alignas(64) StagingShard {
+		std::mutex mutex;
+		std::vector<Staged> routes;
+	};
+
+	std::unordered_map<Key, Entry, KeyHash> table;
+	// Entries pointing into every distinct edge array, and what the arrays take up, kept as entries come and go
+	// so the metrics can be read every tick
+	std::unordered_map<const std::vector<int>*, size_t> arrayEntries;
+	size_t arrayBytes = 0;
+	mutable StagingShard staging[stagingShards];
+	uint32_t version = 0; // Routing version the table was filled for
+	uint64_t currentTick = 0;
+
+	mutable std::atomic<uint64_t> hits = 0;
+	mutable std::atomic<uint64_t> misses = 0;
+
+public:
+	// Safe to call from any number of threads during a tick. Routes computed for the same version are always identical,
+	// so a miss for a version the table isn't for is just a miss
+	bool Find(int origin, int destination, uint32_t routingVersion, Lookup& result) const
+	{
+		if (routingVersion == version) {
+			auto it = table.find({ origin, destination });
+			if (it != table.end()) {
+				it->second.lastUsed.store(currentTick, std::memory_order_relaxed);
+				result = { it->second.edges, it->second.offset };
+				hits.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// Safe to call from any number of threads during a tick, the route shows up after the next Publish
+	void Stage(int origin, int destination, uint32_t routingVersion, RouteEdges edges) const
+	{
+		StagingShard& shard = staging[KeyHash()({ origin, destination }) % stagingShards];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.routes.push_back({ { origin, destination }, routingVersion, std::move(edges) });
+	}
+
+	// Call between ticks. Routes staged for an older routing version are dropped, and so is the whole table
+	// as soon as the version changes, which is what invalidates the cache after road edits
+	void Publish(uint64_t tick, uint32_t routingVersion, const std::vector<int>& edgeSource)
+	{
+		currentTick = tick;
+		if (routingVersion != version) {
+			table.clear();
+			arrayEntries.clear();
+			arrayBytes = 0;
+			version = routingVersion;
+		}
+
+		std::vector<Staged> routes;
+		for (StagingShard& shard : staging) {
+			routes.insert(routes.end(), std::make_move_iterator(shard.routes.begin()), std::make_move_iterator(shard.routes.end()));
+			shard.routes.clear();
+		}
+		if (routes.empty()) return;
+
+		// Staging order depends on which thread got there first, so sort it out before anything goes in
+		std::sort(routes.begin(), routes.end(), [](const Staged& a, const Staged& b) { return a.key < b.key; });
+
+		for (const Staged& staged : routes) {
+			// Anything staged for an old version may hold edge numbers that no longer mean anything
+			if (staged.version != version) continue;
+
+			Insert(staged.key, staged.edges, 0);
+			if (!staged.edges) continue;
+
+			for (int i = 1; i < (int)staged.edges->size(); i++) {
+				Insert({ edgeSource[(*staged.edges)[i]], staged.key.destination }, staged.edges, i);
+			}
+		}
+
+		if (table.size() > capacity) Evict(table.size() - capacity);
+	}
+
+	Metrics GetMetrics() const
+	{
+		// Roughly what a node of the table costs, plus its bucket
+		size_t entryBytes = sizeof(Key) + sizeof(Entry) + 2 * sizeof(void*);
+		return { hits, misses, table.size(), arrayEntries.size(), table.size() * entryBytes + arrayBytes };
+	}
+
+private:
+	void Insert(const Key& key, const RouteEdges& edges, int offset)
+	{
+		auto [it, inserted] = table.try_emplace(key);
+		if (!inserted) return;
+		it->second.edges = edges;
+		it->second.offset = offset;
+		it->second.lastUsed.store(currentTick, std::memory_order_relaxed);
+		if (edges && arrayEntries[edges.get()]++ == 0) arrayBytes += sizeof(std::vector<int>) + edges->capacity() * sizeof(int);
+	}
+
+	void Erase(const Key& key)
+	{
+		auto it = table.find(key);
+		const std::vector<int>* edges = it->second.edges.get();
+		if (edges && --arrayEntries[edges] == 0) {
+			arrayEntries.erase(edges);
+			arrayBytes -= sizeof(std::vector<int>) + edges->capacity() * sizeof(int);
+		}
+		table.erase(it);
+	}
+
+	void Evict(size_t count)
+	{
+		std::vector<std::pair<uint64_t, Key>> ages;
+		ages.reserve(table.size());
+		for (const auto& [key, entry] : table) ages.push_back({ entry.lastUsed.load(std::memory_order_relaxed), key });
+
+		// Oldest first, ties broken by key so the same entries go every time
+		std::nth_element(ages.begin(), ages.begin() + count, ages.end(), [](const auto& a, const auto& b) {
+			return a.first < b.first || (a.first == b.first && a.second < b.second);
+		});
+		for (size_t i = 0; i < count; i++) Erase(ages[i].second);
+	}
+};
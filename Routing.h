@@ -0,0 +1,716 @@
+#pragma once
+
+#include "RoadNetwork.h"
+#include "JobSystem.h"
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+
+// Self-contained copy of the road graph with a travel time on every edge, so routing data can be built
+// in the background while the simulation carries on editing its own RoadNetwork
+struct RoutingGraph {
+	uint32_t version = 0; // RoadNetwork::version this was copied from
+	std::vector<int> edgeStart;
+	std::vector<int> edgeTarget;
+	std::vector<float> edgeWeight; // Seconds
+
+	RoutingGraph() = default;
+	RoutingGraph(const RoadNetwork& roads, const std::vector<float>& weights)
+		: version(roads.version), edgeStart(roads.edgeStart), edgeTarget(roads.edgeTarget), edgeWeight(weights)
+	{
+	}
+
+	int NodeCount() const { return edgeStart.empty() ? 0 : (int)edgeStart.size() - 1; }
+};
+
+// Scratch space for one-to-one searches. Entries are only valid if they were touched in the current search,
+// which saves clearing arrays the size of the graph for every query
+struct SearchScratch {
+	std::vector<float> dist;
+	std::vector<int> parent;
+	std::vector<uint32_t> stamp;
+	uint32_t currentStamp = 0;
+
+	void Prepare(int nodeCount)
+	{
+		if ((int)stamp.size() < nodeCount) {
+			dist.resize(nodeCount);
+			parent.resize(nodeCount);
+			stamp.resize(nodeCount, 0);
+		}
+		if (++currentStamp == 0) {
+			std::fill(stamp.begin(), stamp.end(), 0);
+			currentStamp = 1;
+		}
+	}
+
+	bool Seen(int node) const { return stamp[node] == currentStamp; }
+	float Dist(int node) const { return Seen(node) ? dist[node] : INFINITY; }
+
+	void Set(int node, float d, int p)
+	{
+		stamp[node] = currentStamp;
+		dist[node] = d;
+		parent[node] = p;
+	}
+};
+
+using SearchQueue = std::priority_queue<std::pair<float, int>, std::vector<std::pair<float, int>>, std::greater<std::pair<float, int>>>;
+
+// Travel times from every source to every target, row-major, infinity where there is no way
+struct TravelTimeMatrix {
+	int rows = 0;
+	int cols = 0;
+	std::vector<float> times;
+
+	void Resize(int rowCount, int colCount)
+	{
+		rows = rowCount;
+		cols = colCount;
+		times.assign((size_t)rows * cols, INFINITY);
+	}
+
+	float& At(int row, int col) { return times[(size_t)row * cols + col]; }
+	float At(int row, int col) const { return times[(size_t)row * cols + col]; }
+};
+
+// Contraction hierarchy over a RoutingGraph.
+// Nodes are contracted one after another, adding shortcut arcs wherever removing a node would make a shortest path
+// longer, and a node's rank is its position in that order. A shortest path then always climbs up the ranks and comes
+// back down, so a query only has to search upwards from both ends.
+class ContractionHierarchy {
+
+public:
+	struct Arc {
+		int source;
+		int target;
+		float weight;
+		int originalEdge; // -1 for shortcuts
+		int firstHalf; // For shortcuts: the arcs it stands for, source -> middle and middle -> target
+		int secondHalf;
+	};
+
+	uint32_t graphVersion = 0;
+	std::vector<int> rank;
+	std::vector<Arc> arcs;
+
+	// Arcs leaving a node towards higher ranks, for the forward search
+	std::vector<int> upStart;
+	std::vector<int> upArcs;
+	// Arcs arriving at a node from higher ranks, for the backward search
+	std::vector<int> downStart;
+	std::vector<int> downArcs;
+
+	// Witness searches give up after settling this many nodes and add the shortcut anyway, which is always safe
+	static constexpr int witnessSettleLimit = 200;
+
+private:
+	struct Link {
+		int node;
+		int arc;
+	};
+
+	// The graph while it is being contracted, only links between nodes that are still left
+	struct ContractionState {
+		std::vector<std::vector<Link>> out;
+		std::vector<std::vector<Link>> in;
+		std::vector<uint8_t> removed; // Contracted, or being contracted this round
+		std::vector<int> priority;
+		std::vector<int> contractedNeighbours;
+		std::vector<int> level; // One more than the highest level of any contracted neighbour
+	};
+
+	struct Shortcut {
+		int source;
+		int target;
+		float weight;
+		int firstHalf;
+		int secondHalf;
+	};
+
+	static inline thread_local SearchScratch forwardScratch;
+	static inline thread_local SearchScratch backwardScratch;
+
+public:
+	// Contracts the graph in rounds. Every round picks nodes that rank lowest among their neighbours, which makes
+	// them independent of each other, and contracts them all in parallel.
+	// Returns null if cancelled is set part way through
+	static std::shared_ptr<ContractionHierarchy> Build(const RoutingGraph& graph, JobSystem& jobs, const std::atomic<bool>* cancelled = nullptr)
+	{
+		auto ch = std::make_shared<ContractionHierarchy>();
+		ch->graphVersion = graph.version;
+
+		const int n = graph.NodeCount();
+		ch->rank.assign(n, -1);
+		ContractionState state;
+		state.out.resize(n);
+		state.in.resize(n);
+		state.removed.assign(n, 0);
+		state.priority.assign(n, 0);
+		state.contractedNeighbours.assign(n, 0);
+		state.level.assign(n, 0);
+
+		for (int u = 0; u < n; u++) {
+			for (int e = graph.edgeStart[u]; e < graph.edgeStart[u + 1]; e++) {
+				ch->AddArc(state, { u, graph.edgeTarget[e], graph.edgeWeight[e], -1, -1 }, e);
+			}
+		}
+
+		std::vector<int> remaining(n);
+		for (int u = 0; u < n; u++) remaining[u] = u;
+
+		jobs.ParallelFor(0, n, 256, [&](int begin, int end) {
+			for (int u = begin; u < end; u++) state.priority[u] = ch->Priority(state, u);
+		});
+
+		std::vector<std::vector<int>> upLists(n);
+		std::vector<std::vector<int>> downLists(n);
+		int nextRank = 0;
+
+		std::vector<uint8_t> selectedFlag;
+		std::vector<int> selected;
+		std::vector<std::vector<Shortcut>> shortcuts;
+		std::vector<uint8_t> dirty(n, 0);
+
+		while (!remaining.empty()) {
+			if (cancelled && *cancelled) return nullptr;
+
+			// Pick every node that ranks below all of its neighbours
+			selectedFlag.assign(remaining.size(), 0);
+			jobs.ParallelFor(0, (int)remaining.size(), 1024, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) selectedFlag[i] = ch->IsLocalMinimum(state, remaining[i]);
+			});
+
+			selected.clear();
+			for (size_t i = 0; i < remaining.size(); i++) {
+				if (selectedFlag[i]) selected.push_back(remaining[i]);
+			}
+			// Witness searches must not go through nodes that are about to disappear
+			for (int u : selected) state.removed[u] = 1;
+
+			shortcuts.assign(selected.size(), {});
+			jobs.ParallelFor(0, (int)selected.size(), 16, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) ch->FindShortcuts(state, selected[i], witnessSettleLimit, shortcuts[i]);
+			});
+
+			// Applying the changes is cheap, and doing it in a fixed order keeps the result deterministic
+			for (size_t i = 0; i < selected.size(); i++) {
+				int u = selected[i];
+				ch->rank[u] = nextRank++;
+
+				for (const Link& link : state.out[u]) {
+					upLists[u].push_back(link.arc);
+					EraseLink(state.in[link.node], u);
+					state.contractedNeighbours[link.node]++;
+					state.level[link.node] = std::max(state.level[link.node], state.level[u] + 1);
+					dirty[link.node] = 1;
+				}
+				for (const Link& link : state.in[u]) {
+					downLists[u].push_back(link.arc);
+					EraseLink(state.out[link.node], u);
+					state.contractedNeighbours[link.node]++;
+					state.level[link.node] = std::max(state.level[link.node], state.level[u] + 1);
+					dirty[link.node] = 1;
+				}
+				state.out[u].clear();
+				state.in[u].clear();
+
+				for (const Shortcut& s : shortcuts[i]) {
+					ch->AddArc(state, s, -1);
+				}
+			}
+
+			remaining.erase(std::remove_if(remaining.begin(), remaining.end(), [&](int u) { return state.removed[u]; }), remaining.end());
+
+			// Only the neighbours of contracted nodes can have changed priority
+			jobs.ParallelFor(0, (int)remaining.size(), 256, [&](int begin, int end) {
+				for (int i = begin; i < end; i++) {
+					int u = remaining[i];
+					if (!dirty[u]) continue;
+					state.priority[u] = ch->Priority(state, u);
+					dirty[u] = 0;
+				}
+			});
+		}
+
+		ch->upStart.assign(n + 1, 0);
+		ch->downStart.assign(n + 1, 0);
+		for (int u = 0; u < n; u++) {
+			ch->upStart[u] = (int)ch->upArcs.size();
+			ch->upArcs.insert(ch->upArcs.end(), upLists[u].begin(), upLists[u].end());
+			ch->downStart[u] = (int)ch->downArcs.size();
+			ch->downArcs.insert(ch->downArcs.end(), downLists[u].begin(), downLists[u].end());
+		}
+		ch->upStart[n] = (int)ch->upArcs.size();
+		ch->downStart[n] = (int)ch->downArcs.size();
+
+		return ch;
+	}
+
+	int NodeCount() const { return (int)rank.size(); }
+
+	// Bidirectional upward search. Returns the travel time, or infinity if there is no path.
+	// If path is given, it is filled with the edges of the original graph along the way.
+	// Safe to call from any number of threads at once
+	float Query(int source, int target, std::vector<int>* path = nullptr) const
+	{
+		if (path) path->clear();
+		if (source == target) return 0.0f;
+
+		SearchScratch& forward = forwardScratch;
+		SearchScratch& backward = backwardScratch;
+		forward.Prepare(NodeCount());
+		backward.Prepare(NodeCount());
+
+		SearchQueue forwardQueue;
+		SearchQueue backwardQueue;
+		forward.Set(source, 0.0f, -1);
+		backward.Set(target, 0.0f, -1);
+		forwardQueue.push({ 0.0f, source });
+		backwardQueue.push({ 0.0f, target });
+
+		float best = INFINITY;
+		int meeting = -1;
+
+		while (true) {
+			float forwardMin = forwardQueue.empty() ? INFINITY : forwardQueue.top().first;
+			float backwardMin = backwardQueue.empty() ? INFINITY : backwardQueue.top().first;
+			// Neither side can find anything shorter any more
+			if (std::min(forwardMin, backwardMin) >= best) break;
+
+			bool isForward = forwardMin <= backwardMin;
+			SearchQueue& queue = isForward ? forwardQueue : backwardQueue;
+			SearchScratch& self = isForward ? forward : backward;
+			SearchScratch& other = isForward ? backward : forward;
+
+			auto [d, u] = queue.top();
+			queue.pop();
+			if (d > self.dist[u]) continue;
+
+			if (other.Seen(u) && d + other.dist[u] < best) {
+				best = d + other.dist[u];
+				meeting = u;
+			}
+
+			const std::vector<int>& start = isForward ? upStart : downStart;
+			const std::vector<int>& list = isForward ? upArcs : downArcs;
+			const std::vector<int>& oppositeStart = isForward ? downStart : upStart;
+			const std::vector<int>& oppositeList = isForward ? downArcs : upArcs;
+
+			// Stall on demand: if a higher node already reached gets here quicker, u can't be on a shortest path
+			bool stalled = false;
+			for (int i = oppositeStart[u]; i < oppositeStart[u + 1] && !stalled; i++) {
+				const Arc& arc = arcs[oppositeList[i]];
+				int v = isForward ? arc.source : arc.target;
+				stalled = self.Dist(v) + arc.weight < d;
+			}
+			if (stalled) continue;
+
+			for (int i = start[u]; i < start[u + 1]; i++) {
+				const Arc& arc = arcs[list[i]];
+				int v = isForward ? arc.target : arc.source;
+				float dv = d + arc.weight;
+				if (dv < self.Dist(v)) {
+					self.Set(v, dv, list[i]);
+					queue.push({ dv, v });
+				}
+			}
+		}
+
+		if (meeting < 0) return INFINITY;
+
+		if (path) {
+			std::vector<int> upward;
+			for (int u = meeting; forward.parent[u] >= 0; u = arcs[forward.parent[u]].source) upward.push_back(forward.parent[u]);
+			for (auto it = upward.rbegin(); it != upward.rend(); ++it) Unpack(*it, *path);
+			for (int u = meeting; backward.parent[u] >= 0; u = arcs[backward.parent[u]].target) Unpack(backward.parent[u], *path);
+		}
+		return best;
+	}
+
+	// Everything an upward search from node settles, with its distance. Forward follows arcs, backward goes against them
+	void UpwardSearch(int node, bool isForward, std::vector<std::pair<int, float>>& space) const
+	{
+		space.clear();
+		SearchScratch& self = isForward ? forwardScratch : backwardScratch;
+		self.Prepare(NodeCount());
+
+		SearchQueue queue;
+		self.Set(node, 0.0f, -1);
+		queue.push({ 0.0f, node });
+
+		const std::vector<int>& start = isForward ? upStart : downStart;
+		const std::vector<int>& list = isForward ? upArcs : downArcs;
+		const std::vector<int>& oppositeStart = isForward ? downStart : upStart;
+		const std::vector<int>& oppositeList = isForward ? downArcs : upArcs;
+
+		while (!queue.empty()) {
+			auto [d, u] = queue.top();
+			queue.pop();
+			if (d > self.dist[u]) continue;
+
+			bool stalled = false;
+			for (int i = oppositeStart[u]; i < oppositeStart[u + 1] && !stalled; i++) {
+				const Arc& arc = arcs[oppositeList[i]];
+				stalled = self.Dist(isForward ? arc.source : arc.target) + arc.weight < d;
+			}
+			if (stalled) continue;
+
+			space.push_back({ u, d });
+
+			for (int i = start[u]; i < start[u + 1]; i++) {
+				const Arc& arc = arcs[list[i]];
+				int v = isForward ? arc.target : arc.source;
+				float dv = d + arc.weight;
+				if (dv < self.Dist(v)) {
+					self.Set(v, dv, list[i]);
+					queue.push({ dv, v });
+				}
+			}
+		}
+	}
+
+	// Bucket-based many-to-many: one backward search per target leaves (target, distance) in a bucket at every node it
+	// settles, then one forward search per source scans the buckets of the nodes it settles. Every shortest path meets
+	// at its highest node, so that is all it takes to fill the matrix. Both sets of searches run in parallel
+	void ManyToMany(const std::vector<int>& sources, const std::vector<int>& targets, JobSystem& jobs, TravelTimeMatrix& result) const
+	{
+		result.Resize((int)sources.size(), (int)targets.size());
+
+		std::vector<std::vector<std::pair<int, float>>> targetSpaces(targets.size());
+		jobs.ParallelFor(0, (int)targets.size(), 8, [&](int begin, int end) {
+			for (int t = begin; t < end; t++) UpwardSearch(targets[t], false, targetSpaces[t]);
+		});
+
+		// Buckets as CSR, filled in target order so every bucket is sorted by target
+		struct BucketEntry {
+			int target;
+			float dist;
+		};
+		std::vector<int> bucketStart(NodeCount() + 1, 0);
+		for (const auto& space : targetSpaces) {
+			for (const auto& [node, dist] : space) bucketStart[node + 1]++;
+		}
+		for (int u = 0; u < NodeCount(); u++) bucketStart[u + 1] += bucketStart[u];
+
+		std::vector<BucketEntry> buckets(bucketStart[NodeCount()]);
+		std::vector<int> fill(bucketStart.begin(), bucketStart.end() - 1);
+		for (int t = 0; t < (int)targets.size(); t++) {
+			for (const auto& [node, dist] : targetSpaces[t]) buckets[fill[node]++] = { t, dist };
+		}
+		targetSpaces = {};
+
+		jobs.ParallelFor(0, (int)sources.size(), 8, [&](int begin, int end) {
+			std::vector<std::pair<int, float>> space;
+			for (int s = begin; s < end; s++) {
+				UpwardSearch(sources[s], true, space);
+
+				float* row = &result.times[(size_t)s * result.cols];
+				for (const auto& [node, dist] : space) {
+					for (int i = bucketStart[node]; i < bucketStart[node + 1]; i++) {
+						row[buckets[i].target] = std::min(row[buckets[i].target], dist + buckets[i].dist);
+					}
+				}
+			}
+		});
+	}
+
+	// Appends the original edges an arc stands for
+	void Unpack(int arc, std::vector<int>& path) const
+	{
+		static thread_local std::vector<int> stack;
+		stack.clear();
+		stack.push_back(arc);
+		while (!stack.empty()) {
+			const Arc& a = arcs[stack.back()];
+			stack.pop_back();
+			if (a.originalEdge >= 0) {
+				path.push_back(a.originalEdge);
+			}
+			else {
+				stack.push_back(a.secondHalf);
+				stack.push_back(a.firstHalf);
+			}
+		}
+	}
+
+private:
+	static void EraseLink(std::vector<Link>& links, int node)
+	{
+		for (size_t i = 0; i < links.size(); i++) {
+			if (links[i].node == node) {
+				links[i] = links.back();
+				links.pop_back();
+				return;
+			}
+		}
+	}
+
+	// Adds an arc between two nodes that are still left, unless there already is one at least as short
+	void AddArc(ContractionState& state, const Shortcut& s, int originalEdge)
+	{
+		if (s.source == s.target) return;
+
+		for (Link& link : state.out[s.source]) {
+			if (link.node != s.target) continue;
+			if (arcs[link.arc].weight <= s.weight) return;
+
+			// Replace the longer one in both directions
+			int arc = (int)arcs.size();
+			arcs.push_back({ s.source, s.target, s.weight, originalEdge, s.firstHalf, s.secondHalf });
+			link.arc = arc;
+			for (Link& back : state.in[s.target]) {
+				if (back.node == s.source) back.arc = arc;
+			}
+			return;
+		}
+
+		int arc = (int)arcs.size();
+		arcs.push_back({ s.source, s.target, s.weight, originalEdge, s.firstHalf, s.secondHalf });
+		state.out[s.source].push_back({ s.target, arc });
+		state.in[s.target].push_back({ s.source, arc });
+	}
+
+	// Shortcuts needed to remove u: one for every pair of neighbours whose shortest path goes through it
+	void FindShortcuts(const ContractionState& state, int u, int settleLimit, std::vector<Shortcut>& result) const
+	{
+		SearchScratch& scratch = forwardScratch;
+
+		for (const Link& in : state.in[u]) {
+			float inWeight = arcs[in.arc].weight;
+
+			float maxVia = 0.0f;
+			for (const Link& out : state.out[u]) {
+				if (out.node != in.node) maxVia = std::max(maxVia, inWeight + arcs[out.arc].weight);
+			}
+			if (maxVia == 0.0f) continue;
+
+			// Local search from the in-neighbour that avoids u, looking for a path no longer than going through it
+			scratch.Prepare(NodeCount());
+			SearchQueue queue;
+			scratch.Set(in.node, 0.0f, -1);
+			queue.push({ 0.0f, in.node });
+
+			int settled = 0;
+			while (!queue.empty() && settled < settleLimit) {
+				auto [d, v] = queue.top();
+				queue.pop();
+				if (d > scratch.dist[v]) continue;
+				if (d > maxVia) break;
+				settled++;
+
+				for (const Link& link : state.out[v]) {
+					if (state.removed[link.node]) continue;
+					float dw = d + arcs[link.arc].weight;
+					if (dw < scratch.Dist(link.node)) {
+						scratch.Set(link.node, dw, -1);
+						queue.push({ dw, link.node });
+					}
+				}
+			}
+
+			for (const Link& out : state.out[u]) {
+				if (out.node == in.node) continue;
+				float via = inWeight + arcs[out.arc].weight;
+				if (scratch.Dist(out.node) > via) {
+					result.push_back({ in.node, out.node, via, in.arc, out.arc });
+				}
+			}
+		}
+	}
+
+	// Lower is contracted sooner: prefer nodes that add few shortcuts compared to the arcs they remove,
+	// and spread contraction evenly over the graph so the hierarchy stays shallow.
+	// The ratio works a lot better than the usual difference on grid-like road layouts
+	int Priority(const ContractionState& state, int u) const
+	{
+		std::vector<Shortcut> shortcuts;
+		FindShortcuts(state, u, witnessSettleLimit / 4, shortcuts);
+		int removedArcs = std::max(1, (int)(state.in[u].size() + state.out[u].size()));
+		return 100 * (int)shortcuts.size() / removedArcs + 50 * state.level[u] + 20 * state.contractedNeighbours[u];
+	}
+
+	bool IsLocalMinimum(const ContractionState& state, int u) const
+	{
+		auto Key = [&](int v) { return std::make_pair(state.priority[v], (uint32_t)v * 2654435761u); };
+
+		auto key = Key(u);
+		for (const Link& link : state.out[u]) {
+			if (Key(link.node) < key) return false;
+		}
+		for (const Link& link : state.in[u]) {
+			if (Key(link.node) < key) return false;
+		}
+		return true;
+	}
+};
+
+// Finds routes on the road network. Uses the contraction hierarchy when there is one for the current graph,
+// and falls back to A* while a new one is being built after an edit.
+// Route is safe to call from any number of threads at once, everything else belongs to the simulation thread
+class Router {
+
+private:
+	struct PendingBuild {
+		std::shared_ptr<ContractionHierarchy> result;
+		std::atomic<int> remaining = 1;
+		std::atomic<bool> cancelled = false;
+		uint64_t adoptTick = 0;
+	};
+
+	std::shared_ptr<const ContractionHierarchy> hierarchy;
+	std::shared_ptr<PendingBuild> pending;
+	float secondsPerTile = 0.0f; // Fastest travel anywhere on the graph, for the A* heuristic
+	uint32_t version = 0;
+
+	static inline thread_local SearchScratch aStarScratch;
+
+public:
+	~Router()
+	{
+		if (pending) pending->cancelled = true;
+	}
+
+	// Starts building a hierarchy for the graph in the background. It is only switched to on adoptTick,
+	// whether it finished early or the simulation has to wait for it, so results don't depend on timing
+	void RequestBuild(const RoadNetwork& roads, const std::vector<float>& weights, JobSystem& jobs, uint64_t adoptTick)
+	{
+		if (pending) pending->cancelled = true;
+		version++;
+
+		secondsPerTile = INFINITY;
+		for (int e = 0; e < roads.EdgeCount(); e++) secondsPerTile = std::min(secondsPerTile, weights[e] / roads.edgeLength[e]);
+
+		auto build = std::make_shared<PendingBuild>();
+		build->adoptTick = adoptTick;
+		pending = build;
+
+		auto graph = std::make_shared<RoutingGraph>(roads, weights);
+		jobs.SubmitBackground([build, graph, &jobs] {
+			build->result = ContractionHierarchy::Build(*graph, jobs, &build->cancelled);
+		}, &build->remaining);
+	}
+
+	// Call between ticks, while nothing is routing
+	void Update(uint64_t tick, JobSystem& jobs)
+	{
+		if (!pending || tick < pending->adoptTick) return;
+
+		jobs.Wait(pending->remaining);
+		if (pending->result) hierarchy = pending->result;
+		pending = nullptr;
+		version++;
+	}
+
+	// Changes whenever Route could start giving different answers, i.e. on a new graph or weights and when a hierarchy is adopted
+	uint32_t Version() const { return version; }
+
+	// After a change of weights alone, the hierarchy for the old weights keeps being used until the new one is adopted
+	const ContractionHierarchy* Hierarchy(const RoadNetwork& roads) const
+	{
+		return (hierarchy && hierarchy->graphVersion == roads.version) ? hierarchy.get() : nullptr;
+	}
+
+	// The same, to keep using from other threads. The hierarchy never changes once built
+	std::shared_ptr<const ContractionHierarchy> SharedHierarchy(const RoadNetwork& roads) const
+	{
+		return (hierarchy && hierarchy->graphVersion == roads.version) ? hierarchy : nullptr;
+	}
+
+	// Fills path with the edges from one node to another. Returns the travel time, infinity if there is no way there
+	float Route(const RoadNetwork& roads, const std::vector<float>& weights, int from, int to, std::vector<int>& path) const
+	{
+		if (const ContractionHierarchy* ch = Hierarchy(roads)) {
+			return ch->Query(from, to, &path);
+		}
+		return AStar(roads, weights, secondsPerTile, from, to, path);
+	}
+
+	// Zone to zone travel times. Without a current hierarchy, falls back to one plain search from every source
+	void ManyToMany(const RoadNetwork& roads, const std::vector<float>& weights, const std::vector<int>& sources, const std::vector<int>& targets, JobSystem& jobs, TravelTimeMatrix& result) const
+	{
+		if (const ContractionHierarchy* ch = Hierarchy(roads)) {
+			ch->ManyToMany(sources, targets, jobs, result);
+			return;
+		}
+
+		result.Resize((int)sources.size(), (int)targets.size());
+		jobs.ParallelFor(0, (int)sources.size(), 1, [&](int begin, int end) {
+			for (int s = begin; s < end; s++) {
+				SearchScratch& scratch = aStarScratch;
+				OneToAll(roads, weights, sources[s], scratch);
+				for (int t = 0; t < (int)targets.size(); t++) result.At(s, t) = scratch.Dist(targets[t]);
+			}
+		});
+	}
+
+	// Plain Dijkstra over the whole graph, distances are left in scratch
+	static void OneToAll(const RoadNetwork& roads, const std::vector<float>& weights, int from, SearchScratch& scratch)
+	{
+		scratch.Prepare(roads.NodeCount());
+		SearchQueue queue;
+		scratch.Set(from, 0.0f, -1);
+		queue.push({ 0.0f, from });
+
+		while (!queue.empty()) {
+			auto [d, u] = queue.top();
+			queue.pop();
+			if (d > scratch.dist[u]) continue;
+
+			for (int e = roads.edgeStart[u]; e < roads.edgeStart[u + 1]; e++) {
+				int v = roads.edgeTarget[e];
+				float dv = d + weights[e];
+				if (dv < scratch.Dist(v)) {
+					scratch.Set(v, dv, e);
+					queue.push({ dv, v });
+				}
+			}
+		}
+	}
+
+	static float AStar(const RoadNetwork& roads, const std::vector<float>& weights, float secondsPerTile, int from, int to, std::vector<int>& path)
+	{
+		path.clear();
+		if (from == to) return 0.0f;
+
+		// Manhattan distance at the fastest speed found anywhere never overestimates
+		olc::vi2d goal = roads.CellPos(to);
+		auto Heuristic = [&](int node) {
+			olc::vi2d cell = roads.CellPos(node);
+			return (std::abs(cell.x - goal.x) + std::abs(cell.y - goal.y)) * secondsPerTile;
+		};
+
+		SearchScratch& scratch = aStarScratch;
+		scratch.Prepare(roads.NodeCount());
+		SearchQueue queue;
+		scratch.Set(from, 0.0f, -1);
+		queue.push({ Heuristic(from), from });
+
+		while (!queue.empty()) {
+			auto [f, u] = queue.top();
+			queue.pop();
+			float d = scratch.dist[u];
+			if (f > d + Heuristic(u)) continue;
+
+			if (u == to) {
+				for (int v = to; scratch.parent[v] >= 0; v = roads.edgeSource[scratch.parent[v]]) path.push_back(scratch.parent[v]);
+				std::reverse(path.begin(), path.end());
+				return d;
+			}
+
+			for (int e = roads.edgeStart[u]; e < roads.edgeStart[u + 1]; e++) {
+				int v = roads.edgeTarget[e];
+				float dv = d + weights[e];
+				if (dv < scratch.Dist(v)) {
+					scratch.Set(v, dv, e);
+					queue.push({ dv + Heuristic(v), v });
+				}
+			}
+		}
+		return INFINITY;
+	}
+};
@@ -0,0 +1,1629 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "RoadNetwork.h"
+#include "JobSystem.h"
+#include "World.h"
+#include "Routing.h"
+#include "RouteCache.h"
+#include "TimingWheel.h"
+#include "Junctions.h"
+#include "Demand.h"
+#include "Zones.h"
+#include "LinkStats.h"
+#include "QuantileSketch.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <condition_variable>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <functional>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+
+struct Vehicle {
+	uint32_t id;
+	int edge;
+	int nextEdge; // Chosen on entering an edge, so the vehicle knows who it is following across the junction
+	float progress; // 0 at the source of the edge, 1 at the target
+	float speed; // Tiles per second
+	uint32_t rngState; // Every vehicle draws from its own stream, so results don't depend on update order
+
+	RouteEdges route; // Edges to the destination, null while wandering. Shared with other vehicles on the same trip
+	int routeIndex; // Position of edge in route, so nextEdge is at routeIndex + 1 (which can be 0)
+
+	uint64_t enteredTick; // When the vehicle got onto its edge, for travel time estimates
+	uint64_t departedTick = 0; // When the trip started
+
+	uint8_t junctionQuadrants = 0; // Reserved for crossing the junction ahead, or the one just crossed. 0 if none
+	bool crossedJunction = false;
+	uint64_t waitingSince = UINT64_MAX; // First tick the vehicle asked to cross the junction ahead, to serve the longest waiting first
+
+	int destinationCell = -1; // Where the trip ends, as a cell so it survives road edits
+	int originChunk = -1; // Where the trip started, for travel times per origin and destination
+	bool arrived = false; // Trip over, the vehicle is only kept until the next compaction
+	bool meso = false; // In a region simulated as queues, where progress isn't kept up to date
+};
+
+// Everything the rest of the program wants to change in the simulation goes through one of these,
+// so that the simulation thread is the only one that ever touches its state
+struct SimulationCommand {
+	enum class Type {
+		SetRoad, // cell, value = 1 to add a road, 0 to remove it
+		SetFocus, // focusMin, focusMax = cells that are simulated in full detail, everywhere else is simulated as queues
+	};
+
+	Type type;
+	int cell = 0;
+	int value = 0;
+	olc::vi2d focusMin = { 0, 0 };
+	olc::vi2d focusMax = { 0, 0 }; // Inclusive
+};
+
+// Something the simulation has to do at a given tick, rather than checking for every tick
+struct SimulationEvent {
+	enum class Type {
+		SignalPhase, // target = junction node whose lights change
+	};
+
+	Type type;
+	int target;
+};
+
+// Immutable view of the simulation after a tick, handed over to the renderer
+struct SimulationSnapshot {
+	struct VehicleState {
+		uint32_t id;
+		olc::vf2d pos; // World space, centre of the vehicle
+	};
+
+	uint64_t tick = 0;
+	double time = 0.0; // Simulated seconds
+	std::vector<VehicleState> vehicles; // Sorted by id
+
+	// What routes are planned with, for searches off the simulation thread. Null while there is no hierarchy for the current roads
+	std::shared_ptr<const ContractionHierarchy> hierarchy;
+	std::shared_ptr<const std::vector<int>> hierarchyCells; // Cell of every node of the hierarchy
+
+	// Travel time percentiles in seconds, for the overlay
+	struct TravelTimes {
+		uint64_t count = 0;
+		float p50 = 0.0f;
+		float p90 = 0.0f;
+		float p99 = 0.0f;
+	};
+	TravelTimes tripTimes; // Of every trip completed so far
+	int watchedCell = -1; // See Simulation::WatchCell
+	std::vector<std::pair<int, TravelTimes>> watchedLinks; // Target cell and times of every link out of the watched cell
+	RouteCache::Metrics routeCache = {};
+};
+
+// Fingerprint of the simulation state, with a hash per part so a mismatch says where things started to differ
+struct SimulationStateHash {
+	enum Part { Roads, Routing, Signals, Trips, Vehicles, PartCount };
+	static constexpr const char* partNames[PartCount] = { "roads", "routing", "signals", "trips", "vehicles" };
+
+	uint64_t parts[PartCount] = {};
+
+	bool operator==(const SimulationStateHash& other) const { return memcmp(parts, other.parts, sizeof(parts)) == 0; }
+};
+
+class Simulation {
+
+public:
+	struct TripStats {
+		uint64_t generated = 0;
+		uint64_t started = 0;
+		uint64_t completed = 0;
+		uint64_t abandoned = 0; // No way to the destination, at the start or after a road edit, or stuck in gridlock
+		uint64_t dropped = 0; // Origin or destination has no roads, or too many trips were waiting
+		double travelSeconds = 0.0; // Of the completed trips, from starting to arriving
+	};
+
+public:
+	float tickLength = 1.0f / 20.0f; // Simulated seconds per tick
+	int maxSpawnsPerTick = 50;
+	float freeFlowSpeed = 2.0f; // Tiles per second
+	float minimumGap = 0.35f; // Tiles between a vehicle and the one in front of it
+	// Ticks between a road edit and switching to the routing hierarchy built for it, A* is used in between
+	uint64_t hierarchyDelayTicks = 20;
+
+	// Congestion: edges keep a running estimate of how long they take to drive, and every so often the ones that
+	// changed enough become the new routing weights. Vehicles with routes over those edges are planned again, a few per tick
+	float travelTimeSmoothing = 0.2f; // Weight of every new measurement in an edge's estimate
+	float travelTimeRecovery = 0.3f; // How far an estimate moves back towards free flow over an interval the edge is empty for
+	uint64_t rerouteIntervalTicks = 100;
+	float rerouteThreshold = 0.25f; // Relative change in an edge's cost that makes routes over it worth replanning
+	int maxReroutesPerTick = 32;
+	// Rebuilding the routing hierarchy costs far more than a few replans, so new weights only go into it this often
+	uint64_t hierarchyRebuildTicks = 1200;
+
+	// Junctions where three or more roads meet have traffic lights, which let one axis through at a time
+	uint64_t signalGreenTicks = 200;
+	float stopLineDistance = 0.1f; // How far short of the end of its edge a vehicle waits to cross a junction
+	float junctionClearance = 0.5f; // How far onto the next edge a vehicle has to be before it is out of the junction
+
+	// Demand, unless one is loaded: a gravity model where every road tile makes this many trips per hour,
+	// falling off with the travel time to the destination by exp(-gravityBeta * seconds)
+	double tripsPerRoadTilePerHour = 5.0;
+	double gravityBeta = 0.02;
+	double clockStart = 7.0 * 3600.0; // Time of day the simulation starts at, in seconds since midnight
+	size_t maxPendingTrips = 10000; // Trips waiting for room on the road to start, any more are dropped
+	// Gridlock: a vehicle that has been on the same edge this long is taken off the road and its trip abandoned
+	float maxStuckSeconds = 300.0f;
+
+	// Level of detail: regions away from the focus are simulated as a queue per edge. Vehicles take the free flow
+	// time to get to the end of an edge, and leave it in order, no faster than the saturation flow and only when
+	// there is room on the next edge. Their exact position along the edge is never worked out
+	int focusMarginChunks = 1; // Regions this close to the focus stay in full detail, so vehicles are converted out of sight
+	float mesoSaturationFlow = 2.5f; // Vehicles per second that can leave an edge
+
+private:
+	// Regions are the world chunks. Every edge belongs to the region of its source tile, and every vehicle to the
+	// region of its edge. Regions update in parallel and only ever write to their own vehicles: what they need to
+	// know about their neighbours is read from the halo, per-edge data every region publishes before anyone moves.
+	// Vehicles crossing into another region are handed over through per-boundary queues once every region is done.
+	struct CrossingRequest {
+		int junction;
+		bool inJunction; // Already has its quadrants and only keeps them taken, these go first
+		uint64_t waitingSince;
+		uint32_t id;
+		int vehicle;
+		uint8_t quadrants;
+		int duration; // Ticks
+	};
+
+	// First in, first out, without shifting everything along on every pop
+	struct MesoQueue {
+		std::vector<int> vehicles; // Indices into Simulation::vehicles, front first
+		size_t head = 0;
+		float exitCredit = 0.0f; // Vehicles allowed to leave, builds up at the saturation flow
+		bool listed = false; // In Region::activeQueues, which it stays in until it is found empty at the start of a tick
+
+		bool Empty() const { return head == vehicles.size(); }
+		size_t Size() const { return vehicles.size() - head; }
+		int Front() const { return vehicles[head]; }
+		int Back() const { return vehicles.back(); }
+		void Push(int vehicle) { vehicles.push_back(vehicle); }
+
+		void Pop()
+		{
+			if (++head * 2 >= vehicles.size()) {
+				vehicles.erase(vehicles.begin(), vehicles.begin() + head);
+				head = 0;
+			}
+		}
+	};
+
+	struct Region {
+		bool meso = false;
+		std::vector<MesoQueue> queues; // Per edge in edges, only used while meso
+		std::vector<int> activeQueues; // Slots of the queues with vehicles in, the rest are never looked at
+		std::vector<CrossingRequest> crossingRequests;
+		std::vector<int> edges;
+		std::vector<int> vehicles; // Indices into Simulation::vehicles, ascending. Empty while meso, the queues have them
+		std::vector<int> outbox[9]; // Vehicles leaving for each neighbouring region, see NeighbourSlot
+		std::vector<int> sortScratch;
+		std::vector<LinkStats::Counters> linkCounters; // Per edge in edges, added into linkStats when a bin closes
+		// An empty edge has nothing holding back its first vehicle
+		void QueueVehicle(int slot, int vehicle)
+		{
+			MesoQueue& queue = queues[slot];
+			if (queue.Empty()) queue.exitCredit = 1.0f;
+			// A queue emptied earlier this tick is still listed
+			if (!queue.listed) {
+				activeQueues.push_back(slot);
+				queue.listed = true;
+			}
+			queue.Push(vehicle);
+		}
+
+		int arrivals = 0; // Vehicles that reached the end of their trip this tick
+		int abandoned = 0; // Vehicles that gave up on a destination they couldn't reach, or were stuck for too long
+		uint64_t arrivalTicks = 0; // Trip times of the arrivals added up
+	};
+
+	struct Trip {
+		int origin; // Chunks, as in DemandModel
+		int destination;
+	};
+
+	JobSystem& jobs;
+	JobGraph tickGraph;
+
+	RoadNetwork roads;
+	std::shared_ptr<const std::vector<int>> roadCells; // Shared with snapshots, a new one whenever the roads change
+	std::vector<uint8_t> roadMask;
+	bool roadsDirty = false;
+
+	std::vector<float> edgeWeights; // Travel time in seconds, what routes are planned with
+
+	struct EdgeEstimate {
+		std::atomic<float> travelTime; // Seconds, smoothed over the vehicles that drove the edge
+		std::atomic<uint32_t> samples; // Since the last time estimates were folded into the weights
+	};
+
+	std::unique_ptr<EdgeEstimate[]> edgeEstimates;
+	std::vector<uint8_t> edgeCostChanged; // Edges whose weight changed in the last fold
+	std::vector<uint32_t> rerouteQueue; // Ids of vehicles to replan, ascending
+	size_t rerouteCursor = 0;
+	float rerouteSecondsPerTile = 0.0f; // Lower bound for the A* heuristic with the current weights
+	bool hierarchyWeightsStale = false;
+	uint64_t hierarchyRequestTick = 0;
+
+	JunctionReservations junctions;
+	std::vector<CrossingRequest> crossingRequests;
+	std::vector<int> crossingGroups; // Where every junction's requests start in crossingRequests
+
+	TimingWheel<SimulationEvent> events;
+	std::vector<int8_t> nodeSignal; // Axis with a green light at every junction (0 = x, 1 = y), -1 if it has no lights
+	Router router;
+	RouteCache routeCache;
+	Zones zones;
+	LinkStats linkStats;
+	std::vector<int> edgeLink; // Link in linkStats of every edge
+
+	ChunkGrid regionGrid;
+	std::vector<Region> regions;
+	std::vector<int> edgeRegion;
+	std::vector<int> edgeSlot; // Index of the edge in its region's edges
+	olc::vi2d focusMin = { 0, 0 };
+	olc::vi2d focusMax = { INT_MAX / 2, INT_MAX / 2 }; // Leaves room for the margin, everything is in focus until told otherwise
+	bool focusDirty = false;
+	std::vector<float> edgeTail; // Halo: how far along the edge its rearmost vehicle is, infinity if there is none
+	std::vector<int> edgeExit; // Halo: the edge the front vehicle is about to move onto, -1 if it isn't about to leave
+	std::vector<float> gapAhead; // Per vehicle: free road in front of it on its own edge at the start of the tick
+
+	std::vector<Vehicle> vehicles; // Sorted by id, new vehicles are always appended
+	std::vector<Vehicle> spawnedVehicles;
+	uint32_t nextVehicleId = 0;
+	size_t arrivedCount = 0; // Arrived vehicles still in vehicles
+
+	DemandModel demand;
+	std::vector<Trip> pendingTrips; // Oldest first
+	std::vector<RouteCache::Lookup> tripRoutes;
+	TripStats tripStats = {};
+	QuantileSketch tripTimes; // Ticks, of every completed trip
+	QuantileSketchGrid odTripTimes; // By origin and destination chunk
+	std::atomic<int> watchedCell = -1;
+
+	uint32_t seed;
+	std::mt19937 rng;
+
+	// Replay log: every command applied, and a state hash every hashInterval ticks. Off while hashInterval is 0
+	uint64_t hashInterval = 0;
+	std::vector<std::pair<uint64_t, SimulationCommand>> commandLog;
+	std::vector<std::pair<uint64_t, SimulationStateHash>> hashLog;
+
+	uint64_t tick = 0;
+	double time = 0.0;
+
+public:
+	Simulation(JobSystem& jobs, uint32_t seed = 69) : jobs(jobs), seed(seed), rng(seed)
+	{
+		// Every phase reads what the phase before it wrote and nothing else,
+		// which is what makes the result independent of how regions are spread over threads.
+		// BeginTick runs before the graph, see Tick
+		int publish = tickGraph.Add([this] { ForEachRegion([this](int r) { PublishHalo(r); }); });
+		int request = tickGraph.Add([this] { ForEachRegion([this](int r) { RequestCrossings(r); }); }, { publish });
+		int grant = tickGraph.Add([this] { GrantCrossings(); }, { request });
+		// Rerouting only touches routes past the next edge, which nothing reads until vehicles move
+		int reroute = tickGraph.Add([this] { RerouteVehicles(); });
+		int move = tickGraph.Add([this] { ForEachRegion([this](int r) { MoveRegion(r); }); }, { grant, reroute });
+		// Spawning only appends to its own list, so it can run alongside moving the existing vehicles
+		int spawn = tickGraph.Add([this] { SpawnVehicles(); }, { publish });
+		int handover = tickGraph.Add([this] { ForEachRegion([this](int r) { ReceiveHandovers(r); }); }, { move });
+		int merge = tickGraph.Add([this] { MergeSpawnedVehicles(); }, { handover, spawn });
+		tickGraph.Add([this] { routeCache.Publish(tick, router.Version(), roads.edgeSource); }, { merge });
+	}
+
+	void LoadRoads(const std::vector<uint8_t>& mask, olc::vi2d worldSize)
+	{
+		roadMask = mask;
+		roads.vWorldSize = worldSize;
+		regionGrid = ChunkGrid(worldSize);
+		// A new road network starts a new history
+		for (Region& region : regions) region.linkCounters.assign(region.edges.size(), {});
+		linkStats.Start(tickLength, tick);
+		tripTimes.Clear();
+		odTripTimes.Resize(regionGrid.ChunkCount(), regionGrid.ChunkCount());
+		roadsDirty = true;
+		RebuildRoads();
+		if (demand.Empty()) BuildGravityDemand();
+	}
+
+	// Calls visit(name, parameter, lowest, highest) for every parameter above, with a reference to it and the range
+	// of values it makes sense for
+	template<typename F>
+	void ForEachParameter(F&& visit)
+	{
+		constexpr double any = INFINITY;
+		visit("tickLength", tickLength, 0.001, 1.0);
+		visit("maxSpawnsPerTick", maxSpawnsPerTick, 0.0, any);
+		visit("freeFlowSpeed", freeFlowSpeed, 0.01, any);
+		visit("minimumGap", minimumGap, 0.0, any);
+		visit("hierarchyDelayTicks", hierarchyDelayTicks, 0.0, any);
+		visit("travelTimeSmoothing", travelTimeSmoothing, 0.0, 1.0);
+		visit("travelTimeRecovery", travelTimeRecovery, 0.0, 1.0);
+		visit("rerouteIntervalTicks", rerouteIntervalTicks, 1.0, any);
+		visit("rerouteThreshold", rerouteThreshold, 0.0, any);
+		visit("maxReroutesPerTick", maxReroutesPerTick, 0.0, any);
+		visit("hierarchyRebuildTicks", hierarchyRebuildTicks, 0.0, any);
+		visit("signalGreenTicks", signalGreenTicks, 1.0, any);
+		visit("stopLineDistance", stopLineDistance, 0.0, any);
+		visit("junctionClearance", junctionClearance, 0.0, any);
+		visit("tripsPerRoadTilePerHour", tripsPerRoadTilePerHour, 0.0, any);
+		visit("gravityBeta", gravityBeta, 0.0, any);
+		visit("clockStart", clockStart, 0.0, any);
+		visit("maxPendingTrips", maxPendingTrips, 0.0, any);
+		visit("maxStuckSeconds", maxStuckSeconds, 1.0, any);
+		visit("focusMarginChunks", focusMarginChunks, 0.0, any);
+		visit("mesoSaturationFlow", mesoSaturationFlow, 0.01, any);
+		visit("routeCacheCapacity", routeCache.capacity, 0.0, any);
+	}
+
+	// Why the parameter can't be set to the value, empty if it can
+	std::string ParameterError(const std::string& name, double value)
+	{
+		std::string error = "there is no parameter " + name;
+		ForEachParameter([&](const char* key, auto& parameter, double lowest, double highest) {
+			if (name != key) return;
+			using Type = std::remove_reference_t<decltype(parameter)>;
+
+			// The value has to fit the type as well, casting one that doesn't is undefined
+			double limit = std::is_integral_v<Type> ? std::ldexp(1.0, std::numeric_limits<Type>::digits) : (double)std::numeric_limits<Type>::max();
+			char text[160] = "";
+			if (std::is_integral_v<Type> && value != std::floor(value)) snprintf(text, sizeof(text), "%s has to be a whole number", key);
+			else if (value >= limit) snprintf(text, sizeof(text), "%s has to be below %g", key, limit);
+			else if (!(value >= lowest && value <= highest)) {
+				if (std::isinf(highest)) snprintf(text, sizeof(text), "%s has to be at least %g", key, lowest);
+				else snprintf(text, sizeof(text), "%s has to be from %g to %g", key, lowest, highest);
+			}
+			error = text;
+		});
+		return error;
+	}
+
+	// Sets one of the parameters above by name, for runs set up from a file. Call before LoadRoads, some of them
+	// only take effect when the roads are built. Returns false if there is no such parameter or the value is out of
+	// range, see ParameterError
+	bool SetParameter(const std::string& name, double value)
+	{
+		if (!ParameterError(name, value).empty()) return false;
+		ForEachParameter([&](const char* key, auto& parameter, double, double) {
+			if (name == key) parameter = (std::remove_reference_t<decltype(parameter)>)value;
+		});
+		return true;
+	}
+
+	// Trips between chunks, see DemandModel::Load. Call after LoadRoads
+	bool LoadDemand(const std::string& filename)
+	{
+		return demand.Load(filename, regionGrid.ChunkCount());
+	}
+
+	// Replaces the demand with a gravity model over the zones of the current roads
+	void BuildGravityDemand()
+	{
+		TravelTimeMatrix travelTimes;
+		ComputeZoneTravelTimes(travelTimes);
+
+		std::vector<double> zoneSize(regionGrid.ChunkCount(), 0.0);
+		for (int node = 0; node < roads.NodeCount(); node++) zoneSize[regionGrid.ChunkOfCell(roads.nodeCell[node])] += 1.0;
+		demand.BuildGravity(regionGrid.ChunkCount(), zoneSize, zones.zoneChunk, travelTimes, tripsPerRoadTilePerHour, gravityBeta);
+	}
+
+	void Apply(const SimulationCommand& command)
+	{
+		if (hashInterval > 0) commandLog.push_back({ tick, command });
+
+		switch (command.type) {
+		case SimulationCommand::Type::SetRoad:
+			if (command.cell < 0 || command.cell >= (int)roadMask.size()) break;
+			if (roadMask[command.cell] != (command.value != 0)) {
+				roadMask[command.cell] = command.value != 0;
+				roadsDirty = true;
+			}
+			break;
+
+		case SimulationCommand::Type::SetFocus:
+			focusMin = command.focusMin;
+			focusMax = command.focusMax;
+			focusDirty = true;
+			break;
+		}
+	}
+
+	void Tick()
+	{
+		// Edits since the last tick are batched up into one rebuild before the graph. That stays out of the graph because
+		// adopting a new hierarchy can mean waiting for its build, and a worker running a graph job could be the one
+		// the build is waiting on
+		BeginTick();
+		tickGraph.Run(jobs);
+
+		tick++;
+		time += tickLength;
+
+		if (linkStats.ClosesBin(tick)) {
+			MergeLinkCounters();
+			linkStats.CloseBins(tick);
+		}
+
+		if (hashInterval > 0 && tick % hashInterval == 0) hashLog.push_back({ tick, ComputeStateHash() });
+	}
+
+	// Starts keeping what a replay needs, see Replay.h. Commands are logged with the tick they are applied before
+	void StartReplayLog(uint64_t interval)
+	{
+		hashInterval = interval;
+		commandLog.clear();
+		hashLog.clear();
+	}
+
+	const std::vector<std::pair<uint64_t, SimulationCommand>>& CommandLog() const { return commandLog; }
+	const std::vector<std::pair<uint64_t, SimulationStateHash>>& HashLog() const { return hashLog; }
+	uint32_t Seed() const { return seed; }
+
+	// Everything that decides what happens next, apart from caches that only change how fast it is worked out.
+	// Vehicles are hashed one by one and the hashes added up, so they can be hashed in parallel
+	SimulationStateHash ComputeStateHash() const
+	{
+		SimulationStateHash result;
+
+		uint64_t hash = HashMix(roads.NodeCount(), roads.EdgeCount());
+		for (size_t i = 0; i < roadMask.size(); i += 8) {
+			uint64_t word = 0;
+			memcpy(&word, roadMask.data() + i, std::min<size_t>(8, roadMask.size() - i));
+			hash = HashMix(hash, word);
+		}
+		result.parts[SimulationStateHash::Roads] = hash;
+
+		hash = HashMix(router.Version(), rerouteQueue.size() - rerouteCursor);
+		for (int e = 0; e < roads.EdgeCount(); e++) {
+			hash = HashMix(hash, FloatBits(edgeWeights[e]));
+			hash = HashMix(hash, FloatBits(edgeEstimates[e].travelTime.load(std::memory_order_relaxed)));
+		}
+		result.parts[SimulationStateHash::Routing] = hash;
+
+		hash = HashMix(events.Size(), nodeSignal.size());
+		for (size_t i = 0; i < nodeSignal.size(); i += 8) {
+			uint64_t word = 0;
+			memcpy(&word, nodeSignal.data() + i, std::min<size_t>(8, nodeSignal.size() - i));
+			hash = HashMix(hash, word);
+		}
+		result.parts[SimulationStateHash::Signals] = hash;
+
+		std::mt19937 rngCopy = rng;
+		hash = HashMix(rngCopy(), nextVehicleId);
+		hash = HashMix(hash, tripStats.generated);
+		hash = HashMix(hash, tripStats.started);
+		hash = HashMix(hash, tripStats.completed);
+		hash = HashMix(hash, tripStats.abandoned);
+		hash = HashMix(hash, tripStats.dropped);
+		for (const Trip& trip : pendingTrips) hash = HashMix(hash, ((uint64_t)(uint32_t)trip.origin << 32) | (uint32_t)trip.destination);
+		result.parts[SimulationStateHash::Trips] = hash;
+
+		std::atomic<uint64_t> vehicleSum = 0;
+		jobs.ParallelFor(0, (int)vehicles.size(), 4096, [&](int begin, int end) {
+			uint64_t sum = 0;
+			for (int i = begin; i < end; i++) {
+				const Vehicle& v = vehicles[i];
+				if (v.arrived) continue;
+				uint64_t h = HashMix(v.id, ((uint64_t)(uint32_t)v.edge << 32) | (uint32_t)v.nextEdge);
+				h = HashMix(h, (FloatBits(v.progress) << 32) | FloatBits(v.speed));
+				h = HashMix(h, ((uint64_t)v.rngState << 32) | (uint32_t)v.routeIndex);
+				h = HashMix(h, v.route ? v.route->size() : UINT64_MAX);
+				h = HashMix(h, v.enteredTick);
+				h = HashMix(h, v.departedTick);
+				h = HashMix(h, v.waitingSince);
+				h = HashMix(h, ((uint64_t)(uint32_t)v.destinationCell << 32) | (v.junctionQuadrants << 8) | (v.crossedJunction << 1) | v.meso);
+				sum += h;
+			}
+			vehicleSum += sum;
+		});
+		result.parts[SimulationStateHash::Vehicles] = HashMix(vehicleSum, VehicleCount());
+		return result;
+	}
+
+	void WriteSnapshot(SimulationSnapshot& out) const
+	{
+		out.tick = tick;
+		out.time = time;
+		out.hierarchy = router.SharedHierarchy(roads);
+		out.hierarchyCells = out.hierarchy ? roadCells : nullptr;
+
+		out.tripTimes = SummariseTimes(tripTimes);
+		out.routeCache = routeCache.GetMetrics();
+		out.watchedCell = watchedCell.load(std::memory_order_relaxed);
+		out.watchedLinks.clear();
+		int node = out.watchedCell >= 0 && out.watchedCell < (int)roads.cellToNode.size() ? roads.cellToNode[out.watchedCell] : -1;
+		if (node >= 0) {
+			for (int e = roads.edgeStart[node]; e < roads.edgeStart[node + 1]; e++) {
+				out.watchedLinks.push_back({ roads.nodeCell[roads.edgeTarget[e]], SummariseTimes(linkStats.TravelTimes(edgeLink[e])) });
+			}
+		}
+
+		if (arrivedCount > 0) {
+			out.vehicles.clear();
+			for (const Vehicle& v : vehicles) {
+				if (!v.arrived) out.vehicles.push_back({ v.id, VehiclePos(v) });
+			}
+			return;
+		}
+
+		out.vehicles.resize(vehicles.size());
+		jobs.ParallelFor(0, (int)vehicles.size(), 4096, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				out.vehicles[i] = { vehicles[i].id, VehiclePos(vehicles[i]) };
+			}
+		});
+	}
+
+	// Cell whose links have their travel times put into snapshots, -1 for none. It only changes what snapshots carry,
+	// so it can be set from any thread rather than posted as a command, and stays out of replays
+	void WatchCell(int cell) { watchedCell.store(cell, std::memory_order_relaxed); }
+
+	const RoadNetwork& Roads() const { return roads; }
+	const Router& Routing() const { return router; }
+	const std::vector<float>& EdgeWeights() const { return edgeWeights; }
+	const Zones& GetZones() const { return zones; }
+	RouteCache::Metrics RouteCacheMetrics() const { return routeCache.GetMetrics(); }
+	// Only covers bins that have closed. Only call between ticks
+	const LinkStats& GetLinkStats() const { return linkStats; }
+	int EdgeLink(int edge) const { return edgeLink[edge]; }
+
+	// Current estimate of the seconds it takes to drive an edge, as opposed to the weight routes are planned with
+	float EdgeTravelTime(int edge) const { return edgeEstimates[edge].travelTime.load(std::memory_order_relaxed); }
+
+	// Travel times between every pair of zones in one batch. Only call between ticks
+	void ComputeZoneTravelTimes(TravelTimeMatrix& result) const
+	{
+		router.ManyToMany(roads, edgeWeights, zones.zoneNode, zones.zoneNode, jobs, result);
+	}
+	size_t VehicleCount() const { return vehicles.size() - arrivedCount; }
+	const DemandModel& Demand() const { return demand; }
+	TripStats GetTripStats() const { return tripStats; }
+	// Travel times of completed trips, in ticks. Only exact between ticks
+	const QuantileSketch& TripTimes() const { return tripTimes; }
+	// Null if no trip from the one chunk to the other has been completed
+	const QuantileSketch* TripTimes(int originChunk, int destinationChunk) const { return odTripTimes.Get(originChunk, destinationChunk); }
+	size_t PendingTripCount() const { return pendingTrips.size(); }
+	uint64_t TickCount() const { return tick; }
+	double SimulatedTime() const { return time; }
+
+private:
+	olc::vf2d VehiclePos(const Vehicle& v) const
+	{
+		float progress = v.meso ? MesoProgress(v) : v.progress;
+		olc::vf2d from = olc::vf2d(roads.CellPos(roads.edgeSource[v.edge])) + olc::vf2d(0.5f, 0.5f);
+		olc::vf2d to = olc::vf2d(roads.CellPos(roads.edgeTarget[v.edge])) + olc::vf2d(0.5f, 0.5f);
+		olc::vf2d dir = to - from;
+
+		// Keep to the right hand side of the road
+		const float laneOffset = 0.2f;
+		return from + dir * progress + olc::vf2d(-dir.y, dir.x) * laneOffset;
+	}
+
+	// Where a queued vehicle would be driving at free flow, it can't be any further along than that
+	float MesoProgress(const Vehicle& v) const
+	{
+		return std::min(1.0f, (tick - v.enteredTick) * v.speed * tickLength / roads.edgeLength[v.edge]);
+	}
+
+	uint64_t MesoTravelTicks(const Vehicle& v) const
+	{
+		return (uint64_t)std::ceil(roads.edgeLength[v.edge] / (v.speed * tickLength));
+	}
+
+	void BeginTick()
+	{
+		if (roadsDirty) RebuildRoads();
+		else if (tick > 0 && tick % rerouteIntervalTicks == 0) UpdateEdgeCosts();
+		if (focusDirty) ApplyFocus();
+		router.Update(tick, jobs);
+
+		events.Advance(tick, [this](uint64_t, const SimulationEvent& event) { Dispatch(event); });
+	}
+
+	void Dispatch(const SimulationEvent& event)
+	{
+		switch (event.type) {
+		case SimulationEvent::Type::SignalPhase:
+			nodeSignal[event.target] ^= 1;
+			events.Schedule(tick + signalGreenTicks, event);
+			break;
+		}
+	}
+
+	template<typename F>
+	void ForEachRegion(F&& fn)
+	{
+		jobs.ParallelFor(0, (int)regions.size(), 1, [&](int begin, int end) {
+			for (int r = begin; r < end; r++) fn(r);
+		});
+	}
+
+	// Index into Region::outbox of the queue from one region to a neighbouring one
+	int NeighbourSlot(int from, int to) const
+	{
+		int dx = to % regionGrid.vChunkCount.x - from % regionGrid.vChunkCount.x;
+		int dy = to / regionGrid.vChunkCount.x - from / regionGrid.vChunkCount.x;
+		// Vehicles move less than a tile per tick, so they can never skip over a region
+		assert(dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1);
+		return (dy + 1) * 3 + (dx + 1);
+	}
+
+	// Switches every region that moved in or out of the focus over to the other model
+	void ApplyFocus()
+	{
+		focusDirty = false;
+		olc::vi2d margin = regionGrid.vChunkSize * focusMarginChunks;
+		olc::vi2d low = focusMin - margin;
+		olc::vi2d high = focusMax + margin;
+
+		ForEachRegion([&](int r) {
+			olc::vi2d begin = regionGrid.ChunkBegin(r);
+			olc::vi2d end = regionGrid.ChunkEnd(r) - olc::vi2d(1, 1);
+			bool inFocus = end.x >= low.x && begin.x <= high.x && end.y >= low.y && begin.y <= high.y;
+
+			if (inFocus && regions[r].meso) RegionToMicro(r);
+			else if (!inFocus && !regions[r].meso) RegionToMeso(r);
+		});
+	}
+
+	// Vehicles keep their order along every edge, and the time they would have entered it to be where they are,
+	// so they leave the edge when they would have anyway
+	void RegionToMeso(int r)
+	{
+		Region& region = regions[r];
+		region.meso = true;
+		region.queues.assign(region.edges.size(), {});
+		region.activeQueues.clear();
+
+		std::vector<int>& order = region.sortScratch;
+		order = region.vehicles;
+		std::sort(order.begin(), order.end(), [this](int a, int b) {
+			const Vehicle& va = vehicles[a];
+			const Vehicle& vb = vehicles[b];
+			if (va.edge != vb.edge) return va.edge < vb.edge;
+			if (va.progress != vb.progress) return va.progress > vb.progress;
+			return va.id < vb.id;
+		});
+
+		for (int i : order) {
+			Vehicle& v = vehicles[i];
+			uint64_t elapsed = (uint64_t)(v.progress * roads.edgeLength[v.edge] / (v.speed * tickLength));
+			v.enteredTick = tick - std::min(elapsed, tick);
+			v.meso = true;
+			v.junctionQuadrants = 0;
+			v.crossedJunction = false;
+			v.waitingSince = UINT64_MAX;
+			region.QueueVehicle(edgeSlot[v.edge], i);
+		}
+		region.vehicles.clear();
+	}
+
+	// Vehicles are put where free flow would have taken them, but always a gap behind the one in front
+	void RegionToMicro(int r)
+	{
+		Region& region = regions[r];
+		region.meso = false;
+		region.vehicles.clear();
+
+		std::sort(region.activeQueues.begin(), region.activeQueues.end());
+		for (int slot : region.activeQueues) {
+			MesoQueue& queue = region.queues[slot];
+			float length = roads.edgeLength[region.edges[slot]];
+			float limit = length;
+			for (size_t k = queue.head; k < queue.vehicles.size(); k++) {
+				Vehicle& v = vehicles[queue.vehicles[k]];
+				float distance = std::min(MesoProgress(v) * length, limit);
+				v.progress = std::max(distance, 0.0f) / length;
+				v.meso = false;
+				limit = distance - minimumGap;
+				region.vehicles.push_back(queue.vehicles[k]);
+			}
+		}
+		region.queues.clear();
+		region.activeQueues.clear();
+		std::sort(region.vehicles.begin(), region.vehicles.end());
+	}
+
+	void RebuildRoads()
+	{
+		// Counts so far belong to the edges as they were
+		MergeLinkCounters();
+
+		// Queues are per edge, so everything goes back to full detail while edges are renumbered
+		ForEachRegion([this](int r) {
+			if (regions[r].meso) RegionToMicro(r);
+		});
+
+		// Remember where every vehicle was, in cells, since edge indices change with the rebuild
+		std::vector<std::pair<int, int>> vehicleCells(vehicles.size());
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			vehicleCells[i] = {
+				roads.nodeCell[roads.edgeSource[vehicles[i].edge]],
+				roads.nodeCell[roads.edgeTarget[vehicles[i].edge]]
+			};
+		}
+
+		roads.Build(roadMask, roads.vWorldSize);
+		roadsDirty = false;
+		roadCells = std::make_shared<const std::vector<int>>(roads.nodeCell);
+
+		edgeLink.resize(roads.EdgeCount());
+		for (int e = 0; e < roads.EdgeCount(); e++) {
+			edgeLink[e] = linkStats.Link(roads.nodeCell[roads.edgeSource[e]], roads.nodeCell[roads.edgeTarget[e]], roads.edgeLength[e]);
+		}
+
+		edgeWeights.resize(roads.EdgeCount());
+		edgeEstimates = std::make_unique<EdgeEstimate[]>(roads.EdgeCount());
+		for (int e = 0; e < roads.EdgeCount(); e++) {
+			edgeWeights[e] = roads.edgeLength[e] / freeFlowSpeed;
+			edgeEstimates[e].travelTime = edgeWeights[e];
+			edgeEstimates[e].samples = 0;
+		}
+		edgeCostChanged.assign(roads.EdgeCount(), 0);
+		rerouteQueue.clear();
+		rerouteCursor = 0;
+		router.RequestBuild(roads, edgeWeights, jobs, tick + hierarchyDelayTicks);
+		hierarchyWeightsStale = false;
+		hierarchyRequestTick = tick;
+		zones.Build(roads, regionGrid);
+		junctions.Build(roads);
+		PlaceSignals();
+
+		// Keep vehicles whose road still exists, drop the rest.
+		// Edge numbers have all changed, so routes are thrown away and planned again at the next junction
+		size_t kept = 0;
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			if (vehicles[i].arrived) continue;
+			int from = roads.cellToNode[vehicleCells[i].first];
+			int to = roads.cellToNode[vehicleCells[i].second];
+			int edge = (from >= 0 && to >= 0) ? roads.FindEdge(from, to) : -1;
+			if (edge < 0) continue;
+
+			vehicles[i].edge = edge;
+			vehicles[i].route = nullptr;
+			vehicles[i].junctionQuadrants = 0;
+			vehicles[i].crossedJunction = false;
+			vehicles[i].waitingSince = UINT64_MAX;
+			vehicles[i].nextEdge = Wander(edge, vehicles[i].rngState);
+			vehicles[kept++] = vehicles[i];
+		}
+		vehicles.resize(kept);
+		arrivedCount = 0;
+
+		AssignRegions();
+		focusDirty = true;
+	}
+
+	// Lights at neighbouring junctions are out of step, by an amount that only depends on where they are
+	void PlaceSignals()
+	{
+		events.Clear();
+		nodeSignal.assign(roads.NodeCount(), -1);
+
+		for (int node = 0; node < roads.NodeCount(); node++) {
+			if (junctions.JunctionOf(node) < 0) continue;
+
+			uint32_t hash = (uint32_t)roads.nodeCell[node] * 2654435761u;
+			uint64_t offset = (hash >> 8) % (2 * signalGreenTicks);
+			nodeSignal[node] = offset < signalGreenTicks ? 0 : 1;
+			events.Schedule(tick + signalGreenTicks - offset % signalGreenTicks, { SimulationEvent::Type::SignalPhase, node });
+		}
+	}
+
+	bool IsRedLight(int edge) const
+	{
+		int8_t green = nodeSignal[roads.edgeTarget[edge]];
+		return green >= 0 && green != (roads.edgeDirection[edge] & 1);
+	}
+
+	void AssignRegions()
+	{
+		regions.assign(regionGrid.ChunkCount(), {});
+
+		edgeRegion.resize(roads.EdgeCount());
+		edgeSlot.resize(roads.EdgeCount());
+		for (int e = 0; e < roads.EdgeCount(); e++) {
+			edgeRegion[e] = regionGrid.ChunkOfCell(roads.nodeCell[roads.edgeSource[e]]);
+			edgeSlot[e] = (int)regions[edgeRegion[e]].edges.size();
+			regions[edgeRegion[e]].edges.push_back(e);
+		}
+		for (Region& region : regions) region.linkCounters.assign(region.edges.size(), {});
+		edgeTail.assign(roads.EdgeCount(), INFINITY);
+		edgeExit.assign(roads.EdgeCount(), -1);
+		gapAhead.resize(vehicles.size());
+
+		for (int i = 0; i < (int)vehicles.size(); i++) {
+			regions[edgeRegion[vehicles[i].edge]].vehicles.push_back(i);
+		}
+	}
+
+	// Phase 1: work out the gaps between the region's vehicles, and publish the rear of every edge to the halo
+	void PublishHalo(int r)
+	{
+		Region& region = regions[r];
+		for (int e : region.edges) {
+			edgeTail[e] = INFINITY;
+			edgeExit[e] = -1;
+		}
+
+		if (region.meso) {
+			// Queued vehicles are bunched up at the front of the edge, or as far as free flow got the last one
+			for (int slot : region.activeQueues) {
+				const MesoQueue& queue = region.queues[slot];
+				if (queue.Empty()) continue;
+				int e = region.edges[slot];
+				float packed = roads.edgeLength[e] - (queue.Size() - 1) * minimumGap;
+				edgeTail[e] = std::max(0.0f, std::min(MesoProgress(vehicles[queue.Back()]) * roads.edgeLength[e], packed));
+
+				const Vehicle& front = vehicles[queue.Front()];
+				if (front.enteredTick + MesoTravelTicks(front) <= tick) edgeExit[e] = front.nextEdge;
+			}
+			return;
+		}
+
+		// Front to back along each edge
+		std::vector<int>& order = region.sortScratch;
+		order = region.vehicles;
+		std::sort(order.begin(), order.end(), [this](int a, int b) {
+			const Vehicle& va = vehicles[a];
+			const Vehicle& vb = vehicles[b];
+			if (va.edge != vb.edge) return va.edge < vb.edge;
+			if (va.progress != vb.progress) return va.progress > vb.progress;
+			return va.id < vb.id;
+		});
+
+		for (size_t k = 0; k < order.size(); k++) {
+			const Vehicle& v = vehicles[order[k]];
+			float distance = v.progress * roads.edgeLength[v.edge];
+
+			if (k > 0 && vehicles[order[k - 1]].edge == v.edge) {
+				gapAhead[order[k]] = vehicles[order[k - 1]].progress * roads.edgeLength[v.edge] - distance;
+			}
+			else {
+				// Front of its edge: the gap depends on the next edge, which may belong to another region
+				gapAhead[order[k]] = INFINITY;
+				if (roads.edgeLength[v.edge] - distance <= v.speed * tickLength + stopLineDistance) edgeExit[v.edge] = v.nextEdge;
+			}
+
+			edgeTail[v.edge] = distance; // The last one written is the rearmost
+		}
+	}
+
+	// Phase 2: vehicles about to reach a junction ask to cross it, and vehicles in one keep their quadrants taken
+	void RequestCrossings(int r)
+	{
+		Region& region = regions[r];
+		region.crossingRequests.clear();
+
+		for (int i : region.vehicles) {
+			Vehicle& v = vehicles[i];
+			if (v.junctionQuadrants) {
+				int node = v.crossedJunction ? roads.edgeSource[v.edge] : roads.edgeTarget[v.edge];
+				region.crossingRequests.push_back({ junctions.JunctionOf(node), true, 0, v.id, i, v.junctionQuadrants, 1 });
+				continue;
+			}
+
+			// Only the front vehicle of an edge can be next into the junction
+			int junction = junctions.JunctionOf(roads.edgeTarget[v.edge]);
+			if (junction < 0 || v.nextEdge < 0 || gapAhead[i] != INFINITY || IsRedLight(v.edge)) continue;
+
+			float step = v.speed * tickLength;
+			float toStopLine = (1.0f - v.progress) * roads.edgeLength[v.edge] - stopLineDistance;
+			if (toStopLine > step) continue;
+
+			// Going in without room on the other side would only block the junction for everyone else
+			if (edgeTail[v.nextEdge] < junctionClearance + minimumGap) continue;
+
+			if (v.waitingSince == UINT64_MAX) v.waitingSince = tick;
+			int duration = (int)std::ceil((stopLineDistance + junctionClearance) / step) + 1;
+			region.crossingRequests.push_back({ junction, false, v.waitingSince, v.id, i, junctions.Movement(roads, v.edge, v.nextEdge), duration });
+		}
+	}
+
+	// Phase 3: grant crossings junction by junction, longest waiting first. Once a request is turned down, later ones
+	// for the same quadrants are too, so nobody gets overtaken by traffic that would keep them waiting
+	void GrantCrossings()
+	{
+		crossingRequests.clear();
+		for (Region& region : regions) {
+			crossingRequests.insert(crossingRequests.end(), region.crossingRequests.begin(), region.crossingRequests.end());
+		}
+
+		std::sort(crossingRequests.begin(), crossingRequests.end(), [](const CrossingRequest& a, const CrossingRequest& b) {
+			if (a.junction != b.junction) return a.junction < b.junction;
+			if (a.inJunction != b.inJunction) return a.inJunction;
+			if (a.waitingSince != b.waitingSince) return a.waitingSince < b.waitingSince;
+			return a.id < b.id;
+		});
+
+		crossingGroups.clear();
+		for (int k = 0; k < (int)crossingRequests.size(); k++) {
+			if (k == 0 || crossingRequests[k].junction != crossingRequests[k - 1].junction) crossingGroups.push_back(k);
+		}
+		crossingGroups.push_back((int)crossingRequests.size());
+
+		// Junctions don't share anything, and every vehicle asks at most once
+		jobs.ParallelFor(0, (int)crossingGroups.size() - 1, 64, [this](int begin, int end) {
+			for (int g = begin; g < end; g++) {
+				uint8_t refused = 0;
+				for (int k = crossingGroups[g]; k < crossingGroups[g + 1]; k++) {
+					const CrossingRequest& request = crossingRequests[k];
+					if (request.inJunction) {
+						junctions.Occupy(request.junction, tick, request.quadrants);
+						continue;
+					}
+
+					if (!(refused & request.quadrants) && junctions.Reserve(request.junction, tick, request.duration, request.quadrants)) {
+						Vehicle& v = vehicles[request.vehicle];
+						v.junctionQuadrants = request.quadrants;
+						v.crossedJunction = false;
+						v.waitingSince = UINT64_MAX;
+					}
+					else refused |= request.quadrants;
+				}
+			}
+		});
+	}
+
+	// Phase 4: move the region's vehicles, and queue up the ones that left it
+	void MoveRegion(int r)
+	{
+		Region& region = regions[r];
+		for (std::vector<int>& outbox : region.outbox) outbox.clear();
+		region.arrivals = 0;
+		region.abandoned = 0;
+		region.arrivalTicks = 0;
+
+		if (region.meso) {
+			MoveRegionMeso(r);
+			return;
+		}
+
+		size_t kept = 0;
+		for (int i : region.vehicles) {
+			Vehicle& v = vehicles[i];
+			region.linkCounters[edgeSlot[v.edge]].vehicleTicks++;
+			float length = roads.edgeLength[v.edge];
+			float distance = v.progress * length;
+
+			float gap = gapAhead[i];
+			if (gap == INFINITY && v.nextEdge >= 0) gap = (length - distance) + edgeTail[v.nextEdge];
+			// Junctions are only entered with a reservation, which is never given at a red light
+			bool mayCross = v.junctionQuadrants != 0 && !v.crossedJunction;
+			if (!mayCross && v.nextEdge >= 0 && junctions.JunctionOf(roads.edgeTarget[v.edge]) >= 0) gap = std::min(gap, length - distance - stopLineDistance + minimumGap);
+
+			float advance = std::clamp(gap - minimumGap, 0.0f, v.speed * tickLength);
+			if (advance == 0.0f && IsStuck(v)) {
+				v.arrived = true;
+				region.abandoned++;
+				continue;
+			}
+
+			distance += advance;
+			while (distance >= length) {
+				distance -= length;
+				RecordTravelTime(region, v);
+
+				if (v.nextEdge < 0) {
+					// End of the trip, or the end of trying
+					v.arrived = true;
+					RecordArrival(region, v);
+					break;
+				}
+
+				v.crossedJunction = v.junctionQuadrants != 0;
+				v.edge = v.nextEdge;
+				v.enteredTick = tick;
+				if (v.route) v.routeIndex++;
+				v.nextEdge = ChooseNextEdge(v);
+				length = roads.edgeLength[v.edge];
+			}
+			if (v.arrived) continue;
+			v.progress = distance / length;
+
+			if (v.crossedJunction && distance >= junctionClearance) {
+				v.junctionQuadrants = 0;
+				v.crossedJunction = false;
+			}
+
+			if (edgeRegion[v.edge] == r) region.vehicles[kept++] = i;
+			else region.outbox[NeighbourSlot(r, edgeRegion[v.edge])].push_back(i);
+		}
+		region.vehicles.resize(kept);
+	}
+
+	// Only the vehicle at the front of each queue is ever looked at. Vehicles that move on to another edge of the region
+	// join its queue straight away, but can't leave it again before the next tick since they have only just entered
+	void MoveRegionMeso(int r)
+	{
+		Region& region = regions[r];
+
+		// Drop the queues that emptied last tick. Queues that fill up while this runs are added at the end, and only
+		// hold vehicles that have just entered, so it doesn't matter that they are looked at this tick
+		size_t kept = 0;
+		for (int slot : region.activeQueues) {
+			if (region.queues[slot].Empty()) {
+				region.queues[slot].listed = false;
+				continue;
+			}
+			region.activeQueues[kept++] = slot;
+			region.linkCounters[slot].vehicleTicks += (uint32_t)region.queues[slot].Size();
+		}
+		region.activeQueues.resize(kept);
+
+		for (size_t k = 0; k < region.activeQueues.size(); k++) {
+			int slot = region.activeQueues[k];
+			MesoQueue& queue = region.queues[slot];
+			int e = region.edges[slot];
+			queue.exitCredit = std::min(1.0f, queue.exitCredit + mesoSaturationFlow * tickLength);
+
+			while (!queue.Empty() && queue.exitCredit >= 1.0f) {
+				int i = queue.Front();
+				Vehicle& v = vehicles[i];
+				if (v.enteredTick + MesoTravelTicks(v) > tick) break;
+				if (v.nextEdge >= 0 && (IsRedLight(e) || edgeTail[v.nextEdge] < minimumGap)) {
+					if (!IsStuck(v)) break;
+					queue.Pop();
+					v.arrived = true;
+					region.abandoned++;
+					continue;
+				}
+
+				queue.Pop();
+				queue.exitCredit -= 1.0f;
+				RecordTravelTime(region, v);
+
+				if (v.nextEdge < 0) {
+					v.arrived = true;
+					RecordArrival(region, v);
+					continue;
+				}
+
+				v.edge = v.nextEdge;
+				v.enteredTick = tick;
+				v.progress = 0.0f;
+				if (v.route) v.routeIndex++;
+				v.nextEdge = ChooseNextEdge(v);
+
+				if (edgeRegion[v.edge] == r) region.QueueVehicle(edgeSlot[v.edge], i);
+				else {
+					v.meso = false;
+					region.outbox[NeighbourSlot(r, edgeRegion[v.edge])].push_back(i);
+				}
+			}
+		}
+	}
+
+	// Phase 5: pick up the vehicles the neighbouring regions handed over
+	void ReceiveHandovers(int r)
+	{
+		Region& region = regions[r];
+		olc::vi2d chunk = { r % regionGrid.vChunkCount.x, r / regionGrid.vChunkCount.x };
+
+		bool received = false;
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				olc::vi2d neighbour = chunk + olc::vi2d(dx, dy);
+				if ((dx == 0 && dy == 0) || neighbour.x < 0 || neighbour.x >= regionGrid.vChunkCount.x || neighbour.y < 0 || neighbour.y >= regionGrid.vChunkCount.y) continue;
+
+				int n = neighbour.y * regionGrid.vChunkCount.x + neighbour.x;
+				const std::vector<int>& inbox = regions[n].outbox[NeighbourSlot(n, r)];
+				region.vehicles.insert(region.vehicles.end(), inbox.begin(), inbox.end());
+				received |= !inbox.empty();
+			}
+		}
+
+		if (!received) return;
+		std::sort(region.vehicles.begin(), region.vehicles.end());
+
+		if (region.meso) {
+			// Everyone handed over has only just entered their edge, so they queue up behind whoever is on it already
+			for (int i : region.vehicles) {
+				Vehicle& v = vehicles[i];
+				v.meso = true;
+				v.junctionQuadrants = 0;
+				v.crossedJunction = false;
+				region.QueueVehicle(edgeSlot[v.edge], i);
+			}
+			region.vehicles.clear();
+		}
+	}
+
+	// Blocked on the same edge for so long that it is part of a gridlock, which nothing else would ever clear
+	bool IsStuck(const Vehicle& v) const
+	{
+		return (tick - v.enteredTick) * tickLength > maxStuckSeconds;
+	}
+
+	// Whether a vehicle is about to move onto the edge from one of the edges leading into it
+	bool ThroughTrafficWaiting(int edge) const
+	{
+		int node = roads.edgeSource[edge];
+		for (int e = roads.edgeStart[node]; e < roads.edgeStart[node + 1]; e++) {
+			int in = roads.FindEdge(roads.edgeTarget[e], node);
+			if (in >= 0 && edgeExit[in] == edge) return true;
+		}
+		return false;
+	}
+
+	// Trips start at the road node of their origin zone, as soon as there is room on the first edge of their route.
+	// Vehicles join it past where a junction at its start would end, so they never need a reservation to get out of
+	// one, and only where a vehicle crossing onto the edge would fit. Traffic already on the road goes first
+	void SpawnVehicles()
+	{
+		if (roads.EdgeCount() == 0) return;
+
+		demand.Generate(clockStart + time, tickLength, rng, [this](int origin, int destination) {
+			tripStats.generated++;
+			if (pendingTrips.size() < maxPendingTrips) pendingTrips.push_back({ origin, destination });
+			else tripStats.dropped++;
+		});
+
+		int count = std::min((int)pendingTrips.size(), maxSpawnsPerTick);
+		tripRoutes.assign(count, { nullptr, 0 });
+
+		// Routing is what costs, and it is safe to do in parallel
+		jobs.ParallelFor(0, count, 4, [this](int begin, int end) {
+			for (int k = begin; k < end; k++) {
+				int origin = TripNode(pendingTrips[k].origin);
+				int destination = TripNode(pendingTrips[k].destination);
+				if (origin >= 0 && destination >= 0 && origin != destination) tripRoutes[k] = PlanRoute(origin, destination);
+			}
+		});
+
+		std::vector<int> usedEdges;
+		size_t waiting = 0;
+		for (int k = 0; k < count; k++) {
+			const Trip& trip = pendingTrips[k];
+			const RouteCache::Lookup& route = tripRoutes[k];
+			if (!route.edges) {
+				if (TripNode(trip.origin) < 0 || TripNode(trip.destination) < 0 || TripNode(trip.origin) == TripNode(trip.destination)) tripStats.dropped++;
+				else tripStats.abandoned++;
+				continue;
+			}
+
+			// Don't drop a vehicle on top of another one, the trip waits for the next tick instead
+			int edge = (*route.edges)[route.offset];
+			float entry = std::min(junctionClearance, 0.5f * roads.edgeLength[edge]);
+			if (edgeTail[edge] < entry + minimumGap || ThroughTrafficWaiting(edge) || std::find(usedEdges.begin(), usedEdges.end(), edge) != usedEdges.end()) {
+				pendingTrips[waiting++] = trip;
+				continue;
+			}
+			usedEdges.push_back(edge);
+
+			Vehicle& v = spawnedVehicles.emplace_back();
+			v.id = nextVehicleId++;
+			v.edge = edge;
+			v.progress = entry / roads.edgeLength[edge];
+			v.speed = freeFlowSpeed * (0.75f + 0.5f * RandomFloat(rng));
+			v.rngState = (uint32_t)rng() | 1;
+			v.route = route.edges;
+			v.routeIndex = route.offset;
+			v.nextEdge = route.offset + 1 < (int)route.edges->size() ? (*route.edges)[route.offset + 1] : -1;
+			v.enteredTick = tick;
+			v.departedTick = tick;
+			v.destinationCell = roads.nodeCell[TripNode(trip.destination)];
+			v.originChunk = trip.origin;
+			tripStats.started++;
+		}
+		pendingTrips.erase(pendingTrips.begin() + waiting, pendingTrips.begin() + count);
+	}
+
+	// Road node standing in for a demand zone, -1 if the chunk has no roads
+	int TripNode(int chunk) const
+	{
+		int zone = zones.chunkZone[chunk];
+		return zone >= 0 ? zones.zoneNode[zone] : -1;
+	}
+
+	void MergeSpawnedVehicles()
+	{
+		for (const Region& region : regions) {
+			arrivedCount += region.arrivals + region.abandoned;
+			tripStats.completed += region.arrivals;
+			tripStats.abandoned += region.abandoned;
+			tripStats.travelSeconds += region.arrivalTicks * (double)tickLength;
+		}
+
+		// Arrived vehicles are already out of every region, but only leave the vehicle list in batches
+		if (arrivedCount > 0 && arrivedCount * 16 >= vehicles.size()) {
+			std::vector<int> newIndex(vehicles.size(), -1);
+			size_t kept = 0;
+			for (size_t i = 0; i < vehicles.size(); i++) {
+				if (vehicles[i].arrived) continue;
+				newIndex[i] = (int)kept;
+				vehicles[kept++] = std::move(vehicles[i]);
+			}
+			vehicles.resize(kept);
+			arrivedCount = 0;
+
+			ForEachRegion([&](int r) {
+				for (int& i : regions[r].vehicles) i = newIndex[i];
+				for (MesoQueue& queue : regions[r].queues) {
+					for (size_t k = queue.head; k < queue.vehicles.size(); k++) queue.vehicles[k] = newIndex[queue.vehicles[k]];
+				}
+			});
+		}
+
+		for (Vehicle& v : spawnedVehicles) {
+			Region& region = regions[edgeRegion[v.edge]];
+			v.meso = region.meso;
+			if (region.meso) region.QueueVehicle(edgeSlot[v.edge], (int)vehicles.size());
+			else region.vehicles.push_back((int)vehicles.size());
+			vehicles.push_back(v);
+		}
+		spawnedVehicles.clear();
+		gapAhead.resize(vehicles.size());
+	}
+
+	SimulationSnapshot::TravelTimes SummariseTimes(const QuantileSketch& sketch) const
+	{
+		return { sketch.Count(), (float)(sketch.Quantile(0.5) * tickLength), (float)(sketch.Quantile(0.9) * tickLength), (float)(sketch.Quantile(0.99) * tickLength) };
+	}
+
+	// Vehicles only ever leave edges of their own region, and at most one per tick, so every edge's estimate is
+	// only updated by one thread at a time and in a fixed order. The atomics are what make reading it elsewhere safe
+	void RecordTravelTime(Region& region, const Vehicle& v)
+	{
+		uint64_t ticks = std::max<uint64_t>(tick - v.enteredTick, 1);
+		float sample = ticks * tickLength;
+
+		LinkStats::Counters& counters = region.linkCounters[edgeSlot[v.edge]];
+		counters.exits++;
+		counters.travelTicks += (uint32_t)ticks;
+		linkStats.TravelTimes(edgeLink[v.edge]).Add(ticks);
+
+		EdgeEstimate& estimate = edgeEstimates[v.edge];
+		float old = estimate.travelTime.load(std::memory_order_relaxed);
+		while (!estimate.travelTime.compare_exchange_weak(old, old + (sample - old) * travelTimeSmoothing, std::memory_order_relaxed));
+		estimate.samples.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// A vehicle at the end of its route either made it, or gave up on a destination it couldn't reach
+	void RecordArrival(Region& region, const Vehicle& v)
+	{
+		if (roads.edgeTarget[v.edge] != roads.cellToNode[v.destinationCell]) {
+			region.abandoned++;
+			return;
+		}
+
+		uint64_t ticks = tick - v.departedTick;
+		region.arrivals++;
+		region.arrivalTicks += ticks;
+		tripTimes.Add(ticks);
+		if (v.originChunk >= 0) odTripTimes.Add(v.originChunk, regionGrid.ChunkOfCell(v.destinationCell), ticks);
+	}
+
+	// Between ticks: empty every region's counters into the link totals
+	void MergeLinkCounters()
+	{
+		for (Region& region : regions) {
+			for (size_t slot = 0; slot < region.edges.size(); slot++) {
+				LinkStats::Counters& counters = region.linkCounters[slot];
+				if (counters.vehicleTicks == 0 && counters.exits == 0) continue;
+				linkStats.Add(edgeLink[region.edges[slot]], counters);
+				counters = {};
+			}
+		}
+	}
+
+	// Between ticks: make estimates that moved far enough from the weights the new weights, and queue up every vehicle
+	// whose route still has to cross one of them
+	void UpdateEdgeCosts()
+	{
+		// Vehicles only leave an edge in the order they got onto it, so the one that has been on it longest is at the front
+		std::vector<uint64_t> frontEntered(roads.EdgeCount(), UINT64_MAX);
+		for (const Vehicle& v : vehicles) {
+			if (!v.arrived) frontEntered[v.edge] = std::min(frontEntered[v.edge], v.enteredTick);
+		}
+
+		bool changed = false;
+		rerouteSecondsPerTile = INFINITY;
+		for (int e = 0; e < roads.EdgeCount(); e++) {
+			EdgeEstimate& estimate = edgeEstimates[e];
+			float freeFlow = roads.edgeLength[e] / freeFlowSpeed;
+
+			// A jammed edge measures nothing, since nobody gets off it, but it takes at least as long as its front vehicle
+			// has been on it. Only an empty edge is left to recover on its own, nobody measures an edge nobody drives
+			float travelTime = estimate.travelTime;
+			if (frontEntered[e] != UINT64_MAX) travelTime = std::max(travelTime, (tick - frontEntered[e]) * tickLength);
+			else if (estimate.samples == 0) travelTime += (freeFlow - travelTime) * travelTimeRecovery;
+			estimate.travelTime = travelTime;
+			estimate.samples = 0;
+
+			edgeCostChanged[e] = std::abs(travelTime - edgeWeights[e]) > edgeWeights[e] * rerouteThreshold;
+			if (edgeCostChanged[e]) {
+				edgeWeights[e] = travelTime;
+				changed = true;
+			}
+			rerouteSecondsPerTile = std::min(rerouteSecondsPerTile, edgeWeights[e] / roads.edgeLength[e]);
+		}
+
+		hierarchyWeightsStale |= changed;
+		if (hierarchyWeightsStale && tick >= hierarchyRequestTick + hierarchyRebuildTicks) {
+			router.RequestBuild(roads, edgeWeights, jobs, tick + hierarchyDelayTicks);
+			hierarchyWeightsStale = false;
+			hierarchyRequestTick = tick;
+		}
+
+		// Whatever is left of the last round was planned with weights that are gone now anyway
+		rerouteQueue.clear();
+		rerouteCursor = 0;
+		if (!changed) return;
+
+		std::vector<uint8_t> affected(vehicles.size());
+		jobs.ParallelFor(0, (int)vehicles.size(), 1024, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) affected[i] = RouteCrossesChangedEdge(vehicles[i]);
+		});
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			if (affected[i]) rerouteQueue.push_back(vehicles[i].id);
+		}
+	}
+
+	// Only the part past the next edge counts, the vehicle is committed to that one already
+	bool RouteCrossesChangedEdge(const Vehicle& v) const
+	{
+		if (!v.route || v.arrived || v.nextEdge < 0) return false;
+		for (int k = v.routeIndex + 2; k < (int)v.route->size(); k++) {
+			if (edgeCostChanged[(*v.route)[k]]) return true;
+		}
+		return false;
+	}
+
+	// Replans the next few queued vehicles with the latest weights. Plain A* rather than the hierarchy,
+	// which is still the one for older weights until its replacement is adopted
+	void RerouteVehicles()
+	{
+		size_t batchEnd = std::min(rerouteQueue.size(), rerouteCursor + (size_t)maxReroutesPerTick);
+		jobs.ParallelFor((int)rerouteCursor, (int)batchEnd, 4, [this](int begin, int end) {
+			std::vector<int> path;
+			for (int k = begin; k < end; k++) {
+				// Vehicles are sorted by id, and may have been removed since they were queued
+				auto it = std::lower_bound(vehicles.begin(), vehicles.end(), rerouteQueue[k], [](const Vehicle& v, uint32_t id) { return v.id < id; });
+				if (it == vehicles.end() || it->id != rerouteQueue[k] || !RouteCrossesChangedEdge(*it)) continue;
+
+				Vehicle& v = *it;
+				int from = roads.edgeTarget[v.nextEdge];
+				int destination = roads.edgeTarget[v.route->back()];
+				Router::AStar(roads, edgeWeights, rerouteSecondsPerTile, from, destination, path);
+
+				auto route = std::make_shared<std::vector<int>>();
+				route->reserve(path.size() + 1);
+				route->push_back(v.nextEdge);
+				route->insert(route->end(), path.begin(), path.end());
+				v.route = std::move(route);
+				v.routeIndex = -1;
+			}
+		});
+		rerouteCursor = batchEnd;
+	}
+
+	// Pick the edge to take once the vehicle reaches the end of its current one, -1 if the trip ends there.
+	// Without a route, e.g. after a road edit threw it away, a new one is planned to the destination
+	int ChooseNextEdge(Vehicle& v) const
+	{
+		if (v.route && v.routeIndex + 1 < (int)v.route->size()) return (*v.route)[v.routeIndex + 1];
+
+		int from = roads.edgeTarget[v.edge];
+		int destination = v.destinationCell >= 0 ? roads.cellToNode[v.destinationCell] : -1;
+		v.route = nullptr;
+		if (destination < 0 || destination == from) return -1;
+
+		RouteCache::Lookup route = PlanRoute(from, destination);
+		if (!route.edges) return -1;
+
+		v.route = std::move(route.edges);
+		v.routeIndex = route.offset - 1;
+		return (*v.route)[route.offset];
+	}
+
+	// Null edges if there is no way there
+	RouteCache::Lookup PlanRoute(int from, int destination) const
+	{
+		RouteCache::Lookup cached;
+		if (!routeCache.Find(from, destination, router.Version(), cached)) {
+			auto route = std::make_shared<std::vector<int>>();
+			router.Route(roads, edgeWeights, from, destination, *route);
+			cached = { route->empty() ? nullptr : std::move(route), 0 };
+			routeCache.Stage(from, destination, router.Version(), cached.edges);
+		}
+		return cached;
+	}
+
+	// Any way but back, unless it is a dead end
+	int Wander(int edge, uint32_t& rngState) const
+	{
+		int node = roads.edgeTarget[edge];
+		int cameFrom = roads.edgeSource[edge];
+
+		int options[4];
+		int optionCount = 0;
+		for (int e = roads.edgeStart[node]; e < roads.edgeStart[node + 1]; e++) {
+			if (roads.edgeTarget[e] != cameFrom) options[optionCount++] = e;
+		}
+
+		if (optionCount == 0) return roads.FindEdge(node, cameFrom);
+		return options[NextRandom(rngState) % optionCount];
+	}
+
+	static uint64_t HashMix(uint64_t hash, uint64_t value)
+	{
+		value *= 0xbf58476d1ce4e5b9ull;
+		value ^= value >> 31;
+		hash = (hash ^ value) * 0x94d049bb133111ebull;
+		return hash ^ (hash >> 29);
+	}
+
+	static uint64_t FloatBits(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// xorshift32, state must never be 0
+	static uint32_t NextRandom(uint32_t& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+};
+
+// What the renderer needs to draw one frame: the two latest snapshots and how far between them to draw
+struct SimulationFrame {
+	std::shared_ptr<const SimulationSnapshot> previous;
+	std::shared_ptr<const SimulationSnapshot> current;
+	float alpha = 0.0f; // 0 = previous, 1 = current
+};
+
+// Runs a Simulation on its own thread at a fixed tick rate, independent of the frame rate.
+// Snapshots are triple buffered: one being drawn from, one being interpolated towards, one being written
+class SimulationRunner {
+
+	using Clock = std::chrono::steady_clock;
+
+private:
+	Simulation& simulation;
+
+	std::thread thread;
+	std::atomic<bool> running = false;
+	std::mutex wakeMutex;
+	std::condition_variable wakeSignal;
+
+	std::mutex commandMutex;
+	std::vector<SimulationCommand> pendingCommands;
+
+	std::mutex snapshotMutex;
+	std::vector<std::shared_ptr<SimulationSnapshot>> snapshotPool;
+	std::shared_ptr<const SimulationSnapshot> previous;
+	std::shared_ptr<const SimulationSnapshot> current;
+	Clock::time_point currentPublished;
+
+public:
+	// Give up on catching up if the simulation falls further behind real time than this
+	std::chrono::milliseconds maxLag = std::chrono::milliseconds(250);
+
+	// Called on the simulation thread with every snapshot as it is published, e.g. to record it. Set before Start,
+	// and keep it quick, the next tick waits for it
+	std::function<void(const SimulationSnapshot&)> onPublish;
+
+public:
+	SimulationRunner(Simulation& simulation) : simulation(simulation)
+	{
+		// Publish the starting state so there is always something to draw
+		Publish();
+		Publish();
+	}
+
+	~SimulationRunner() { Stop(); }
+
+	void Start()
+	{
+		if (running) return;
+		running = true;
+		thread = std::thread(&SimulationRunner::Run, this);
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			running = false;
+		}
+		wakeSignal.notify_all();
+		if (thread.joinable()) thread.join();
+	}
+
+	// Commands are applied at the start of the next tick, in the order they were posted
+	void Post(const SimulationCommand& command)
+	{
+		std::lock_guard<std::mutex> lock(commandMutex);
+		pendingCommands.push_back(command);
+	}
+
+	SimulationFrame GetFrame()
+	{
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+
+		std::chrono::duration<float> sincePublished = Clock::now() - currentPublished;
+		float alpha = sincePublished.count() / simulation.tickLength;
+
+		return { previous, current, std::clamp(alpha, 0.0f, 1.0f) };
+	}
+
+private:
+	void Run()
+	{
+		std::vector<SimulationCommand> commands;
+		const auto tickDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(simulation.tickLength));
+		Clock::time_point nextTick = Clock::now();
+
+		while (running) {
+			{
+				std::lock_guard<std::mutex> lock(commandMutex);
+				commands.swap(pendingCommands);
+			}
+			for (const SimulationCommand& command : commands) simulation.Apply(command);
+			commands.clear();
+
+			simulation.Tick();
+			Publish();
+
+			// Ticks are scheduled against the wall clock rather than slept for a fixed time after each one,
+			// so a slow tick is made up for by the following ones
+			nextTick += tickDuration;
+			Clock::time_point now = Clock::now();
+			if (now - nextTick > maxLag) nextTick = now;
+
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wakeSignal.wait_until(lock, nextTick, [this] { return !running; });
+		}
+	}
+
+	void Publish()
+	{
+		std::shared_ptr<SimulationSnapshot> snapshot;
+		{
+			// A pooled snapshot is free once nothing but the pool refers to it.
+			// References are only ever added under snapshotMutex, so the count can't go up behind our back
+			std::lock_guard<std::mutex> lock(snapshotMutex);
+			for (auto& pooled : snapshotPool) {
+				if (pooled.use_count() == 1) {
+					snapshot = pooled;
+					break;
+				}
+			}
+			if (!snapshot) {
+				snapshot = std::make_shared<SimulationSnapshot>();
+				snapshotPool.push_back(snapshot);
+			}
+		}
+
+		simulation.WriteSnapshot(*snapshot);
+		if (onPublish) onPublish(*snapshot);
+
+		std::lock_guard<std::mutex> lock(snapshotMutex);
+		previous = current ? current : snapshot;
+		current = snapshot;
+		currentPublished = Clock::now();
+	}
+};
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "Geometry2D.h"
+#include "olcPixelGameEngine/utilities/olcUTIL_QuadTree.h"
+#include "SpatialHash.h"
+#include "PooledQuadTree.h"
+
+#include <vector>
+#include <list>
+#include <random>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdio>
+
+// Times the spatial hash against olc's QuadTreeContainer on points that all move every tick, like vehicles:
+// both are brought up to date with the new positions, then asked the same rectangle and radius queries.
+// Every answer of the spatial hash is checked against going through all the points
+struct SpatialBenchmarkOptions {
+	int items = 100000;
+	int ticks = 100;
+	int queries = 1000; // Per tick, half rectangles and half circles
+	float worldSize = 1000.0f; // Tiles along each side
+	float querySize = 10.0f; // Sides of the rectangles and diameter of the circles, in tiles
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--bench-spatial") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--bench-spatial" && option != "--ticks" && option != "--queries" && option != "--world" && option != "--query-size") {
+				printf("Error: unknown option %s\n", option.c_str());
+				printf("Usage: Traffic --bench-spatial items [--ticks N] [--queries N] [--world tiles] [--query-size tiles]\n");
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--bench-spatial") items = atoi(value);
+			else if (option == "--ticks") ticks = atoi(value);
+			else if (option == "--queries") queries = atoi(value);
+			else if (option == "--world") worldSize = (float)atof(value);
+			else if (option == "--query-size") querySize = (float)atof(value);
+		}
+
+		if (items < 1 || ticks < 1 || queries < 0 || worldSize <= 0.0f || querySize <= 0.0f) {
+			printf("Error: --bench-spatial, --ticks, --world and --query-size have to be positive\n");
+			return false;
+		}
+		return true;
+	}
+};
+
+inline int RunSpatialBenchmark(const SpatialBenchmarkOptions& options)
+{
+	using Clock = std::chrono::steady_clock;
+	auto Milliseconds = [](Clock::time_point from) { return std::chrono::duration<double, std::milli>(Clock::now() - from).count(); };
+
+	std::mt19937 rng(69);
+	std::uniform_real_distribution<float> inWorld(0.0f, options.worldSize);
+	std::uniform_real_distribution<float> velocity(-0.1f, 0.1f); // Tiles per tick, a bit faster than traffic
+
+	std::vector<olc::vf2d> positions(options.items);
+	std::vector<olc::vf2d> velocities(options.items);
+	for (int i = 0; i < options.items; i++) {
+		positions[i] = { inWorld(rng), inWorld(rng) };
+		velocities[i] = { velocity(rng), velocity(rng) };
+	}
+
+	// Points as empty rectangles, the quad tree only holds rectangles
+	auto PointRect = [](olc::vf2d p) { return olc::utils::geom2d::rect<float>(p, { 0.0f, 0.0f }); };
+
+	olc::utils::QuadTreeContainer<int> quadTree({ { 0.0f, 0.0f }, { options.worldSize, options.worldSize } });
+	using QuadTreeItem = std::list<olc::utils::QuadTreeItem<int>>::iterator;
+	std::vector<QuadTreeItem> quadTreeItems(options.items);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < options.items; i++) {
+		quadTree.insert(i, PointRect(positions[i]));
+		quadTreeItems[i] = std::prev(quadTree.end());
+	}
+	double quadTreeInsert = Milliseconds(start);
+
+	SpatialHash hash;
+	hash.Resize({ 0.0f, 0.0f }, { options.worldSize, options.worldSize });
+
+	double quadTreeUpdate = 0.0, quadTreeQuery = 0.0, hashUpdate = 0.0, hashQuery = 0.0;
+	uint64_t quadTreeFound = 0, hashFound = 0;
+	int wrong = 0;
+	std::vector<int> found;
+	std::vector<olc::vf2d> queryCentres(options.queries);
+
+	for (int tick = 0; tick < options.ticks; tick++) {
+		// Bounce off the edges of the world
+		for (int i = 0; i < options.items; i++) {
+			olc::vf2d& p = positions[i];
+			olc::vf2d& v = velocities[i];
+			p += v;
+			if (p.x < 0.0f || p.x >= options.worldSize) { v.x = -v.x; p.x = std::clamp(p.x, 0.0f, std::nextafter(options.worldSize, 0.0f)); }
+			if (p.y < 0.0f || p.y >= options.worldSize) { v.y = -v.y; p.y = std::clamp(p.y, 0.0f, std::nextafter(options.worldSize, 0.0f)); }
+		}
+		for (olc::vf2d& centre : queryCentres) centre = { inWorld(rng), inWorld(rng) };
+
+		start = Clock::now();
+		for (int i = 0; i < options.items; i++) quadTree.relocate(quadTreeItems[i], PointRect(positions[i]));
+		quadTreeUpdate += Milliseconds(start);
+
+		start = Clock::now();
+		hash.Build(options.items, [&](int i) { return positions[i]; });
+		hashUpdate += Milliseconds(start);
+
+		// The quad tree only does rectangles, circles are their bounding box narrowed down by distance
+		const float half = options.querySize * 0.5f;
+		start = Clock::now();
+		for (int q = 0; q < options.queries; q++) {
+			olc::vf2d centre = queryCentres[q];
+			auto results = quadTree.search({ centre - olc::vf2d(half, half), { options.querySize, options.querySize } });
+			if (q % 2 == 0) quadTreeFound += results.size();
+			else {
+				for (const auto& item : results) quadTreeFound += (positions[item->item] - centre).mag2() <= half * half;
+			}
+		}
+		quadTreeQuery += Milliseconds(start);
+
+		start = Clock::now();
+		for (int q = 0; q < options.queries; q++) {
+			olc::vf2d centre = queryCentres[q];
+			found.clear();
+			if (q % 2 == 0) hash.QueryRect(centre - olc::vf2d(half, half), centre + olc::vf2d(half, half), found);
+			else hash.QueryRadius(centre, half, found);
+			hashFound += found.size();
+		}
+		hashQuery += Milliseconds(start);
+
+		// Checked outside the timing, on a few queries per tick
+		for (int q = 0; q < std::min(options.queries, 8); q++) {
+			olc::vf2d centre = queryCentres[q];
+			found.clear();
+			if (q % 2 == 0) hash.QueryRect(centre - olc::vf2d(half, half), centre + olc::vf2d(half, half), found);
+			else hash.QueryRadius(centre, half, found);
+
+			size_t expected = 0;
+			for (const olc::vf2d& p : positions) {
+				if (q % 2 == 0) expected += p.x >= centre.x - half && p.x <= centre.x + half && p.y >= centre.y - half && p.y <= centre.y + half;
+				else expected += (p - centre).mag2() <= half * half;
+			}
+			if (found.size() != expected) wrong++;
+		}
+	}
+
+	printf("%d items over %.0f x %.0f tiles, %d ticks of %d queries of %.1f tiles\n", options.items, options.worldSize, options.worldSize, options.ticks, options.queries, options.querySize);
+	printf("%-12s %14s %14s %14s %12s\n", "", "insert ms", "update ms/tick", "query us", "found");
+	printf("%-12s %14.2f %14.3f %14.3f %12llu\n", "quad tree", quadTreeInsert, quadTreeUpdate / options.ticks, quadTreeQuery * 1000.0 / ((double)options.ticks * std::max(1, options.queries)), (unsigned long long)quadTreeFound);
+	printf("%-12s %14s %14.3f %14.3f %12llu\n", "spatial hash", "-", hashUpdate / options.ticks, hashQuery * 1000.0 / ((double)options.ticks * std::max(1, options.queries)), (unsigned long long)hashFound);
+	if (wrong > 0) {
+		printf("Error: %d spatial hash queries disagree with checking every item\n", wrong);
+		return 1;
+	}
+	return 0;
+}
+
+// Times loading scenery that hardly ever moves, trees and buildings, into olc's QuadTreeContainer one at a time
+// against loading it into the pooled quad tree in one go, then nudging a few items and asking rectangle queries.
+// Every answer of the pooled quad tree is checked against going through all the items
+struct QuadTreeBenchmarkOptions {
+	int items = 1000000;
+	int moves = 10000; // Items nudged, each a little, as if edited
+	int queries = 1000;
+	float worldSize = 2000.0f; // Tiles along each side
+	float querySize = 40.0f; // Sides of the rectangles in tiles, about a screen
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--bench-quadtree") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--bench-quadtree" && option != "--moves" && option != "--queries" && option != "--world" && option != "--query-size") {
+				printf("Error: unknown option %s\n", option.c_str());
+				printf("Usage: Traffic --bench-quadtree items [--moves N] [--queries N] [--world tiles] [--query-size tiles]\n");
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--bench-quadtree") items = atoi(value);
+			else if (option == "--moves") moves = atoi(value);
+			else if (option == "--queries") queries = atoi(value);
+			else if (option == "--world") worldSize = (float)atof(value);
+			else if (option == "--query-size") querySize = (float)atof(value);
+		}
+
+		if (items < 1 || moves < 0 || queries < 0 || worldSize <= 0.0f || querySize <= 0.0f) {
+			printf("Error: --bench-quadtree, --world and --query-size have to be positive\n");
+			return false;
+		}
+		return true;
+	}
+};
+
+inline int RunQuadTreeBenchmark(const QuadTreeBenchmarkOptions& options)
+{
+	using Clock = std::chrono::steady_clock;
+	auto Milliseconds = [](Clock::time_point from) { return std::chrono::duration<double, std::milli>(Clock::now() - from).count(); };
+	using Box = PooledQuadTree<int>::Box;
+
+	// Mostly trees a bit smaller than a tile, one in ten a building of a few tiles
+	std::mt19937 rng(69);
+	std::uniform_real_distribution<float> inWorld(0.0f, options.worldSize);
+	std::uniform_real_distribution<float> treeSize(0.3f, 0.8f);
+	std::uniform_real_distribution<float> buildingSize(1.0f, 4.0f);
+	std::uniform_real_distribution<float> nudge(-0.05f, 0.05f);
+
+	std::vector<Box> boxes(options.items);
+	std::vector<int> values(options.items);
+	for (int i = 0; i < options.items; i++) {
+		olc::vf2d size = i % 10 == 0 ? olc::vf2d(buildingSize(rng), buildingSize(rng)) : olc::vf2d(treeSize(rng), treeSize(rng));
+		olc::vf2d min = { inWorld(rng), inWorld(rng) };
+		boxes[i] = { min, min + size };
+		values[i] = i;
+	}
+	auto Rect = [](const Box& box) { return olc::utils::geom2d::rect<float>(box.min, box.max - box.min); };
+
+	olc::utils::QuadTreeContainer<int> quadTree({ { 0.0f, 0.0f }, { options.worldSize, options.worldSize } });
+	using QuadTreeItem = std::list<olc::utils::QuadTreeItem<int>>::iterator;
+	std::vector<QuadTreeItem> quadTreeItems(options.items);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < options.items; i++) {
+		quadTree.insert(i, Rect(boxes[i]));
+		quadTreeItems[i] = std::prev(quadTree.end());
+	}
+	double quadTreeLoad = Milliseconds(start);
+
+	PooledQuadTree<int> pooled({ 0.0f, 0.0f }, { options.worldSize, options.worldSize });
+	start = Clock::now();
+	std::vector<int> handles;
+	pooled.Build(boxes, values, &handles);
+	double pooledLoad = Milliseconds(start);
+
+	std::vector<int> moved(options.moves);
+	for (int& i : moved) {
+		i = (int)(rng() % options.items);
+		olc::vf2d offset = { nudge(rng), nudge(rng) };
+		boxes[i].min += offset;
+		boxes[i].max += offset;
+	}
+
+	start = Clock::now();
+	for (int i : moved) quadTree.relocate(quadTreeItems[i], Rect(boxes[i]));
+	double quadTreeMove = Milliseconds(start);
+
+	start = Clock::now();
+	for (int i : moved) pooled.Relocate(handles[i], boxes[i]);
+	double pooledMove = Milliseconds(start);
+
+	std::vector<Box> areas(options.queries);
+	for (Box& area : areas) {
+		area.min = { inWorld(rng), inWorld(rng) };
+		area.max = area.min + olc::vf2d(options.querySize, options.querySize);
+	}
+
+	uint64_t quadTreeFound = 0, pooledFound = 0;
+	start = Clock::now();
+	for (const Box& area : areas) quadTreeFound += quadTree.search(Rect(area)).size();
+	double quadTreeQuery = Milliseconds(start);
+
+	std::vector<int> found;
+	start = Clock::now();
+	for (const Box& area : areas) {
+		found.clear();
+		pooled.Search(area, found);
+		pooledFound += found.size();
+	}
+	double pooledQuery = Milliseconds(start);
+
+	// Checked outside the timing, on a few queries
+	int wrong = 0;
+	for (int q = 0; q < std::min(options.queries, 8); q++) {
+		found.clear();
+		pooled.Search(areas[q], found);
+		size_t expected = 0;
+		for (const Box& box : boxes) expected += PooledQuadTree<int>::Overlaps(areas[q], box);
+		if (found.size() != expected) wrong++;
+	}
+
+	auto PerQuery = [&](double ms) { return ms * 1000.0 / std::max(1, options.queries); };
+	printf("%d items over %.0f x %.0f tiles, %d moved, %d queries of %.1f tiles\n", options.items, options.worldSize, options.worldSize, options.moves, options.queries, options.querySize);
+	printf("%-12s %12s %12s %12s %12s\n", "", "load ms", "move ms", "query us", "found");
+	printf("%-12s %12.2f %12.3f %12.3f %12llu\n", "quad tree", quadTreeLoad, quadTreeMove, PerQuery(quadTreeQuery), (unsigned long long)quadTreeFound);
+	printf("%-12s %12.2f %12.3f %12.3f %12llu\n", "pooled", pooledLoad, pooledMove, PerQuery(pooledQuery), (unsigned long long)pooledFound);
+	printf("Pooled quad tree: %.1f MB\n", pooled.MemoryBytes() / (1024.0 * 1024.0));
+	if (wrong > 0) {
+		printf("Error: %d pooled quad tree queries disagree with checking every item\n", wrong);
+		return 1;
+	}
+	return 0;
+}
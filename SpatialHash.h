@@ -0,0 +1,138 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Points, e.g. vehicles, bucketed by the grid cell they are in, for finding the ones in a rectangle or near a point.
+// Rather than moving points between buckets, the whole thing is built again whenever they move: count the points
+// per cell, add the counts up into where every cell starts, then put every point in its place. That is two passes
+// over the points and one over the cells, with no allocation once the arrays have grown, and the points of a cell
+// end up next to each other, so a query only reads the cells it covers.
+// Points outside the grid go in the nearest cell on its edge, so they are still found
+class SpatialHash {
+
+private:
+	olc::vf2d origin = { 0.0f, 0.0f };
+	olc::vi2d gridSize = { 0, 0 };
+	float cellSize = 1.0f;
+	float inverseCellSize = 1.0f;
+
+	std::vector<int> cellStart; // Per cell and one past the last, into the arrays below
+	std::vector<int> items; // What the point was given as, sorted by cell
+	std::vector<olc::vf2d> points; // Sorted the same way
+	std::vector<int> pointCell; // Per point as given, only used while building
+
+public:
+	// Cells are squares with sides of cellSize, a tile by default
+	void Resize(olc::vf2d worldMin, olc::vf2d worldMax, float newCellSize = 1.0f)
+	{
+		origin = worldMin;
+		cellSize = newCellSize;
+		inverseCellSize = 1.0f / cellSize;
+		gridSize = { std::max(1, (int)std::ceil((worldMax.x - worldMin.x) * inverseCellSize)), std::max(1, (int)std::ceil((worldMax.y - worldMin.y) * inverseCellSize)) };
+		cellStart.assign((size_t)gridSize.x * gridSize.y + 1, 0);
+		items.clear();
+		points.clear();
+	}
+
+	// Item i is at position(i), for i from 0 to count
+	template<typename F>
+	void Build(int count, F&& position)
+	{
+		pointCell.resize(count);
+		items.resize(count);
+		points.resize(count);
+		std::fill(cellStart.begin(), cellStart.end(), 0);
+
+		for (int i = 0; i < count; i++) {
+			int cell = CellOf(position(i));
+			pointCell[i] = cell;
+			cellStart[cell + 1]++;
+		}
+		for (size_t c = 1; c < cellStart.size(); c++) cellStart[c] += cellStart[c - 1];
+
+		// Fills every cell from its start, which leaves cellStart holding where every cell ends, i.e. where the next starts
+		for (int i = 0; i < count; i++) {
+			int slot = cellStart[pointCell[i]]++;
+			items[slot] = i;
+			points[slot] = position(i);
+		}
+		for (size_t c = cellStart.size() - 1; c > 0; c--) cellStart[c] = cellStart[c - 1];
+		cellStart[0] = 0;
+	}
+
+	int Count() const { return (int)items.size(); }
+
+	// Appends the items at or inside the edges of the rectangle
+	void QueryRect(olc::vf2d min, olc::vf2d max, std::vector<int>& out) const
+	{
+		ForEachCell(min, max, [&](int begin, int end) {
+			for (int s = begin; s < end; s++) {
+				const olc::vf2d& p = points[s];
+				if (p.x >= min.x && p.x <= max.x && p.y >= min.y && p.y <= max.y) out.push_back(items[s]);
+			}
+		});
+	}
+
+	// Appends the items no further than radius from the centre
+	void QueryRadius(olc::vf2d centre, float radius, std::vector<int>& out) const
+	{
+		float radius2 = radius * radius;
+		ForEachCell(centre - olc::vf2d(radius, radius), centre + olc::vf2d(radius, radius), [&](int begin, int end) {
+			for (int s = begin; s < end; s++) {
+				if ((points[s] - centre).mag2() <= radius2) out.push_back(items[s]);
+			}
+		});
+	}
+
+	// Closest item no further than maxDistance away, -1 if there is none
+	int Nearest(olc::vf2d point, float maxDistance) const
+	{
+		int best = -1;
+		float best2 = maxDistance * maxDistance;
+		ForEachCell(point - olc::vf2d(maxDistance, maxDistance), point + olc::vf2d(maxDistance, maxDistance), [&](int begin, int end) {
+			for (int s = begin; s < end; s++) {
+				float distance2 = (points[s] - point).mag2();
+				// Lowest item on a tie, so the answer doesn't depend on the order within a cell
+				if (best < 0 ? distance2 <= best2 : distance2 < best2 || (distance2 == best2 && items[s] < best)) {
+					best2 = distance2;
+					best = items[s];
+				}
+			}
+		});
+		return best;
+	}
+
+private:
+	olc::vi2d CellPos(olc::vf2d p) const
+	{
+		olc::vf2d local = (p - origin) * inverseCellSize;
+		// Clamped as floats first, a point far enough away would overflow an int
+		return {
+			(int)std::clamp(local.x, 0.0f, (float)(gridSize.x - 1)),
+			(int)std::clamp(local.y, 0.0f, (float)(gridSize.y - 1))
+		};
+	}
+
+	int CellOf(olc::vf2d p) const
+	{
+		olc::vi2d cell = CellPos(p);
+		return cell.y * gridSize.x + cell.x;
+	}
+
+	// Calls f(begin, end) with the slots of every row of cells that overlap the rectangle, a row being contiguous
+	template<typename F>
+	void ForEachCell(olc::vf2d min, olc::vf2d max, F&& f) const
+	{
+		if (items.empty() || !(min.x <= max.x && min.y <= max.y)) return;
+		olc::vi2d first = CellPos(min);
+		olc::vi2d last = CellPos(max);
+		for (int y = first.y; y <= last.y; y++) {
+			int row = y * gridSize.x;
+			f(cellStart[row + first.x], cellStart[row + last.x + 1]);
+		}
+	}
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free queue between exactly one producer thread and one consumer thread.
+// Items live in a fixed ring of slots that are written and read in place, so a slot holding a vector keeps its
+// capacity from one use to the next and nothing is allocated once the ring has warmed up
+template<typename T>
+class SpscQueue {
+
+private:
+	std::vector<T> slots;
+	alignas(64) std::atomic<size_t> head = 0; // Next slot to write, only moved by the producer
+	alignas(64) std::atomic<size_t> tail = 0; // Next slot to read, only moved by the consumer
+
+public:
+	SpscQueue(size_t capacity) : slots(capacity) {}
+
+	// Producer: the slot to fill, or null if the queue is full. It is only handed over by Push
+	T* BeginPush()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == slots.size()) return nullptr;
+		return &slots[h % slots.size()];
+	}
+
+	void Push() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	// Consumer: the oldest item, or null if the queue is empty. It stays put until Pop
+	T* Front()
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (head.load(std::memory_order_acquire) == t) return nullptr;
+		return &slots[t % slots.size()];
+	}
+
+	void Pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	bool Empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Sum, maximum and count of non-zero cells of a value on a grid, over blocks of 2x2, 4x4, ... cells up to the whole
+// grid, like the mip levels of a texture. Changing cells only recomputes their ancestors, each once however many of
+// its cells changed, from its own four children so nothing drifts however often a cell changes.
+// Sums over any rectangle come from the largest blocks that fit in it, so only its edges go down to single cells
+class StatsPyramid {
+
+public:
+	struct Stats {
+		float sum = 0.0f;
+		float max = 0.0f;
+		uint32_t count = 0; // Cells that aren't 0
+	};
+
+private:
+	struct Level {
+		olc::vi2d size;
+		std::vector<Stats> nodes;
+		std::vector<uint8_t> dirty;
+		std::vector<int> changed; // Nodes recomputed by the last Update, or set since it at level 0
+	};
+
+	std::vector<Level> levels;
+	bool updated = false; // Level 0 still lists what the last Update took in
+
+public:
+	void Resize(olc::vi2d size)
+	{
+		levels.clear();
+		while (true) {
+			Level& level = levels.emplace_back();
+			level.size = size;
+			level.nodes.assign((size_t)size.x * size.y, {});
+			level.dirty.assign(level.nodes.size(), 0);
+			if (size.x <= 1 && size.y <= 1) break;
+			size = { (size.x + 1) / 2, (size.y + 1) / 2 };
+		}
+	}
+
+	// Only shows in the levels above after Update
+	void Set(int x, int y, float value)
+	{
+		Level& base = levels[0];
+		if (updated) {
+			base.changed.clear();
+			updated = false;
+		}
+
+		int i = y * base.size.x + x;
+		base.nodes[i] = { value, value, value != 0.0f ? 1u : 0u };
+		if (!base.dirty[i]) {
+			base.dirty[i] = 1;
+			base.changed.push_back(i);
+		}
+	}
+
+	float Get(int x, int y) const { return levels[0].nodes[y * levels[0].size.x + x].sum; }
+
+	// Recomputes the ancestors of every cell set since the last call
+	void Update()
+	{
+		for (size_t l = 1; l < levels.size(); l++) {
+			Level& child = levels[l - 1];
+			Level& parent = levels[l];
+			parent.changed.clear();
+
+			for (int i : child.changed) {
+				child.dirty[i] = 0;
+				int p = (i / child.size.x / 2) * parent.size.x + (i % child.size.x) / 2;
+				if (parent.dirty[p]) continue;
+				parent.dirty[p] = 1;
+				parent.changed.push_back(p);
+			}
+			for (int p : parent.changed) parent.nodes[p] = Combine(l, p % parent.size.x, p / parent.size.x);
+		}
+
+		Level& top = levels.back();
+		for (int i : top.changed) top.dirty[i] = 0;
+		updated = true;
+	}
+
+	// Nodes the last Update changed at a level, which is what has to be redrawn
+	const std::vector<int>& Changed(int level) const { return levels[level].changed; }
+
+	int LevelCount() const { return (int)levels.size(); }
+	olc::vi2d LevelSize(int level) const { return levels[level].size; }
+	const Stats& At(int level, int x, int y) const { return levels[level].nodes[y * levels[level].size.x + x]; }
+	const Stats& At(int level, int i) const { return levels[level].nodes[i]; }
+
+	// Over the cells from min up to but not including max, as of the last Update
+	Stats Query(olc::vi2d min, olc::vi2d max) const
+	{
+		Stats result;
+		if (levels.empty()) return result;
+		min = min.max({ 0, 0 });
+		max = max.min(levels[0].size);
+		if (min.x >= max.x || min.y >= max.y) return result;
+		Query((int)levels.size() - 1, 0, 0, min, max, result);
+		return result;
+	}
+
+private:
+	Stats Combine(size_t l, int x, int y) const
+	{
+		const Level& child = levels[l - 1];
+		Stats result;
+		for (int cy = y * 2; cy < std::min(y * 2 + 2, child.size.y); cy++) {
+			for (int cx = x * 2; cx < std::min(x * 2 + 2, child.size.x); cx++) Add(result, child.nodes[cy * child.size.x + cx]);
+		}
+		return result;
+	}
+
+	static void Add(Stats& to, const Stats& from)
+	{
+		to.sum += from.sum;
+		to.max = std::max(to.max, from.max);
+		to.count += from.count;
+	}
+
+	void Query(int l, int x, int y, olc::vi2d min, olc::vi2d max, Stats& result) const
+	{
+		// Cells the node covers
+		olc::vi2d begin = olc::vi2d(x, y) * (1 << l);
+		olc::vi2d end = (begin + olc::vi2d(1 << l, 1 << l)).min(levels[0].size);
+		if (end.x <= min.x || end.y <= min.y || begin.x >= max.x || begin.y >= max.y) return;
+
+		const Stats& node = levels[l].nodes[y * levels[l].size.x + x];
+		if (node.count == 0) return;
+		if (l == 0 || (begin.x >= min.x && begin.y >= min.y && end.x <= max.x && end.y <= max.y)) {
+			Add(result, node);
+			return;
+		}
+
+		const Level& child = levels[l - 1];
+		for (int cy = y * 2; cy < std::min(y * 2 + 2, child.size.y); cy++) {
+			for (int cx = x * 2; cx < std::min(x * 2 + 2, child.size.x); cx++) Query(l - 1, cx, cy, min, max, result);
+		}
+	}
+};
@@ -0,0 +1,348 @@
+#pragma once
+
+#include "Headless.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cmath>
+
+// Many independent simulation runs, every combination of the varied parameters once per seed.
+// The description is a text file of lines like these, everything after a # is ignored:
+//   hours 24
+//   seeds 1-20                        (or a list: seeds 3 7 11)
+//   vary signalGreenTicks 100 200 400
+//   set maxPendingTrips 5000
+//   world 200
+//   worldSeed 69
+//   demand trips.txt
+//   report 900                        (simulated seconds between rows of every run's own CSV, 0 for none)
+//   model queues                      (every region as queues, like headless --queues. The default is detail, which
+//                                      keeps the junctions and traffic lights that signal timing studies are about)
+// set and vary take any name Simulation::SetParameter knows, and worldSeed
+struct SweepDescription {
+	struct Parameter {
+		std::string name;
+		std::vector<double> values;
+	};
+
+	double hours = 24.0;
+	std::vector<uint32_t> seeds = { 69 };
+	static constexpr size_t maxSeeds = 100000; // Far more runs per combination than any study needs
+	std::vector<Parameter> fixed; // One value each
+	std::vector<Parameter> varied;
+	int worldSize = 200;
+	std::string demandFile;
+	double reportSeconds = 0.0;
+	bool queuesOnly = false;
+
+	bool Load(const std::string& filename)
+	{
+		std::ifstream file(filename);
+		if (!file) {
+			printf("Error reading sweep: can't open %s\n", filename.c_str());
+			return false;
+		}
+
+		// Catches misspelt names and values out of range before hours of runs that would ignore or trip over them
+		JobSystem jobs(0);
+		Simulation check(jobs);
+
+		std::string line;
+		for (int lineNumber = 1; std::getline(file, line); lineNumber++) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream fields(line);
+			std::string key;
+			if (!(fields >> key)) continue;
+
+			bool valid = true;
+			std::string error;
+			if (key == "hours") valid = (bool)(fields >> hours) && hours > 0.0;
+			else if (key == "world") valid = (bool)(fields >> worldSize) && worldSize > 0;
+			else if (key == "demand") valid = (bool)(fields >> demandFile);
+			else if (key == "report") valid = (bool)(fields >> reportSeconds) && reportSeconds >= 0.0;
+			else if (key == "seeds") valid = ReadSeeds(fields, error);
+			else if (key == "model") {
+				std::string model;
+				valid = (bool)(fields >> model) && (model == "detail" || model == "queues");
+				queuesOnly = model == "queues";
+			}
+			else if (key == "set" || key == "vary" || key == "worldSeed") {
+				Parameter parameter;
+				if (key == "worldSeed") parameter.name = key;
+				else valid = (bool)(fields >> parameter.name);
+
+				double value;
+				while (fields >> value) parameter.values.push_back(value);
+				valid = valid && fields.eof() && !parameter.values.empty() && (key == "vary" || parameter.values.size() == 1);
+				for (double value : parameter.values) {
+					if (!error.empty()) break;
+					if (parameter.name != "worldSeed") error = check.ParameterError(parameter.name, value);
+					else if (!(value >= 0.0 && value <= UINT32_MAX && value == std::floor(value))) error = "worldSeed has to be a whole number from 0 to 4294967295";
+				}
+				(key == "vary" ? varied : fixed).push_back(parameter);
+			}
+			else valid = false;
+
+			if (valid && !error.empty()) {
+				printf("Error reading sweep: %s line %d: %s\n", filename.c_str(), lineNumber, error.c_str());
+				return false;
+			}
+			if (!valid) {
+				printf("Error reading sweep: %s line %d isn't valid\n", filename.c_str(), lineNumber);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	size_t RunCount() const
+	{
+		size_t count = seeds.size();
+		for (const Parameter& parameter : varied) count *= parameter.values.size();
+		return count;
+	}
+
+	// Value of every varied parameter for a run. Seeds change fastest, so the runs of one combination are next to each other
+	std::vector<double> VariedValues(size_t run) const
+	{
+		std::vector<double> values(varied.size());
+		size_t rest = run / seeds.size();
+		for (int i = (int)varied.size() - 1; i >= 0; i--) {
+			values[i] = varied[i].values[rest % varied[i].values.size()];
+			rest /= varied[i].values.size();
+		}
+		return values;
+	}
+
+	uint32_t Seed(size_t run) const { return seeds[run % seeds.size()]; }
+
+private:
+	// A list too long to ever finish running is an error rather than invalid, so the message can say why
+	bool ReadSeeds(std::istringstream& fields, std::string& error)
+	{
+		seeds.clear();
+		std::string item;
+		while (fields >> item) {
+			uint32_t first, last;
+			char dash;
+			std::istringstream range(item);
+			if (!(range >> first)) return false;
+			if (!(range >> dash >> last)) last = first;
+			else if (dash != '-' || last < first) return false;
+
+			if ((uint64_t)last - first + 1 > maxSeeds - seeds.size()) {
+				error = "seeds lists more than " + std::to_string(maxSeeds) + " seeds";
+				return true;
+			}
+			// Counting in 64 bits, the last seed can be the largest there is
+			for (uint64_t seed = first; seed <= last; seed++) seeds.push_back((uint32_t)seed);
+		}
+		return !seeds.empty();
+	}
+};
+
+struct SweepOptions {
+	std::string sweepFile;
+	std::string outDirectory = "sweep";
+	int parallelRuns = std::max(1, (int)std::thread::hardware_concurrency());
+
+	static bool Requested(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			if (strcmp(argv[i], "--sweep") == 0) return true;
+		}
+		return false;
+	}
+
+	bool Parse(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; i++) {
+			std::string option = argv[i];
+			if (option != "--sweep" && option != "--out" && option != "--parallel") {
+				printf("Error: unknown option %s\n", option.c_str());
+				PrintUsage();
+				return false;
+			}
+			if (i + 1 >= argc) {
+				printf("Error: %s needs a value\n", option.c_str());
+				return false;
+			}
+
+			const char* value = argv[++i];
+			if (option == "--sweep") sweepFile = value;
+			else if (option == "--out") outDirectory = value;
+			else if (option == "--parallel") parallelRuns = atoi(value);
+		}
+
+		if (parallelRuns < 1) {
+			printf("Error: --parallel has to be positive\n");
+			return false;
+		}
+		return true;
+	}
+
+	static void PrintUsage()
+	{
+		printf("Usage: Traffic --sweep sweep.txt [--out sweep] [--parallel N]\n");
+	}
+};
+
+// Runs are spread over as many threads as there are cores, one run per thread at a time, each with a job system
+// without workers of its own. Runs share nothing: every one builds its own world and simulation, which are gone
+// before it picks up the next, so memory use is bounded by the number of runs in flight rather than in the sweep.
+// A run's random numbers only depend on its seed, so every combination of parameters sees the same trips for
+// the same seed, and the results don't depend on which thread ran what
+class SweepRunner {
+
+private:
+	struct Result {
+		double wallSeconds = 0.0;
+		double simulatedSeconds = 0.0;
+		Simulation::TripStats trips;
+		double tripMinutes[3] = {}; // p50, p90, p99
+		size_t vehicles = 0;
+		size_t pendingTrips = 0;
+		bool failed = true;
+	};
+
+	const SweepDescription& sweep;
+	const SweepOptions& options;
+	std::vector<Result> results;
+	std::atomic<size_t> nextRun = 0;
+	std::mutex printMutex;
+
+public:
+	SweepRunner(const SweepDescription& sweep, const SweepOptions& options) : sweep(sweep), options(options) {}
+
+	// Returns the exit code for main
+	int Run()
+	{
+		std::error_code error;
+		std::filesystem::create_directories(options.outDirectory, error);
+		if (error) {
+			printf("Error: can't create %s\n", options.outDirectory.c_str());
+			return 1;
+		}
+
+		size_t runCount = sweep.RunCount();
+		int threadCount = (int)std::min<size_t>(options.parallelRuns, runCount);
+		printf("Running %zu runs of %.1f simulated hours, %d at a time\n", runCount, sweep.hours, threadCount);
+
+		results.assign(runCount, {});
+		std::vector<std::thread> threads;
+		for (int i = 0; i < threadCount; i++) {
+			threads.emplace_back([this, runCount] {
+				for (size_t run = nextRun++; run < runCount; run = nextRun++) RunOne(run);
+			});
+		}
+		for (std::thread& thread : threads) thread.join();
+
+		return WriteSummary() ? 0 : 1;
+	}
+
+private:
+	void RunOne(size_t run)
+	{
+		Result& result = results[run];
+		std::vector<double> values = sweep.VariedValues(run);
+
+		JobSystem jobs(0);
+		Simulation simulation(jobs, sweep.Seed(run));
+		// Sweeps run many simulations at once, so each keeps a smaller route cache than the interactive one
+		simulation.SetParameter("routeCacheCapacity", 20000);
+
+		WorldGenerator generator;
+		auto apply = [&](const std::string& name, double value) {
+			if (name == "worldSeed") generator.seed = (uint32_t)value;
+			else simulation.SetParameter(name, value);
+		};
+		for (const SweepDescription::Parameter& parameter : sweep.fixed) apply(parameter.name, parameter.values[0]);
+		for (size_t i = 0; i < values.size(); i++) apply(sweep.varied[i].name, values[i]);
+
+		olc::vi2d worldSize = { sweep.worldSize, sweep.worldSize };
+		{
+			// The tiles are only needed for the road mask
+			ChunkGrid chunks(worldSize);
+			std::vector<Tile> tiles((size_t)worldSize.x * worldSize.y);
+			generator.Generate(tiles.data(), chunks, jobs);
+			simulation.LoadRoads(RoadMask(tiles.data(), (int)tiles.size()), worldSize);
+		}
+		if (!sweep.demandFile.empty() && !simulation.LoadDemand(sweep.demandFile)) return;
+
+		if (sweep.queuesOnly) {
+			// A focus far outside the world leaves every region as queues
+			SimulationCommand command = { SimulationCommand::Type::SetFocus };
+			command.focusMin = command.focusMax = { -(1 << 20), -(1 << 20) };
+			simulation.Apply(command);
+		}
+
+		RunRecorder recorder;
+		if (sweep.reportSeconds > 0.0 && !recorder.Open(options.outDirectory + "/run_" + std::to_string(run) + ".csv")) return;
+
+		uint64_t totalTicks = (uint64_t)std::llround(sweep.hours * 3600.0 / simulation.tickLength);
+		uint64_t reportTicks = std::max<uint64_t>(1, (uint64_t)std::llround(sweep.reportSeconds / simulation.tickLength));
+
+		recorder.Start(simulation);
+		for (uint64_t t = 1; t <= totalTicks; t++) {
+			simulation.Tick();
+			if (t % reportTicks == 0 || t == totalTicks) recorder.Record(simulation);
+		}
+
+		result.wallSeconds = recorder.WallSeconds();
+		result.simulatedSeconds = simulation.SimulatedTime();
+		result.trips = simulation.GetTripStats();
+		const double quantiles[3] = { 0.5, 0.9, 0.99 };
+		for (int q = 0; q < 3; q++) result.tripMinutes[q] = simulation.TripTimes().Quantile(quantiles[q]) * simulation.tickLength / 60.0;
+		result.vehicles = simulation.VehicleCount();
+		result.pendingTrips = simulation.PendingTripCount();
+		result.failed = false;
+
+		std::lock_guard<std::mutex> lock(printMutex);
+		printf("Run %zu (seed %u", run, sweep.Seed(run));
+		for (size_t i = 0; i < values.size(); i++) printf(", %s %g", sweep.varied[i].name.c_str(), values[i]);
+		printf("): %llu trips completed in %.1f wall seconds\n", (unsigned long long)result.trips.completed, result.wallSeconds);
+	}
+
+	// One row per run, in run order
+	bool WriteSummary()
+	{
+		std::string filename = options.outDirectory + "/summary.csv";
+		FILE* file = fopen(filename.c_str(), "w");
+		if (!file) {
+			printf("Error: can't write %s\n", filename.c_str());
+			return false;
+		}
+
+		fprintf(file, "run,seed");
+		for (const SweepDescription::Parameter& parameter : sweep.varied) fprintf(file, ",%s", parameter.name.c_str());
+		fprintf(file, ",model,status,simulated_seconds,wall_seconds,trips_generated,trips_started,trips_completed,trips_abandoned,trips_dropped,mean_trip_minutes,trip_p50_minutes,trip_p90_minutes,trip_p99_minutes,vehicles_at_end,pending_trips_at_end\n");
+
+		bool allOk = true;
+		for (size_t run = 0; run < results.size(); run++) {
+			const Result& result = results[run];
+			const Simulation::TripStats& trips = result.trips;
+			allOk = allOk && !result.failed;
+
+			fprintf(file, "%zu,%u", run, sweep.Seed(run));
+			for (double value : sweep.VariedValues(run)) fprintf(file, ",%g", value);
+			fprintf(file, ",%s,%s,%.1f,%.3f,%llu,%llu,%llu,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%zu,%zu\n", sweep.queuesOnly ? "queues" : "detail", result.failed ? "failed" : "ok",
+				result.simulatedSeconds, result.wallSeconds,
+				(unsigned long long)trips.generated, (unsigned long long)trips.started, (unsigned long long)trips.completed,
+				(unsigned long long)trips.abandoned, (unsigned long long)trips.dropped,
+				trips.completed > 0 ? trips.travelSeconds / trips.completed / 60.0 : 0.0,
+				result.tripMinutes[0], result.tripMinutes[1], result.tripMinutes[2], result.vehicles, result.pendingTrips);
+		}
+		fclose(file);
+
+		printf("Summary in %s\n", filename.c_str());
+		return allOk;
+	}
+};
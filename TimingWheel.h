@@ -0,0 +1,195 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+// Handle to a scheduled event, only needed to cancel it. Stays safe to use after the event fired
+struct TimerHandle {
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+};
+
+// Hierarchical timing wheel: events scheduled for a tick, drained one tick at a time.
+// Level 0 has a slot for each of the next 256 ticks, level 1 one for every 256 ticks after that, and so on. Events
+// sit in the coarsest slot that fits and drop down a level whenever the wheel below comes round to them, so
+// scheduling and cancelling are O(1), and a tick with nothing due only costs a look at one empty slot.
+// Events live in a pool and are linked into their slot through indices, so nothing is allocated in the steady state.
+// Events due on the same tick are dispatched in the order they were scheduled
+template<typename T>
+class TimingWheel {
+
+private:
+	static constexpr int levelBits = 8;
+	static constexpr int levelCount = 4;
+	static constexpr int slotCount = 1 << levelBits;
+	static constexpr uint32_t slotMask = slotCount - 1;
+	static constexpr int overflowSlot = levelCount * slotCount; // Events too far away for the wheel to tell apart
+	static constexpr int dueSlot = -1; // Taken out of the wheel to be dispatched this tick
+	static constexpr int freeSlot = -2;
+
+	struct Event {
+		uint64_t tick;
+		uint64_t sequence; // Order of scheduling, to break ties between events on the same tick
+		uint32_t generation;
+		int slot;
+		int prev;
+		int next;
+		T payload;
+	};
+
+	std::vector<Event> pool;
+	std::vector<int> freeList;
+	std::vector<int> heads; // First event of every slot, -1 if empty
+	std::vector<std::pair<int, uint32_t>> due;
+
+	uint64_t now = 0; // Last tick drained
+	uint64_t nextSequence = 0;
+	size_t count = 0;
+
+public:
+	TimingWheel() : heads(overflowSlot + 1, -1) {}
+
+	uint64_t Now() const { return now; }
+	size_t Size() const { return count; }
+
+	// Events for the current tick or earlier, including ones scheduled while it is being drained, fire on the next one
+	TimerHandle Schedule(uint64_t tick, const T& payload)
+	{
+		int index;
+		if (!freeList.empty()) {
+			index = freeList.back();
+			freeList.pop_back();
+		}
+		else {
+			index = (int)pool.size();
+			pool.push_back({});
+		}
+
+		Event& event = pool[index];
+		event.tick = std::max(tick, now + 1);
+		event.sequence = nextSequence++;
+		event.payload = payload;
+		Link(index);
+		count++;
+		return { (uint32_t)index, event.generation };
+	}
+
+	// Returns false if the event already fired or was cancelled
+	bool Cancel(TimerHandle handle)
+	{
+		if (!IsPending(handle)) return false;
+		Event& event = pool[handle.index];
+		if (event.slot != dueSlot) Unlink(handle.index);
+		Free(handle.index);
+		return true;
+	}
+
+	bool IsPending(TimerHandle handle) const
+	{
+		return handle.index < pool.size() && pool[handle.index].generation == handle.generation && pool[handle.index].slot != freeSlot;
+	}
+
+	// Drains every tick up to and including the given one, calling dispatch(tick, payload) for each event that is due
+	template<typename F>
+	void Advance(uint64_t tick, F&& dispatch)
+	{
+		while (now < tick) {
+			now++;
+			Cascade();
+
+			int& head = heads[now & slotMask];
+			if (head < 0) continue;
+
+			due.clear();
+			for (int i = head; i >= 0; i = pool[i].next) {
+				pool[i].slot = dueSlot;
+				due.push_back({ i, pool[i].generation });
+			}
+			head = -1;
+
+			// Cascading mixes up the order events went into the slot in
+			std::sort(due.begin(), due.end(), [this](const auto& a, const auto& b) { return pool[a.first].sequence < pool[b.first].sequence; });
+
+			for (size_t k = 0; k < due.size(); k++) {
+				auto [index, generation] = due[k];
+				// An earlier event of this tick may have cancelled it
+				if (pool[index].generation != generation || pool[index].slot != dueSlot) continue;
+
+				T payload = pool[index].payload;
+				Free(index);
+				dispatch(now, payload);
+			}
+		}
+	}
+
+	// Cancels everything, old handles stay safe to use
+	void Clear()
+	{
+		for (int i = 0; i < (int)pool.size(); i++) {
+			if (pool[i].slot != freeSlot) Free(i);
+		}
+		std::fill(heads.begin(), heads.end(), -1);
+	}
+
+private:
+	// Moves the events of every slot that the lower levels have just come round to down to where they belong now,
+	// coarsest first so they can keep falling through to the levels below
+	void Cascade()
+	{
+		for (int level = levelCount - 1; level >= 1; level--) {
+			if ((now & ((1ull << (level * levelBits)) - 1)) != 0) continue;
+
+			// Once the whole wheel has come round, the overflow may hold events that fit into it again
+			if (level == levelCount - 1 && ((now >> (level * levelBits)) & slotMask) == 0) Relink(overflowSlot);
+			Relink(level * slotCount + (int)((now >> (level * levelBits)) & slotMask));
+		}
+	}
+
+	void Relink(int slot)
+	{
+		int i = heads[slot];
+		heads[slot] = -1;
+		while (i >= 0) {
+			int next = pool[i].next;
+			Link(i);
+			i = next;
+		}
+	}
+
+	void Link(int index)
+	{
+		Event& event = pool[index];
+		uint64_t delta = event.tick - now;
+
+		int slot = overflowSlot;
+		for (int level = 0; level < levelCount; level++) {
+			if (delta < (1ull << ((level + 1) * levelBits))) {
+				slot = level * slotCount + (int)((event.tick >> (level * levelBits)) & slotMask);
+				break;
+			}
+		}
+
+		event.slot = slot;
+		event.prev = -1;
+		event.next = heads[slot];
+		if (heads[slot] >= 0) pool[heads[slot]].prev = index;
+		heads[slot] = index;
+	}
+
+	void Unlink(int index)
+	{
+		Event& event = pool[index];
+		if (event.prev >= 0) pool[event.prev].next = event.next;
+		else heads[event.slot] = event.next;
+		if (event.next >= 0) pool[event.next].prev = event.prev;
+	}
+
+	void Free(int index)
+	{
+		pool[index].slot = freeSlot;
+		pool[index].generation++;
+		freeList.push_back(index);
+		count--;
+	}
+};
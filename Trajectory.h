@@ -0,0 +1,447 @@
+#pragma once
+
+#include "Simulation.h"
+#include "SpscQueue.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// Vehicle position in a recorded frame, in 1/positionScale of a tile
+struct TrajectoryVehicle {
+	uint32_t id;
+	int32_t x;
+	int32_t y;
+};
+
+// Recorded vehicle trajectories. A file is a header, then blocks of a fixed number of frames, then an index with
+// the offset of every block, then a footer saying where the index is:
+//   FileHeader | BlockHeader, compressed frames | ... | uint64_t offset per block | Footer
+// Every block starts from scratch, so any block can be decoded on its own, and since frames are a fixed number of
+// ticks apart the block holding a tick is found with a division rather than a search
+struct TrajectoryFormat {
+	static constexpr uint32_t fileMagic = 0x314a5254; // "TRJ1"
+	static constexpr uint32_t footerMagic = 0x58444954; // "TIDX"
+	static constexpr uint32_t version = 1;
+	static constexpr float positionScale = 256.0f;
+	// Largest decoded block a reader accepts, so a damaged size can't ask for more memory than a real block ever needs
+	static constexpr uint32_t maxRawBlockSize = 1u << 28;
+
+	struct FileHeader {
+		uint32_t magic;
+		uint32_t version;
+		float tickLength; // Simulated seconds per tick
+		float positionScale;
+		uint32_t framesPerBlock;
+		uint32_t tickInterval; // Ticks between frames
+		uint64_t firstTick;
+	};
+
+	struct BlockHeader {
+		uint32_t rawSize;
+		uint32_t compressedSize;
+		uint64_t firstTick;
+		uint32_t frameCount;
+		uint32_t reserved;
+	};
+
+	struct Footer {
+		uint64_t indexOffset;
+		uint32_t blockCount;
+		uint32_t magic;
+	};
+};
+
+// Byte oriented LZ77 in the style of LZ4: a token with the length of a run of literals and of the match after it,
+// the literals, and a 16 bit offset back to the match. Fast enough to keep up with the simulation on one thread
+class Lz {
+
+private:
+	static constexpr int minMatch = 4;
+	static constexpr int hashBits = 14;
+	static constexpr size_t maxOffset = 65535;
+
+public:
+	static void Compress(const uint8_t* in, size_t size, std::vector<uint8_t>& out)
+	{
+		std::vector<int64_t> table(1 << hashBits, -1);
+		size_t literalStart = 0;
+		size_t pos = 0;
+
+		while (pos + minMatch <= size) {
+			uint32_t sequence;
+			memcpy(&sequence, in + pos, sizeof(sequence));
+			uint32_t hash = (sequence * 2654435761u) >> (32 - hashBits);
+			int64_t candidate = table[hash];
+			table[hash] = (int64_t)pos;
+
+			if (candidate < 0 || pos - candidate > maxOffset || memcmp(in + candidate, in + pos, minMatch) != 0) {
+				pos++;
+				continue;
+			}
+
+			size_t length = minMatch;
+			while (pos + length < size && in[candidate + length] == in[pos + length]) length++;
+
+			WriteSequence(in + literalStart, pos - literalStart, (uint16_t)(pos - candidate), length, out);
+			pos += length;
+			literalStart = pos;
+		}
+
+		// The last sequence is literals only
+		WriteSequence(in + literalStart, size - literalStart, 0, 0, out);
+	}
+
+	// False if the data is corrupt or doesn't come to exactly size bytes
+	static bool Decompress(const uint8_t* in, size_t inSize, uint8_t* out, size_t size)
+	{
+		const uint8_t* end = in + inSize;
+		size_t pos = 0;
+
+		while (in < end) {
+			uint8_t token = *in++;
+
+			size_t literals = token >> 4;
+			if (literals == 15 && !ReadLength(in, end, literals)) return false;
+			if ((size_t)(end - in) < literals || size - pos < literals) return false;
+			memcpy(out + pos, in, literals);
+			in += literals;
+			pos += literals;
+
+			if (in == end) break;
+
+			if (end - in < 2) return false;
+			size_t offset = in[0] | (in[1] << 8);
+			in += 2;
+			size_t length = token & 15;
+			if (length == 15 && !ReadLength(in, end, length)) return false;
+			length += minMatch;
+
+			if (offset == 0 || offset > pos || size - pos < length) return false;
+			// Matches can overlap what they produce, so copy a byte at a time
+			for (size_t i = 0; i < length; i++, pos++) out[pos] = out[pos - offset];
+		}
+		return pos == size;
+	}
+
+private:
+	static void WriteSequence(const uint8_t* literals, size_t literalCount, uint16_t offset, size_t matchLength, std::vector<uint8_t>& out)
+	{
+		size_t matchCode = matchLength > 0 ? matchLength - minMatch : 0;
+		out.push_back((uint8_t)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+		if (literalCount >= 15) WriteLength(literalCount - 15, out);
+		out.insert(out.end(), literals, literals + literalCount);
+
+		if (matchLength == 0) return;
+		out.push_back((uint8_t)offset);
+		out.push_back((uint8_t)(offset >> 8));
+		if (matchCode >= 15) WriteLength(matchCode - 15, out);
+	}
+
+	static void WriteLength(size_t length, std::vector<uint8_t>& out)
+	{
+		for (; length >= 255; length -= 255) out.push_back(255);
+		out.push_back((uint8_t)length);
+	}
+
+	static bool ReadLength(const uint8_t*& in, const uint8_t* end, size_t& length)
+	{
+		uint8_t byte;
+		do {
+			if (in == end) return false;
+			byte = *in++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+};
+
+// Turns frames into bytes and back. A frame is written a column at a time: the gaps between the ids of its vehicles
+// in id order, then their x and then their y as the difference from where they would be if they kept the step they
+// made last frame, all zigzag encoded into varints. Vehicles driving along a straight road come out as zeros, and
+// the set of vehicles hardly changes from frame to frame, so the columns are mostly long runs that the LZ stage
+// packs away. The encoder and the decoder keep the same track state, which starts empty at the start of every block
+class TrajectoryCodec {
+
+private:
+	struct Track {
+		uint32_t id;
+		int32_t x, y;
+		int32_t stepX, stepY;
+	};
+
+	std::vector<Track> tracks;
+	std::vector<Track> nextTracks;
+	std::vector<uint8_t> known; // Per vehicle of the frame: was it in the previous one
+
+public:
+	void Reset() { tracks.clear(); }
+
+	void EncodeFrame(uint64_t tickDelta, const std::vector<TrajectoryVehicle>& vehicles, std::vector<uint8_t>& out)
+	{
+		WriteVarint(tickDelta, out);
+		WriteVarint(vehicles.size(), out);
+
+		int64_t previousId = -1;
+		for (const TrajectoryVehicle& v : vehicles) {
+			WriteVarint(v.id - previousId - 1, out);
+			previousId = v.id;
+		}
+
+		MatchTracks(vehicles);
+		for (size_t i = 0; i < vehicles.size(); i++) WriteVarint(ZigZag((int64_t)vehicles[i].x - nextTracks[i].x - nextTracks[i].stepX), out);
+		for (size_t i = 0; i < vehicles.size(); i++) WriteVarint(ZigZag((int64_t)vehicles[i].y - nextTracks[i].y - nextTracks[i].stepY), out);
+		AdvanceTracks(vehicles);
+	}
+
+	// False if the data runs out or doesn't make sense
+	bool DecodeFrame(const uint8_t*& in, const uint8_t* end, uint64_t& tickDelta, std::vector<TrajectoryVehicle>& vehicles)
+	{
+		uint64_t count;
+		if (!ReadVarint(in, end, tickDelta) || !ReadVarint(in, end, count) || count > (uint64_t)(end - in)) return false;
+
+		vehicles.resize(count);
+		int64_t previousId = -1;
+		for (TrajectoryVehicle& v : vehicles) {
+			uint64_t gap;
+			if (!ReadVarint(in, end, gap)) return false;
+			v.id = (uint32_t)(previousId + 1 + gap);
+			previousId = v.id;
+		}
+
+		MatchTracks(vehicles);
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			uint64_t residual;
+			if (!ReadVarint(in, end, residual)) return false;
+			vehicles[i].x = (int32_t)((int64_t)nextTracks[i].x + nextTracks[i].stepX + UnZigZag(residual));
+		}
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			uint64_t residual;
+			if (!ReadVarint(in, end, residual)) return false;
+			vehicles[i].y = (int32_t)((int64_t)nextTracks[i].y + nextTracks[i].stepY + UnZigZag(residual));
+		}
+		AdvanceTracks(vehicles);
+		return true;
+	}
+
+private:
+	// Lines the tracks of the previous frame up with the vehicles of this one, by walking both in id order.
+	// Vehicles that weren't in it are predicted at the origin, so their first position is written out in full
+	void MatchTracks(const std::vector<TrajectoryVehicle>& vehicles)
+	{
+		nextTracks.resize(vehicles.size());
+		known.resize(vehicles.size());
+		size_t k = 0;
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			uint32_t id = vehicles[i].id;
+			while (k < tracks.size() && tracks[k].id < id) k++;
+			known[i] = k < tracks.size() && tracks[k].id == id;
+			nextTracks[i] = known[i] ? tracks[k] : Track{ id, 0, 0, 0, 0 };
+		}
+	}
+
+	void AdvanceTracks(const std::vector<TrajectoryVehicle>& vehicles)
+	{
+		for (size_t i = 0; i < vehicles.size(); i++) {
+			Track& track = nextTracks[i];
+			track.stepX = known[i] ? vehicles[i].x - track.x : 0;
+			track.stepY = known[i] ? vehicles[i].y - track.y : 0;
+			track.x = vehicles[i].x;
+			track.y = vehicles[i].y;
+		}
+		tracks.swap(nextTracks);
+	}
+
+	static uint64_t ZigZag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+	static int64_t UnZigZag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+	static void WriteVarint(uint64_t value, std::vector<uint8_t>& out)
+	{
+		while (value >= 0x80) {
+			out.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t)value);
+	}
+
+	static bool ReadVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (in == end) return false;
+			uint8_t byte = *in++;
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+};
+
+// Records snapshots to a trajectory file. Record only copies the positions into a slot of a lock-free queue, which
+// is cheap enough to do on the simulation thread every tick. Encoding, compressing and writing happen on a
+// thread of the recorder's own. If that thread ever falls a whole queue behind, Record waits for it rather than
+// leave holes in the recording
+class TrajectoryRecorder {
+
+public:
+	struct Stats {
+		uint64_t frames;
+		uint64_t vehicleStates;
+		uint64_t bytesWritten;
+		uint64_t stalls; // Times Record had to wait for the writer
+	};
+
+	uint32_t tickInterval = 1; // Record every this many ticks
+	uint32_t framesPerBlock = 64;
+
+private:
+	struct Frame {
+		uint64_t tick;
+		std::vector<TrajectoryVehicle> vehicles;
+	};
+
+	FILE* file = nullptr;
+	TrajectoryFormat::FileHeader header = {};
+	SpscQueue<Frame> queue{ 64 };
+	std::thread writer;
+	std::atomic<bool> closing = false;
+
+	// Writer thread only
+	TrajectoryCodec codec;
+	std::vector<uint8_t> raw;
+	std::vector<uint8_t> compressed;
+	std::vector<uint64_t> blockOffsets;
+	TrajectoryFormat::BlockHeader block = {};
+	uint64_t lastTick = 0;
+	bool started = false;
+
+	std::atomic<uint64_t> frames = 0;
+	std::atomic<uint64_t> vehicleStates = 0;
+	std::atomic<uint64_t> bytesWritten = 0;
+	std::atomic<uint64_t> stalls = 0;
+
+public:
+	~TrajectoryRecorder() { Close(); }
+
+	bool Open(const std::string& filename, float tickLength)
+	{
+		file = fopen(filename.c_str(), "wb");
+		if (!file) {
+			printf("Error: can't write %s\n", filename.c_str());
+			return false;
+		}
+
+		header = { TrajectoryFormat::fileMagic, TrajectoryFormat::version, tickLength, TrajectoryFormat::positionScale, framesPerBlock, tickInterval, 0 };
+		// Written again once the first tick is known
+		fwrite(&header, sizeof(header), 1, file);
+		bytesWritten = sizeof(header);
+
+		closing = false;
+		writer = std::thread(&TrajectoryRecorder::WriterLoop, this);
+		return true;
+	}
+
+	bool IsOpen() const { return file != nullptr; }
+
+	// Call from the thread running the simulation, after every tick
+	void Record(const SimulationSnapshot& snapshot)
+	{
+		if (!file || snapshot.tick % tickInterval != 0) return;
+
+		Frame* frame;
+		while (!(frame = queue.BeginPush())) {
+			stalls++;
+			std::this_thread::yield();
+		}
+
+		frame->tick = snapshot.tick;
+		frame->vehicles.resize(snapshot.vehicles.size());
+		for (size_t i = 0; i < snapshot.vehicles.size(); i++) {
+			const SimulationSnapshot::VehicleState& v = snapshot.vehicles[i];
+			frame->vehicles[i] = { v.id, (int32_t)std::lround(v.pos.x * TrajectoryFormat::positionScale), (int32_t)std::lround(v.pos.y * TrajectoryFormat::positionScale) };
+		}
+		queue.Push();
+	}
+
+	// Writes whatever is still queued, the index and the footer
+	void Close()
+	{
+		if (!file) return;
+		closing = true;
+		writer.join();
+
+		FlushBlock();
+
+		TrajectoryFormat::Footer footer = { bytesWritten.load(), (uint32_t)blockOffsets.size(), TrajectoryFormat::footerMagic };
+		fwrite(blockOffsets.data(), sizeof(uint64_t), blockOffsets.size(), file);
+		fwrite(&footer, sizeof(footer), 1, file);
+		bytesWritten += blockOffsets.size() * sizeof(uint64_t) + sizeof(footer);
+
+		fseek(file, 0, SEEK_SET);
+		fwrite(&header, sizeof(header), 1, file);
+		fclose(file);
+		file = nullptr;
+	}
+
+	Stats GetStats() const { return { frames, vehicleStates, bytesWritten, stalls }; }
+
+private:
+	void WriterLoop()
+	{
+		while (true) {
+			Frame* frame = queue.Front();
+			if (!frame) {
+				if (closing && queue.Empty()) return;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			Encode(*frame);
+			queue.Pop();
+		}
+	}
+
+	void Encode(const Frame& frame)
+	{
+		if (!started) {
+			started = true;
+			header.firstTick = frame.tick;
+		}
+
+		if (block.frameCount == 0) {
+			codec.Reset();
+			raw.clear();
+			block.firstTick = frame.tick;
+			lastTick = frame.tick;
+		}
+
+		codec.EncodeFrame(frame.tick - lastTick, frame.vehicles, raw);
+		lastTick = frame.tick;
+		block.frameCount++;
+		frames++;
+		vehicleStates += frame.vehicles.size();
+
+		if (block.frameCount == framesPerBlock) FlushBlock();
+	}
+
+	void FlushBlock()
+	{
+		if (block.frameCount == 0) return;
+
+		compressed.clear();
+		Lz::Compress(raw.data(), raw.size(), compressed);
+		block.rawSize = (uint32_t)raw.size();
+		block.compressedSize = (uint32_t)compressed.size();
+
+		blockOffsets.push_back(bytesWritten.load()); // Rather than ftell, which is 32 bits on Windows
+		fwrite(&block, sizeof(block), 1, file);
+		fwrite(compressed.data(), 1, compressed.size(), file);
+		bytesWritten += sizeof(block) + compressed.size();
+		block = {};
+	}
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "olcPixelGameEngine.h"
+#include "JobSystem.h"
+
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+struct Tile {
+	int ground;
+	int overlay;
+	int height;
+};
+
+// Roads have no sprite of their own yet, they are drawn as a darkened stone block
+constexpr int roadGround = 4;
+
+// Cells that vehicles can drive on, what the simulation is built from
+inline std::vector<uint8_t> RoadMask(const Tile* tiles, int count)
+{
+	std::vector<uint8_t> mask(count);
+	for (int i = 0; i < count; i++) mask[i] = tiles[i].ground == roadGround;
+	return mask;
+}
+
+// Splits the tile grid into square chunks, the unit of work for generation, drawing and simulation regions
+struct ChunkGrid {
+	olc::vi2d vWorldSize;
+	olc::vi2d vChunkSize;
+	olc::vi2d vChunkCount;
+
+	ChunkGrid(olc::vi2d worldSize = { 0, 0 }, olc::vi2d chunkSize = { 16, 16 })
+		: vWorldSize(worldSize), vChunkSize(chunkSize),
+		vChunkCount((worldSize.x + chunkSize.x - 1) / chunkSize.x, (worldSize.y + chunkSize.y - 1) / chunkSize.y)
+	{
+	}
+
+	int ChunkCount() const { return vChunkCount.x * vChunkCount.y; }
+
+	int ChunkOfCell(olc::vi2d cell) const { return (cell.y / vChunkSize.y) * vChunkCount.x + cell.x / vChunkSize.x; }
+	int ChunkOfCell(int cell) const { return ChunkOfCell({ cell % vWorldSize.x, cell / vWorldSize.x }); }
+
+	// First cell of the chunk, and one past its last cell, clipped to the world
+	olc::vi2d ChunkBegin(int chunk) const { return { (chunk % vChunkCount.x) * vChunkSize.x, (chunk / vChunkCount.x) * vChunkSize.y }; }
+	olc::vi2d ChunkEnd(int chunk) const { return (ChunkBegin(chunk) + vChunkSize).min(vWorldSize); }
+};
+
+class WorldGenerator {
+
+public:
+	// 0 = Normal (randomized terrain)
+	// 1 = Stripes (good for testing sprite size/accuracy)
+	// 2 = funky math generation
+	int generationMode = 0;
+	uint32_t seed = 69;
+	int roadSpacing = 10;
+
+public:
+	// Chunks are generated in parallel, each from its own random stream,
+	// so the world only depends on the seed and not on how the work was split up
+	void Generate(Tile* tiles, const ChunkGrid& chunks, JobSystem& jobs) const
+	{
+		jobs.ParallelFor(0, chunks.ChunkCount(), 1, [&](int chunkBegin, int chunkEnd) {
+			for (int chunk = chunkBegin; chunk < chunkEnd; chunk++) {
+				GenerateChunk(tiles, chunks, chunk);
+			}
+		});
+	}
+
+	void GenerateChunk(Tile* tiles, const ChunkGrid& chunks, int chunk) const
+	{
+		std::seed_seq seedSequence = { seed, (uint32_t)chunk };
+		std::mt19937 rng(seedSequence);
+
+		const olc::vi2d vWorldSize = chunks.vWorldSize;
+		olc::vi2d begin = chunks.ChunkBegin(chunk);
+		olc::vi2d end = chunks.ChunkEnd(chunk);
+
+		for (int y = begin.y; y < end.y; y++) {
+			for (int x = begin.x; x < end.x; x++) {
+				int i = y * vWorldSize.x + x;
+				tiles[i] = {};
+
+				if (generationMode == 0) {
+					// Lay a grid of roads over the terrain so there is something to drive on
+					if (x % roadSpacing == 0 || y % roadSpacing == 0) {
+						tiles[i] = { roadGround, 0, 0 };
+						continue;
+					}
+
+					tiles[i].ground = (rng() % 2) + 1;
+					if (tiles[i].ground == 1) {
+						if (rng() % 10 != 1) continue;
+						tiles[i].overlay = 1;
+					}
+					tiles[i].height = (int)(rng() % 3) - 1;
+				}
+				else if (generationMode == 1) {
+					tiles[i].ground = i % 3 + 1;
+					tiles[i].overlay = 0;
+					tiles[i].height = 0;
+				}
+				else if (generationMode == 2) {
+					tiles[i].overlay = 0;
+					int nx = x - (vWorldSize.x / 2);
+					int ny = y - (vWorldSize.y / 2);
+					// pringle shaped terrain
+					tiles[i].height = (nx * nx - ny * ny) / 128;
+					const int layerCount = 13;
+					// Tile type based on distance from the centre and height
+					tiles[i].ground = ((int)(sqrtf(nx * nx + ny * ny) / ((float)vWorldSize.x) * layerCount * 2) + (abs(tiles[i].height) / 8)) % 3 + 1;
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "RoadNetwork.h"
+#include "World.h"
+
+#include <vector>
+#include <climits>
+
+// Traffic analysis zones, the unit that demand is generated and travel times are reported in.
+// There is one for every world chunk with roads, with the road tile closest to the middle of the chunk standing in for it
+struct Zones {
+	std::vector<int> zoneNode; // Road node that routes to and from the zone start and end at
+	std::vector<int> zoneChunk;
+	std::vector<int> chunkZone; // -1 if the chunk has no roads
+	std::vector<int> nodeZone;
+
+	void Build(const RoadNetwork& roads, const ChunkGrid& chunks)
+	{
+		zoneNode.clear();
+		zoneChunk.clear();
+		chunkZone.assign(chunks.ChunkCount(), -1);
+		nodeZone.assign(roads.NodeCount(), -1);
+
+		std::vector<int> bestNode(chunks.ChunkCount(), -1);
+		std::vector<int> bestDistance(chunks.ChunkCount(), INT_MAX);
+
+		for (int node = 0; node < roads.NodeCount(); node++) {
+			olc::vi2d cell = roads.CellPos(node);
+			int chunk = chunks.ChunkOfCell(cell);
+			olc::vi2d centre = (chunks.ChunkBegin(chunk) + chunks.ChunkEnd(chunk)) / 2;
+
+			int distance = std::abs(cell.x - centre.x) + std::abs(cell.y - centre.y);
+			if (distance < bestDistance[chunk]) {
+				bestDistance[chunk] = distance;
+				bestNode[chunk] = node;
+			}
+		}
+
+		for (int chunk = 0; chunk < chunks.ChunkCount(); chunk++) {
+			if (bestNode[chunk] < 0) continue;
+			chunkZone[chunk] = (int)zoneNode.size();
+			zoneNode.push_back(bestNode[chunk]);
+			zoneChunk.push_back(chunk);
+		}
+
+		for (int node = 0; node < roads.NodeCount(); node++) {
+			nodeZone[node] = chunkZone[chunks.ChunkOfCell(roads.CellPos(node))];
+		}
+	}
+
+	int Count() const { return (int)zoneNode.size(); }
+};
@@ -2,6 +2,19 @@
 #include "olcPixelGameEngine.h"
 #define OLC_PGEX_TRANSFORMEDVIEW
 #include "olcPGEX_TransformedView.h"
+#include "Simulation.h"
+#include "World.h"
+#include "Headless.h"
+#include "Sweep.h"
+#include "Replay.h"
+#include "Trajectory.h"
+#include "Playback.h"
+#include "Heatmap.h"
+#include "AreaStats.h"
+#include "Isochrone.h"
+#include "SpatialHash.h"
+#include "BatchGeometry.h"
+#include "SpatialBenchmark.h"
 
 #include <math.h>
 #include <format>
@@ -107,7 +120,7 @@ public:
 		};
 	}
 
-	void RenderSpriteIsometric(olc::TransformedView& tv, olc::vi2d cellPos, int tileRow, int tileCol, olc::vi2d screenSpaceOffset)
+	void RenderSpriteIsometric(olc::TransformedView& tv, olc::vi2d cellPos, int tileRow, int tileCol, olc::vi2d screenSpaceOffset, olc::Pixel tint = olc::WHITE)
 	{
 		auto WorldToScreen = [&](olc::vf2d worldPos) {
 
@@ -124,10 +137,10 @@ public:
 
 		olc::vf2d screenPos = WorldToScreen(cellPos) + screenSpaceOffset;
 
-		RenderSprite(tv, screenPos, tileRow, tileCol, olc::vf2d(1.0f, 1.0f));
+		RenderSprite(tv, screenPos, tileRow, tileCol, olc::vf2d(1.0f, 1.0f), tint);
 	}
 
-	void RenderSprite(olc::TransformedView& tv, olc::vf2d screenPos, int tileRow, int tileCol, olc::vf2d size) {
+	void RenderSprite(olc::TransformedView& tv, olc::vf2d screenPos, int tileRow, int tileCol, olc::vf2d size, olc::Pixel tint = olc::WHITE) {
 		SpriteSheetRow& row = rows[tileRow];
 
 		SpriteSheetPos spriteSheetPos = GetSpriteSheetPos(tileRow, tileCol);
@@ -143,7 +156,8 @@ public:
 				screenPos, spriteSheetDecal,
 				spriteSheetPos.pos,
 				spriteSheetPos.size,
-				size);
+				size,
+				tint);
 		}
 	}
 	
@@ -170,13 +184,9 @@ public:
 	// TODO: convert to enums
 	int renderMode = 0; // 0 = Isometreic
 	int editMode = 1; // 0 = Terrain height, 1 = Tile/overlay type
-
-public:
-	struct Tile {
-		int ground;
-		int overlay;
-		int height;
-	};
+	std::string replayFile; // Where to save a replay of the session on exit, none if empty
+	std::string trajectoryFile; // Where to record vehicle trajectories, none if empty
+	std::string playbackFile; // Trajectories to play back instead of simulating, none if empty
 
 private:
 	Tile* pWorldTiles = nullptr;
@@ -184,56 +194,106 @@ private:
 	int currentTile = 0;
 	int currentOverlay = 0;
 
+	JobSystem jobs;
+	Simulation simulation{ jobs };
+	SimulationRunner* simulationRunner = nullptr;
+	ReplayLog replay;
+	TrajectoryRecorder trajectory;
+	TrajectoryPlayer player;
+	bool playingBack = false;
+	bool scrubbing = false; // Dragging on the timeline
+	TrafficHeatmap heatmap;
+	IsochroneOverlay isochrone;
+	SpatialHash vehicleGrid; // Vehicles of the latest snapshot, for finding the one under the cursor
+	double vehicleGridTime = -1.0;
+	RectArray vehicleBoxes; // Where every vehicle of the frame is drawn, for culling the ones off screen and picking
+	std::vector<olc::Pixel> vehicleColours;
+	std::vector<uint64_t> vehicleOnScreen;
+	std::vector<uint64_t> vehicleUnderCursor;
+
+	// Sprites of one chunk in the order they have to be drawn, only rebuilt when a tile in the chunk changes
+	struct ChunkDrawCache {
+		struct Item {
+			olc::vf2d screenPos;
+			int cell;
+			int tileRow;
+			int tileCol;
+			olc::Pixel tint;
+			bool isGround;
+		};
+
+		std::vector<Item> items;
+		olc::vf2d vBoundsMin;
+		olc::vf2d vBoundsMax;
+		bool dirty = true;
+	};
+
+	ChunkGrid chunks;
+	std::vector<ChunkDrawCache> chunkDrawCaches;
+	AreaStats areaStats; // Roads, trees, water and height over any rectangle of tiles
+
+	// Cells on screen, last sent to the simulation as the area to simulate in full detail
+	olc::vi2d vFocusMin = { -1, -1 };
+	olc::vi2d vFocusMax = { -1, -1 };
+
 public:
 	olc::vi2d vWorldSize = { 200, 200 };
 	olc::vi2d vTileSize = { 36, 18 };
 
+	const olc::Pixel roadTint = olc::Pixel(80, 80, 90);
+
 
 	bool OnUserCreate() override
 	{
+		chunks = ChunkGrid(vWorldSize);
 		pWorldTiles = new Tile[vWorldSize.x * vWorldSize.y]{};
 
-		srand(69);
-
-		// 0 = Normal (randomized terrain)
-		// 1 = Stripes (good for testing sprite size/accuracy)
-		// 2 = funky math generation
-		const int generationMode = 0;
-
-		for (int y = 0, i = 0; y < vWorldSize.y; y++) {
-			for (int x = 0; x < vWorldSize.x; x++, i++) {
-				if (generationMode == 0) {
-					pWorldTiles[i].ground = (rand() % 2) + 1;
-					if (pWorldTiles[i].ground == 1) {
-						if (rand() % 10 != 1) continue;
-						pWorldTiles[i].overlay = 1;
-					}
-					pWorldTiles[i].height = (rand() % 3) - 1;
-				}
-				else if (generationMode == 1) {
-					pWorldTiles[i].ground = i % 3 + 1;
-					pWorldTiles[i].overlay = 0;
-					pWorldTiles[i].height = 0;
-				}
-				else if (generationMode == 2) {
-					pWorldTiles[i].overlay = 0;
-					int nx = x - (vWorldSize.x/2);
-					int ny = y - (vWorldSize.y/2);
-					// pringle shaped terrain
-					pWorldTiles[i].height = (nx * nx - ny * ny) / 128; 
-					const int layerCount = 13;
-					// Tile type based on distance from the centre and height
-					pWorldTiles[i].ground =  ((int)(sqrtf(nx * nx + ny * ny) / ((float)vWorldSize.x) * layerCount * 2) + (abs(pWorldTiles[i].height) / 8)) % 3 + 1;
-				}
+		WorldGenerator generator;
+		generator.Generate(pWorldTiles, chunks, jobs);
+
+		chunkDrawCaches.resize(chunks.ChunkCount());
+		areaStats.Build(pWorldTiles, chunks);
+
+		renderer = new Renderer(vTileSize.x, vTileSize.y, "assets/spritesheet.png");
+
+		simulation.LoadRoads(RoadMask(pWorldTiles, vWorldSize.x * vWorldSize.y), vWorldSize);
+		// A recording is shown as it was, so nothing is simulated while playing one back
+		playingBack = !playbackFile.empty() && player.Open(playbackFile);
+		if (!playingBack) {
+			if (!replayFile.empty()) replay.Begin(simulation, vWorldSize, generator.seed, "");
+			simulationRunner = new SimulationRunner(simulation);
+			if (!trajectoryFile.empty() && trajectory.Open(trajectoryFile, simulation.tickLength)) {
+				simulationRunner->onPublish = [this](const SimulationSnapshot& snapshot) { trajectory.Record(snapshot); };
 			}
+			simulationRunner->Start();
 		}
 
-		renderer = new Renderer(vTileSize.x, vTileSize.y, "assets/spritesheet.png");
+		heatmap.Resize(vWorldSize);
+		heatmap.freeFlowSpeed = simulation.freeFlowSpeed;
+		isochrone.Resize(vWorldSize);
+		vehicleGrid.Resize({ 0.0f, 0.0f }, vWorldSize);
 
 		isometricTV.Initialise({ScreenWidth(), ScreenHeight()});
 		return true;
 	}
 
+	bool OnUserDestroy() override
+	{
+		// The simulation thread has to be stopped before the simulation it runs goes away
+		delete simulationRunner;
+		simulationRunner = nullptr;
+
+		if (!replayFile.empty() && !playingBack) {
+			replay.Finish(simulation);
+			replay.Save(replayFile);
+		}
+		trajectory.Close();
+		player.Close();
+		heatmap.Release();
+		isochrone.Release();
+		return true;
+	}
+
 	olc::vf2d WorldToScreen(float x, float y) {
 
 		olc::vf2d screenSpaceCoordinate = {
@@ -281,6 +341,7 @@ public:
 			isometricTV.HandlePanAndZoom(2, 0.0f, true, false);
 			// Handle zoom
 			HandleMultiplicativeZoom(isometricTV, 1.41421356237f); // sqrt(2), so every second zoom level is an exact power of 2
+			UpdateSimulationFocus();
 			
 			// Use mouse position to determine sleected cell and related info
 			olc::vi2d vMouseScreen = isometricTV.ScreenToWorld(GetMousePos()); // Mouse pos in screen space
@@ -294,16 +355,44 @@ public:
 
 			// Toggle UI on H
 			if (GetKey(olc::Key::H).bPressed) renderUI = !renderUI;
+			// Cycle the traffic overlay on O
+			if (GetKey(olc::Key::O).bPressed) heatmap.NextMode();
+			// Show what can be reached from the cursor on I, page up and down change how far
+			if (GetKey(olc::Key::I).bPressed) isochrone.enabled = !isochrone.enabled;
+			if (GetKey(olc::Key::PGUP).bPressed) isochrone.limitSeconds = std::min(isochrone.limitSeconds * 2.0f, 3840.0f);
+			if (GetKey(olc::Key::PGDN).bPressed) isochrone.limitSeconds = std::max(isochrone.limitSeconds * 0.5f, 15.0f);
 
 			if (editMode == 0) {
 				HandleTerraingHeightEdit(vSelectedCell);
 				renderUI = false;
 			}
+			else if (playingBack) {
+				// Edits would no longer match what was recorded
+				HandlePlaybackControls(fElapsedTime);
+			}
 			else if (editMode == 1) {
 				HandleTileTypeAndOverlayEdit(vSelectedCell);
 			}
 
-			RenderIsometricWorld(vSelectedCell);
+			RenderIsometricWorld(vSelectedCell, vMouseWorld);
+			if (playingBack) RenderPlaybackTimeline();
+			if (heatmap.mode != TrafficHeatmap::Mode::Off) {
+				float vehiclesOnScreen, meanSpeed;
+				heatmap.VisibleTraffic(vehiclesOnScreen, meanSpeed);
+				char text[128];
+				snprintf(text, sizeof(text), "Overlay: %s (O to change)  %.0f vehicles on screen at %.2f tiles/s", heatmap.ModeName(), vehiclesOnScreen, meanSpeed);
+				DrawStringDecal({ 8.0f, 8.0f }, text, olc::BLACK);
+			}
+			if (isochrone.enabled) {
+				char text[160];
+				if (isochrone.HasResult()) {
+					snprintf(text, sizeof(text), "Isochrone: %d road tiles within %g min of %d,%d, searched in %.1f ms (I to hide, PgUp/PgDn)",
+						isochrone.Reachable(), isochrone.limitSeconds / 60.0f, isochrone.Source().x, isochrone.Source().y, isochrone.SearchMilliseconds());
+				}
+				else snprintf(text, sizeof(text), "Isochrone: point at a road (I to hide)");
+				DrawStringDecal({ 8.0f, 20.0f }, text, olc::BLACK);
+			}
+			if (heatmap.mode != TrafficHeatmap::Mode::Off) RenderTravelTimes(vSelectedCell);
 			
 
 			// Inventory
@@ -319,6 +408,9 @@ public:
 				if (currentTile == 0) {
 					renderer->RenderSprite(ui, uiStartPos, 3, 0, invTileSize);
 				}
+				else if (currentTile == roadGround) {
+					renderer->RenderSprite(ui, uiStartPos, 2, 3, invTileSize, roadTint);
+				}
 				else {
 					renderer->RenderSprite(ui, uiStartPos, 2, currentTile, invTileSize);
 				}
@@ -335,6 +427,19 @@ public:
 					"E", olc::BLACK, textScale);
 				DrawStringDecal(uiStartPos - olc::vf2d(0.5f, invTileSize.y + 0.5f) * vTileSize + olc::vf2d(0.0f, ((olc::vf2d(2.0f, 3.0f) * invTileSize + olc::vf2d(1.0f, 1.0f)) * vTileSize).y),
 					"H to hide/show", olc::BLACK, olc::vf2d(1.0f, 1.0f));
+
+				// What is on screen, above the inventory
+				olc::vi2d vVisibleMin, vVisibleMax;
+				GetVisibleCells(vVisibleMin, vVisibleMax);
+				areaStats.Update(pWorldTiles);
+				vVisibleMin = vVisibleMin.max({ 0, 0 });
+				vVisibleMax = vVisibleMax.min(vWorldSize);
+				AreaStats::Totals totals = areaStats.Query(vVisibleMin, vVisibleMax);
+				int area = std::max(0, vVisibleMax.x - vVisibleMin.x) * std::max(0, vVisibleMax.y - vVisibleMin.y);
+				char text[128];
+				snprintf(text, sizeof(text), "On screen: %d roads, %d trees, %d water, mean height %.1f",
+					totals.roads, totals.trees, totals.water, area > 0 ? (float)totals.heightSum / area : 0.0f);
+				DrawStringDecal(uiStartPos - olc::vf2d(0.5f, invTileSize.y + 0.5f) * vTileSize - olc::vf2d(0.0f, 12.0f), text, olc::BLACK);
 			}
 
 			// Debug info
@@ -383,6 +488,7 @@ public:
 			if (vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y) {
 				int i = vSelectedCell.y * vWorldSize.x + vSelectedCell.x;
 				pWorldTiles[i].height++;
+				OnTileChanged(i);
 			}
 		}
 
@@ -390,6 +496,7 @@ public:
 			if (vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y) {
 				int i = vSelectedCell.y * vWorldSize.x + vSelectedCell.x;
 				pWorldTiles[i].height--;
+				OnTileChanged(i);
 			}
 		}
 	}
@@ -398,24 +505,32 @@ public:
 		if (GetMouse(0).bHeld) {
 			if (vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y) {
 				int i = vSelectedCell.y * vWorldSize.x + vSelectedCell.x;
+				bool wasRoad = pWorldTiles[i].ground == roadGround;
 				pWorldTiles[i].ground = currentTile;
 
-				if (pWorldTiles[i].ground == 3 || pWorldTiles[i].ground == 0)
-					pWorldTiles[i].overlay = 0; // No plants of water and stone
+				if (pWorldTiles[i].ground == 3 || pWorldTiles[i].ground == 0 || pWorldTiles[i].ground == roadGround)
+					pWorldTiles[i].overlay = 0; // No plants of water, stone and road
+
+				bool isRoad = pWorldTiles[i].ground == roadGround;
+				if (isRoad != wasRoad) {
+					simulationRunner->Post({ SimulationCommand::Type::SetRoad, i, isRoad });
+				}
+				OnTileChanged(i);
 			}
 		}
 		if (GetMouse(1).bHeld) {
 			if (vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y) {
 				int i = vSelectedCell.y * vWorldSize.x + vSelectedCell.x;
-				if (pWorldTiles[i].ground != 3 && pWorldTiles[i].ground != 0) { 
+				if (pWorldTiles[i].ground != 3 && pWorldTiles[i].ground != 0 && pWorldTiles[i].ground != roadGround) { 
 					pWorldTiles[i].overlay = currentOverlay; // No plants of water and stone
+					OnTileChanged(i);
 				}
 			}
 		}
 
 		if (GetKey(olc::Key::Q).bPressed) {
 			currentTile++;
-			currentTile %= 4;
+			currentTile %= 5;
 		}
 		if (GetKey(olc::Key::E).bPressed) {
 			currentOverlay++;
@@ -423,11 +538,102 @@ public:
 		}
 	}
 
-	void RenderIsometricWorld(olc::vi2d vSelectedCell) {
-		const int heightMultiplier = -9;
-		SetDecalMode(olc::DecalMode::NORMAL);
-		for (int y = 0; y < vWorldSize.y; y++) {
-			for (int x = 0; x < vWorldSize.x; x++) {
+	// The screen is a diamond in world space, these are the cells in the box around it
+	void GetVisibleCells(olc::vi2d& vMin, olc::vi2d& vMax) {
+		olc::vf2d vScreenTL = isometricTV.GetWorldTL();
+		olc::vf2d vScreenBR = isometricTV.GetWorldBR();
+		olc::vf2d corners[4] = {
+			ScreenToWorld(vScreenTL.x, vScreenTL.y), ScreenToWorld(vScreenBR.x, vScreenTL.y),
+			ScreenToWorld(vScreenTL.x, vScreenBR.y), ScreenToWorld(vScreenBR.x, vScreenBR.y)
+		};
+
+		olc::vf2d vCornersMin = corners[0];
+		olc::vf2d vCornersMax = corners[0];
+		for (const olc::vf2d& corner : corners) {
+			vCornersMin = vCornersMin.min(corner);
+			vCornersMax = vCornersMax.max(corner);
+		}
+		vMin = vCornersMin.floor();
+		vMax = vCornersMax.ceil();
+	}
+
+	// The simulation gets the cells around the screen
+	void UpdateSimulationFocus() {
+		if (!simulationRunner) return;
+
+		olc::vi2d vNewMin, vNewMax;
+		GetVisibleCells(vNewMin, vNewMax);
+		// Tiles stick up and down by their height, so leave some room
+		vNewMin -= olc::vi2d(2, 2);
+		vNewMax += olc::vi2d(2, 2);
+		if (vNewMin == vFocusMin && vNewMax == vFocusMax) return;
+
+		vFocusMin = vNewMin;
+		vFocusMax = vNewMax;
+		SimulationCommand command = { SimulationCommand::Type::SetFocus };
+		command.focusMin = vFocusMin;
+		command.focusMax = vFocusMax;
+		simulationRunner->Post(command);
+	}
+
+	// Space pauses, left and right jump a minute, up and down change the speed, the timeline at the bottom scrubs
+	void HandlePlaybackControls(float fElapsedTime) {
+		if (GetKey(olc::Key::SPACE).bPressed) player.paused = !player.paused;
+		if (GetKey(olc::Key::UP).bPressed) player.speed = std::min(player.speed * 2.0, 4096.0);
+		if (GetKey(olc::Key::DOWN).bPressed) player.speed = std::max(player.speed * 0.5, 0.125);
+
+		uint64_t minute = (uint64_t)(60.0f / player.Reader().TickLength());
+		uint64_t tick = player.CurrentTick();
+		if (GetKey(olc::Key::RIGHT).bPressed) player.Seek(tick + minute);
+		if (GetKey(olc::Key::LEFT).bPressed) player.Seek(tick > minute ? tick - minute : 0);
+
+		olc::vi2d vMouse = GetMousePos();
+		if (GetMouse(0).bPressed && vMouse.y >= ScreenHeight() - timelineHeight) scrubbing = true;
+		if (!GetMouse(0).bHeld) scrubbing = false;
+
+		if (scrubbing) player.SeekProgress((float)vMouse.x / ScreenWidth());
+		else player.Update(fElapsedTime);
+	}
+
+	static constexpr int timelineHeight = 24;
+
+	void RenderPlaybackTimeline() {
+		olc::vf2d pos = { 0.0f, (float)(ScreenHeight() - timelineHeight) };
+		olc::vf2d size = { (float)ScreenWidth(), (float)timelineHeight };
+		FillRectDecal(pos, size, olc::Pixel(40, 40, 48, 200));
+		FillRectDecal(pos, { size.x * player.Progress(), size.y }, olc::Pixel(90, 120, 200, 200));
+
+		int seconds = (int)(player.CurrentTick() * player.Reader().TickLength());
+		char text[64];
+		snprintf(text, sizeof(text), "%02d:%02d:%02d  x%g%s", seconds / 3600, seconds / 60 % 60, seconds % 60, player.speed, player.paused ? "  paused" : "");
+		DrawStringDecal(pos + olc::vf2d(8.0f, (timelineHeight - 8) * 0.5f), text, olc::WHITE);
+	}
+
+	void OnTileChanged(int worldIndex) {
+		chunkDrawCaches[chunks.ChunkOfCell(worldIndex)].dirty = true;
+		areaStats.ChunkChanged(chunks.ChunkOfCell(worldIndex));
+	}
+
+	void RebuildChunkDrawCache(int chunk, int heightMultiplier) {
+		ChunkDrawCache& cache = chunkDrawCaches[chunk];
+		cache.items.clear();
+		cache.vBoundsMin = { INFINITY, INFINITY };
+		cache.vBoundsMax = { -INFINITY, -INFINITY };
+
+		auto AddItem = [&](olc::vf2d screenPos, int cell, int tileRow, int tileCol, olc::Pixel tint, bool isGround) {
+			cache.items.push_back({ screenPos, cell, tileRow, tileCol, tint, isGround });
+
+			// Same maths as Renderer::RenderSprite, so the chunk is culled exactly when all of its sprites would be
+			olc::vf2d spritePos = screenPos - olc::vf2d(0.0f, (float)(renderer->rows[tileRow].spriteVerticalOffset * vTileSize.y));
+			olc::vf2d spriteSize = renderer->GetSpriteSheetPos(tileRow, tileCol).size;
+			cache.vBoundsMin = cache.vBoundsMin.min(spritePos);
+			cache.vBoundsMax = cache.vBoundsMax.max(spritePos + spriteSize);
+		};
+
+		olc::vi2d begin = chunks.ChunkBegin(chunk);
+		olc::vi2d end = chunks.ChunkEnd(chunk);
+		for (int y = begin.y; y < end.y; y++) {
+			for (int x = begin.x; x < end.x; x++) {
 
 				int worldIndex = y * vWorldSize.x + x;
 				int groundType = pWorldTiles[worldIndex].ground;
@@ -435,6 +641,7 @@ public:
 				int height = pWorldTiles[worldIndex].height * heightMultiplier;
 
 				int groundTileRow = 2;
+				olc::Pixel groundTint = olc::WHITE;
 
 				bool isWater = (groundType == 0);
 				if (isWater) {
@@ -442,28 +649,235 @@ public:
 					groundTileRow = 3;
 				}
 
-				if (pWorldTiles[worldIndex].height == 1 &&
-					pWorldTiles[worldIndex + 1].height == 0 &&
-					pWorldTiles[worldIndex + vWorldSize.x].height == 0 &&
-					pWorldTiles[worldIndex + vWorldSize.x + 1].height == 0 && false) {
+				bool isRoad = (groundType == roadGround);
+				if (isRoad) {
+					groundType = 3;
+					groundTint = roadTint;
 				}
-				else {
-					renderer->RenderSpriteIsometric(isometricTV, { x, y }, groundTileRow, groundType, { 0, height });
 
-					if (x == vSelectedCell.x && y == vSelectedCell.y) {
-						renderer->RenderSpriteIsometric(isometricTV, vSelectedCell, 1, 0, { 0, height });
-					}
+				olc::vf2d screenPos = WorldToScreen((float)x, (float)y) + olc::vf2d(0.0f, (float)height);
+				AddItem(screenPos, worldIndex, groundTileRow, groundType, groundTint, true);
 
-					renderer->RenderSpriteIsometric(isometricTV, { x, y }, 4, overlayType, { 0, height });
+				// Overlay 0 is an empty sprite, no point drawing it
+				if (overlayType != 0) {
+					AddItem(screenPos, worldIndex, 4, overlayType, olc::WHITE, false);
 				}
 			}
 		}
+
+		cache.dirty = false;
+	}
+
+	void RenderIsometricWorld(olc::vi2d vSelectedCell, olc::vf2d vMouseWorld) {
+		const int heightMultiplier = -9;
+
+		std::vector<int> dirtyChunks;
+		for (int chunk = 0; chunk < chunks.ChunkCount(); chunk++) {
+			if (chunkDrawCaches[chunk].dirty) dirtyChunks.push_back(chunk);
+		}
+		jobs.ParallelFor(0, (int)dirtyChunks.size(), 1, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) RebuildChunkDrawCache(dirtyChunks[i], heightMultiplier);
+		});
+
+		int selectedIndex = -1;
+		if (vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y) {
+			selectedIndex = vSelectedCell.y * vWorldSize.x + vSelectedCell.x;
+		}
+
+		// Chunks are drawn in row order, which keeps the back-to-front order of the tiles:
+		// tiles of neighbouring chunks that are drawn out of depth order never overlap on screen
+		SetDecalMode(olc::DecalMode::NORMAL);
+		for (const ChunkDrawCache& cache : chunkDrawCaches) {
+			if (!isometricTV.IsRectVisible(cache.vBoundsMin, cache.vBoundsMax - cache.vBoundsMin)) continue;
+
+			for (const ChunkDrawCache::Item& item : cache.items) {
+				renderer->RenderSprite(isometricTV, item.screenPos, item.tileRow, item.tileCol, olc::vf2d(1.0f, 1.0f), item.tint);
+
+				if (item.isGround && item.cell == selectedIndex) {
+					renderer->RenderSprite(isometricTV, item.screenPos, 1, 0, olc::vf2d(1.0f, 1.0f));
+				}
+			}
+		}
+
+		// Draw one tick behind the simulation, blending between the two latest snapshots
+		SimulationFrame frame = playingBack ? player.GetFrame() : simulationRunner->GetFrame();
+
+		// Over the ground, under the vehicles
+		if (heatmap.mode != TrafficHeatmap::Mode::Off) {
+			heatmap.Update(frame);
+			heatmap.Draw(isometricTV, vTileSize);
+		}
+		if (isochrone.enabled) {
+			bool onRoad = vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y
+				&& pWorldTiles[vSelectedCell.y * vWorldSize.x + vSelectedCell.x].ground == roadGround;
+			isochrone.Update(*frame.current, onRoad ? vSelectedCell.y * vWorldSize.x + vSelectedCell.x : -1, jobs);
+			isochrone.Draw(isometricTV, vTileSize);
+		}
+
+		RenderVehicles(frame, heightMultiplier);
+		HighlightVehicleAt(frame, vMouseWorld);
+	}
+
+	// Percentiles of every trip so far, how the route cache is doing, and percentiles of the links out of the road under
+	// the cursor. The simulation is told which cell to watch and puts its links into the next snapshot, so what is shown
+	// lags the cursor by a tick
+	void RenderTravelTimes(olc::vi2d vSelectedCell) {
+		bool inWorld = vSelectedCell.x >= 0 && vSelectedCell.x < vWorldSize.x && vSelectedCell.y >= 0 && vSelectedCell.y < vWorldSize.y;
+		simulation.WatchCell(inWorld ? vSelectedCell.y * vWorldSize.x + vSelectedCell.x : -1);
+
+		// Replays don't record travel times
+		if (playingBack) return;
+		SimulationFrame frame = simulationRunner->GetFrame();
+		const SimulationSnapshot& snapshot = *frame.current;
+
+		char text[160];
+		const SimulationSnapshot::TravelTimes& trips = snapshot.tripTimes;
+		snprintf(text, sizeof(text), "Trips: %llu done, p50 %.1f / p90 %.1f / p99 %.1f min",
+			(unsigned long long)trips.count, trips.p50 / 60.0f, trips.p90 / 60.0f, trips.p99 / 60.0f);
+		DrawStringDecal({ 8.0f, 32.0f }, text, olc::BLACK);
+
+		const RouteCache::Metrics& cache = snapshot.routeCache;
+		uint64_t lookups = cache.hits + cache.misses;
+		snprintf(text, sizeof(text), "Route cache: %.1f%% hits, %zu entries sharing %zu routes, %.1f MB",
+			lookups > 0 ? 100.0 * cache.hits / lookups : 0.0, cache.entries, cache.routes, cache.memoryBytes / 1e6);
+		DrawStringDecal({ 8.0f, 44.0f }, text, olc::BLACK);
+
+		float y = 56.0f;
+		for (const auto& [target, times] : snapshot.watchedLinks) {
+			if (times.count == 0) continue;
+			snprintf(text, sizeof(text), "Link %d,%d to %d,%d: %llu vehicles, p50 %.1f / p90 %.1f / p99 %.1f s",
+				snapshot.watchedCell % vWorldSize.x, snapshot.watchedCell / vWorldSize.x, target % vWorldSize.x, target / vWorldSize.x,
+				(unsigned long long)times.count, times.p50, times.p90, times.p99);
+			DrawStringDecal({ 8.0f, y }, text, olc::BLACK);
+			y += 12.0f;
+		}
+	}
+
+	// Outlines the vehicle drawn under the cursor, the one drawn last if they overlap, as that is the one on top.
+	// Failing that the nearest one within half a cell, for which the grid is only built again when a new snapshot comes in.
+	// Needs the boxes RenderVehicles just drew, one per vehicle of the current snapshot
+	void HighlightVehicleAt(const SimulationFrame& frame, olc::vf2d vWorldPos) {
+		const auto& vehicles = frame.current->vehicles;
+
+		int picked = -1;
+		BatchGeometry::Overlaps(isometricTV.ScreenToWorld(GetMousePos()), vehicleBoxes, vehicleUnderCursor);
+		BatchGeometry::ForEachSet(vehicleUnderCursor, [&](int i) { picked = i; });
+
+		if (picked < 0) {
+			if (frame.current->time != vehicleGridTime) {
+				vehicleGrid.Build((int)vehicles.size(), [&](int i) { return vehicles[i].pos; });
+				vehicleGridTime = frame.current->time;
+			}
+			picked = vehicleGrid.Nearest(vWorldPos, 0.5f);
+			if (picked < 0) return;
+		}
+
+		olc::vf2d screenPos = olc::vf2d(vehicleBoxes.x[picked], vehicleBoxes.y[picked]) + olc::vf2d(vehicleBoxes.width[picked], vehicleBoxes.height[picked]) * 0.5f;
+
+		// The transformed view has no outlines, so four thin rectangles
+		const olc::vf2d outlineMin = screenPos - olc::vf2d(4.0f, 4.0f);
+		isometricTV.FillRectDecal(outlineMin, { 8.0f, 1.0f }, olc::WHITE);
+		isometricTV.FillRectDecal(outlineMin + olc::vf2d(0.0f, 7.0f), { 8.0f, 1.0f }, olc::WHITE);
+		isometricTV.FillRectDecal(outlineMin, { 1.0f, 8.0f }, olc::WHITE);
+		isometricTV.FillRectDecal(outlineMin + olc::vf2d(7.0f, 0.0f), { 1.0f, 8.0f }, olc::WHITE);
+		isometricTV.DrawStringDecal(screenPos + olc::vf2d(6.0f, -4.0f), "#" + std::to_string(vehicles[picked].id), olc::WHITE, { 0.5f, 0.5f });
+	}
+
+	void RenderVehicles(const SimulationFrame& frame, int heightMultiplier) {
+		const auto& previousVehicles = frame.previous->vehicles;
+		const auto& currentVehicles = frame.current->vehicles;
+
+		const olc::vf2d vehicleSize = { 4.0f, 4.0f };
+		vehicleBoxes.Clear();
+		vehicleColours.clear();
+
+		// Both lists are sorted by id, so matching vehicles up is a single merge-like pass
+		size_t p = 0;
+		for (const auto& vehicle : currentVehicles) {
+			while (p < previousVehicles.size() && previousVehicles[p].id < vehicle.id) p++;
+
+			olc::vf2d pos = vehicle.pos;
+			if (p < previousVehicles.size() && previousVehicles[p].id == vehicle.id) {
+				olc::vf2d from = previousVehicles[p].pos;
+				// Don't smear vehicles that jumped, e.g. after the road under them was rebuilt
+				if ((pos - from).mag2() < 1.0f) pos = from + (pos - from) * frame.alpha;
+			}
+
+			olc::vi2d cell = pos.floor();
+			int height = 0;
+			if (cell.x >= 0 && cell.x < vWorldSize.x && cell.y >= 0 && cell.y < vWorldSize.y) {
+				height = pWorldTiles[cell.y * vWorldSize.x + cell.x].height * heightMultiplier;
+			}
+
+			// The top corner of a cell's sprite is half a tile to the right of its world position
+			olc::vf2d screenPos = WorldToScreen(pos.x, pos.y) + olc::vf2d(vTileSize.x * 0.5f, (float)height);
+
+			// Cheap hash of the id so each vehicle keeps its colour
+			uint32_t hash = vehicle.id * 2654435761u;
+			vehicleColours.push_back(olc::Pixel(64 + (hash >> 24) % 192, 64 + (hash >> 16) % 192, 64 + (hash >> 8) % 192));
+			vehicleBoxes.Add({ screenPos - vehicleSize * 0.5f, vehicleSize });
+		}
+
+		// Only the ones on screen become decals, when zoomed in that is a small part of them
+		olc::vf2d visibleMin = isometricTV.GetWorldTL();
+		BatchGeometry::Overlaps(olc::utils::geom2d::rect<float>(visibleMin, isometricTV.GetWorldBR() - visibleMin), vehicleBoxes, vehicleOnScreen);
+		BatchGeometry::ForEachSet(vehicleOnScreen, [&](int i) {
+			isometricTV.FillRectDecal({ vehicleBoxes.x[i], vehicleBoxes.y[i] }, vehicleSize, vehicleColours[i]);
+		});
 	}
 };
 
-int main()
+int main(int argc, char* argv[])
 {
+	if (SweepOptions::Requested(argc, argv)) {
+		SweepOptions options;
+		SweepDescription sweep;
+		if (!options.Parse(argc, argv) || !sweep.Load(options.sweepFile)) return 1;
+		return SweepRunner(sweep, options).Run();
+	}
+
+	if (ReplayCheckOptions::Requested(argc, argv)) {
+		ReplayCheckOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return CheckReplay(options.replayFile, options.threads);
+	}
+
+	if (SpatialBenchmarkOptions::Requested(argc, argv)) {
+		SpatialBenchmarkOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return RunSpatialBenchmark(options);
+	}
+
+	if (QuadTreeBenchmarkOptions::Requested(argc, argv)) {
+		QuadTreeBenchmarkOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return RunQuadTreeBenchmark(options);
+	}
+
+	if (QueueCheckOptions::Requested(argc, argv)) {
+		QueueCheckOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return CheckQueueFlows(options);
+	}
+
+	if (FlowCheckOptions::Requested(argc, argv)) {
+		FlowCheckOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return CheckTripFlow(options);
+	}
+
+	if (HeadlessOptions::Requested(argc, argv)) {
+		HeadlessOptions options;
+		if (!options.Parse(argc, argv)) return 1;
+		return RunHeadless(options);
+	}
+
 	Game demo;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (strcmp(argv[i], "--record") == 0) demo.replayFile = argv[i + 1];
+		if (strcmp(argv[i], "--trajectory") == 0) demo.trajectoryFile = argv[i + 1];
+		if (strcmp(argv[i], "--play") == 0) demo.playbackFile = argv[i + 1];
+	}
 	if (demo.Construct(1280, 720, 1, 1))
 		demo.Start();
 	return 0;